@@ -0,0 +1,338 @@
+#include "acpi.h"
+
+#define CACHE_LINE_UP(value) (((value) + ACPI_CACHE_LINE - 1) & ~(UINTN)(ACPI_CACHE_LINE - 1))
+
+static EFI_GUID acpi_20_guid = ACPI_20_TABLE_GUID;
+static EFI_GUID acpi_10_guid = ACPI_TABLE_GUID;
+
+// The tables the topology comes from (NULL if they aren't there)
+typedef struct
+{
+    acpi_madt_t *madt;
+    acpi_srat_t *srat;
+    acpi_slit_t *slit;
+} acpi_tables_t;
+
+// Helper function to check a table's bytes add up to 0
+static BOOLEAN checksum_ok(VOID *table, UINTN length)
+{
+    UINT8 sum = 0;
+    for (UINTN i = 0; i < length; ++i)
+        sum += ((UINT8 *)table)[i];
+    return sum == 0;
+}
+
+// Helper function to find the RSDP (the ACPI 2.0 one if the firmware gives both)
+static acpi_rsdp_t *find_rsdp(VOID)
+{
+    acpi_rsdp_t *found = NULL;
+
+    for (UINTN i = 0; i < ST->NumberOfTableEntries; ++i)
+    {
+        EFI_CONFIGURATION_TABLE *table = &ST->ConfigurationTable[i];
+        acpi_rsdp_t *rsdp = table->VendorTable;
+        BOOLEAN is_20 = CompareGuid(&table->VendorGuid, &acpi_20_guid) == 0;
+
+        if (!is_20 && CompareGuid(&table->VendorGuid, &acpi_10_guid) != 0)
+            continue;
+        if (rsdp == NULL || rsdp->signature != ACPI_RSDP_SIGNATURE || !checksum_ok(rsdp, 20))
+            continue;
+
+        found = rsdp;
+        if (is_20)
+            break;
+    }
+
+    return found;
+}
+
+// Helper function to pick the tables we want out of the XSDT (or the RSDT before ACPI 2.0)
+static VOID find_tables(acpi_rsdp_t *rsdp, OUT acpi_tables_t *tables)
+{
+    ZeroMem(tables, sizeof(*tables));
+
+    BOOLEAN extended = rsdp->revision >= 2 && rsdp->xsdt_address != 0 && rsdp->length >= sizeof(acpi_rsdp_t)
+        && checksum_ok(rsdp, rsdp->length);
+    acpi_header_t *root = (acpi_header_t *)(UINTN)(extended ? rsdp->xsdt_address : rsdp->rsdt_address);
+    if (root == NULL || root->length < sizeof(acpi_header_t) || !checksum_ok(root, root->length))
+        return;
+
+    UINTN entry_size = extended ? sizeof(UINT64) : sizeof(UINT32);
+    UINTN count = (root->length - sizeof(acpi_header_t)) / entry_size;
+    UINT8 *entries = (UINT8 *)(root + 1);
+
+    for (UINTN i = 0; i < count; ++i)
+    {
+        // The entries aren't necessarily aligned
+        UINT64 address = 0;
+        CopyMem(&address, entries + i * entry_size, entry_size);
+
+        acpi_header_t *header = (acpi_header_t *)(UINTN)address;
+        if (header == NULL || header->length < sizeof(acpi_header_t) || !checksum_ok(header, header->length))
+            continue;
+
+        if (header->signature == ACPI_MADT_SIGNATURE && header->length >= sizeof(acpi_madt_t) && tables->madt == NULL)
+            tables->madt = (acpi_madt_t *)header;
+        else if (header->signature == ACPI_SRAT_SIGNATURE && header->length >= sizeof(acpi_srat_t) && tables->srat == NULL)
+            tables->srat = (acpi_srat_t *)header;
+        else if (header->signature == ACPI_SLIT_SIGNATURE && header->length >= sizeof(acpi_slit_t) && tables->slit == NULL)
+            tables->slit = (acpi_slit_t *)header;
+    }
+}
+
+// Helper function to step through the entries after a table's fixed part (NULL at the end, or at a broken entry)
+static acpi_entry_t *next_entry(acpi_header_t *table, UINTN fixed_size, acpi_entry_t *entry)
+{
+    UINT8 *end = (UINT8 *)table + table->length;
+    UINT8 *next = entry == NULL ? (UINT8 *)table + fixed_size : (UINT8 *)entry + entry->length;
+
+    if (next + sizeof(acpi_entry_t) > end)
+        return NULL;
+
+    entry = (acpi_entry_t *)next;
+    if (entry->length < sizeof(acpi_entry_t) || next + entry->length > end)
+        return NULL;
+    return entry;
+}
+
+// Helper function to add a processor (only counting it if there's no array yet)
+static VOID add_cpu(boot_acpi_t *acpi, boot_cpu_t *cpus, UINT32 apic_id, UINT32 acpi_id, UINT32 flags, UINT32 extra)
+{
+    // Neither flag means the processor can't be used at all
+    if (!(flags & (ACPI_PROCESSOR_ENABLED | ACPI_PROCESSOR_ONLINE_CAPABLE)))
+        return;
+
+    if (cpus != NULL)
+    {
+        boot_cpu_t *cpu = &cpus[acpi->cpu_count];
+        cpu->apic_id = apic_id;
+        cpu->acpi_id = acpi_id;
+        cpu->node = 0;
+        cpu->flags = extra
+            | (flags & ACPI_PROCESSOR_ENABLED ? BOOT_CPU_ENABLED : 0)
+            | (flags & ACPI_PROCESSOR_ONLINE_CAPABLE ? BOOT_CPU_ONLINE_CAPABLE : 0);
+    }
+    ++acpi->cpu_count;
+}
+
+// Helper function to go through the MADT, counting entries, and filling them in too once the arrays are there
+static VOID read_madt(acpi_madt_t *madt, boot_acpi_t *acpi, boot_cpu_t *cpus, boot_ioapic_t *ioapics,
+    boot_interrupt_override_t *overrides)
+{
+    acpi->cpu_count = 0;
+    acpi->ioapic_count = 0;
+    acpi->override_count = 0;
+    acpi->local_apic = madt->local_apic;
+    acpi->madt_flags = madt->flags & ACPI_MADT_PCAT_COMPAT ? BOOT_ACPI_PCAT_COMPAT : 0;
+
+    for (acpi_entry_t *entry = next_entry(&madt->header, sizeof(*madt), NULL); entry != NULL;
+        entry = next_entry(&madt->header, sizeof(*madt), entry))
+    {
+        if (entry->type == ACPI_MADT_LOCAL_APIC && entry->length >= sizeof(acpi_madt_local_apic_t))
+        {
+            // 0xFF means the processor has an x2APIC entry instead
+            acpi_madt_local_apic_t *local_apic = (acpi_madt_local_apic_t *)entry;
+            if (local_apic->apic_id != 0xFF)
+                add_cpu(acpi, cpus, local_apic->apic_id, local_apic->acpi_id, local_apic->flags, 0);
+        }
+        else if (entry->type == ACPI_MADT_LOCAL_X2APIC && entry->length >= sizeof(acpi_madt_local_x2apic_t))
+        {
+            acpi_madt_local_x2apic_t *local_x2apic = (acpi_madt_local_x2apic_t *)entry;
+            add_cpu(acpi, cpus, local_x2apic->apic_id, local_x2apic->acpi_id, local_x2apic->flags, BOOT_CPU_X2APIC);
+        }
+        else if (entry->type == ACPI_MADT_IOAPIC && entry->length >= sizeof(acpi_madt_ioapic_t))
+        {
+            acpi_madt_ioapic_t *ioapic = (acpi_madt_ioapic_t *)entry;
+            if (ioapics != NULL)
+            {
+                ioapics[acpi->ioapic_count].address = ioapic->address;
+                ioapics[acpi->ioapic_count].id = ioapic->id;
+                ioapics[acpi->ioapic_count].gsi_base = ioapic->gsi_base;
+            }
+            ++acpi->ioapic_count;
+        }
+        else if (entry->type == ACPI_MADT_INTERRUPT_OVERRIDE && entry->length >= sizeof(acpi_madt_interrupt_override_t))
+        {
+            acpi_madt_interrupt_override_t *override = (acpi_madt_interrupt_override_t *)entry;
+            if (overrides != NULL)
+            {
+                overrides[acpi->override_count].bus = override->bus;
+                overrides[acpi->override_count].source = override->source;
+                overrides[acpi->override_count].flags = override->flags;
+                overrides[acpi->override_count].gsi = override->gsi;
+            }
+            ++acpi->override_count;
+        }
+        else if (entry->type == ACPI_MADT_LOCAL_APIC_ADDRESS && entry->length >= sizeof(acpi_madt_local_apic_address_t))
+            acpi->local_apic = ((acpi_madt_local_apic_address_t *)entry)->address;
+    }
+}
+
+// Helper function to give a processor its node
+static VOID set_cpu_node(boot_acpi_t *acpi, boot_cpu_t *cpus, UINT32 apic_id, UINT32 node)
+{
+    for (UINTN i = 0; i < acpi->cpu_count; ++i)
+    {
+        if (cpus[i].apic_id == apic_id)
+        {
+            cpus[i].node = node;
+            return;
+        }
+    }
+}
+
+// Helper function to go through the SRAT, counting memory ranges and nodes, and filling them in too once the arrays are there
+static VOID read_srat(acpi_srat_t *srat, boot_acpi_t *acpi, boot_cpu_t *cpus, boot_numa_range_t *ranges)
+{
+    acpi->numa_range_count = 0;
+    acpi->node_count = 0;
+
+    for (acpi_entry_t *entry = next_entry(&srat->header, sizeof(*srat), NULL); entry != NULL;
+        entry = next_entry(&srat->header, sizeof(*srat), entry))
+    {
+        UINT32 domain;
+
+        if (entry->type == ACPI_SRAT_LOCAL_APIC && entry->length >= sizeof(acpi_srat_local_apic_t))
+        {
+            acpi_srat_local_apic_t *local_apic = (acpi_srat_local_apic_t *)entry;
+            if (!(local_apic->flags & ACPI_SRAT_ENABLED))
+                continue;
+
+            domain = local_apic->domain_low | (UINT32)local_apic->domain_high[0] << 8
+                | (UINT32)local_apic->domain_high[1] << 16 | (UINT32)local_apic->domain_high[2] << 24;
+            if (cpus != NULL)
+                set_cpu_node(acpi, cpus, local_apic->apic_id, domain);
+        }
+        else if (entry->type == ACPI_SRAT_LOCAL_X2APIC && entry->length >= sizeof(acpi_srat_local_x2apic_t))
+        {
+            acpi_srat_local_x2apic_t *local_x2apic = (acpi_srat_local_x2apic_t *)entry;
+            if (!(local_x2apic->flags & ACPI_SRAT_ENABLED))
+                continue;
+
+            domain = local_x2apic->domain;
+            if (cpus != NULL)
+                set_cpu_node(acpi, cpus, local_x2apic->apic_id, domain);
+        }
+        else if (entry->type == ACPI_SRAT_MEMORY && entry->length >= sizeof(acpi_srat_memory_t))
+        {
+            acpi_srat_memory_t *memory = (acpi_srat_memory_t *)entry;
+            if (!(memory->flags & ACPI_SRAT_ENABLED) || memory->length == 0)
+                continue;
+
+            domain = memory->domain;
+            if (ranges != NULL)
+            {
+                boot_numa_range_t *range = &ranges[acpi->numa_range_count];
+                range->start = memory->base;
+                range->size = memory->length;
+                range->node = domain;
+                range->flags = (memory->flags & ACPI_SRAT_HOT_PLUGGABLE ? BOOT_NUMA_HOT_PLUGGABLE : 0)
+                    | (memory->flags & ACPI_SRAT_NON_VOLATILE ? BOOT_NUMA_NON_VOLATILE : 0);
+            }
+            ++acpi->numa_range_count;
+        }
+        else
+            continue;
+
+        if (domain >= acpi->node_count)
+            acpi->node_count = domain + 1;
+    }
+}
+
+// Helper function to find the APIC ID of the processor we're running on
+static UINT32 current_apic_id(VOID)
+{
+    UINT32 eax, ebx, ecx, edx;
+
+    // Leaf 0xB has the full x2APIC ID, leaf 1 only the low 8 bits
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+    if (eax >= 0xB)
+    {
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0xB), "c"(0));
+        if (ebx != 0)
+            return edx;
+    }
+
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    return ebx >> 24;
+}
+
+EFI_STATUS acpi_parse(OUT boot_acpi_t *acpi)
+{
+    EFI_STATUS status;
+    acpi_tables_t tables;
+
+    ZeroMem(acpi, sizeof(*acpi));
+
+    acpi_rsdp_t *rsdp = find_rsdp();
+    if (rsdp == NULL)
+        return EFI_NOT_FOUND;
+
+    find_tables(rsdp, &tables);
+    if (tables.madt == NULL)
+        return EFI_NOT_FOUND;
+
+    // A SLIT is only any use if it's all there
+    UINT64 locality_count = 0;
+    if (tables.slit != NULL && tables.slit->locality_count <= 0xFFFF
+        && sizeof(acpi_slit_t) + tables.slit->locality_count * tables.slit->locality_count <= tables.slit->header.length)
+        locality_count = tables.slit->locality_count;
+
+    // Count everything, then lay the arrays out in one block with each on its own cache line
+    read_madt(tables.madt, acpi, NULL, NULL, NULL);
+    if (tables.srat != NULL)
+        read_srat(tables.srat, acpi, NULL, NULL);
+
+    UINTN cpus_offset = 0;
+    UINTN ioapics_offset = cpus_offset + CACHE_LINE_UP(acpi->cpu_count * sizeof(boot_cpu_t));
+    UINTN overrides_offset = ioapics_offset + CACHE_LINE_UP(acpi->ioapic_count * sizeof(boot_ioapic_t));
+    UINTN ranges_offset = overrides_offset + CACHE_LINE_UP(acpi->override_count * sizeof(boot_interrupt_override_t));
+    UINTN distances_offset = ranges_offset + CACHE_LINE_UP(acpi->numa_range_count * sizeof(boot_numa_range_t));
+    UINTN size = distances_offset + CACHE_LINE_UP(locality_count * locality_count);
+
+    EFI_PHYSICAL_ADDRESS region = 0;
+    UINTN pages = EFI_SIZE_TO_PAGES(size);
+    if (pages > 0)
+    {
+        status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, pages, &region);
+        if (EFI_ERROR(status))
+        {
+            ZeroMem(acpi, sizeof(*acpi));
+            return status;
+        }
+    }
+
+    UINT8 *base = (UINT8 *)(UINTN)region;
+    boot_cpu_t *cpus = (boot_cpu_t *)(base + cpus_offset);
+    read_madt(tables.madt, acpi, cpus, (boot_ioapic_t *)(base + ioapics_offset),
+        (boot_interrupt_override_t *)(base + overrides_offset));
+    if (tables.srat != NULL)
+        read_srat(tables.srat, acpi, cpus, (boot_numa_range_t *)(base + ranges_offset));
+    if (locality_count > 0)
+        CopyMem(base + distances_offset, tables.slit->distances, locality_count * locality_count);
+
+    // Put the bootstrap processor first
+    UINT32 bsp_apic_id = current_apic_id();
+    for (UINTN i = 0; i < acpi->cpu_count; ++i)
+    {
+        if (cpus[i].apic_id == bsp_apic_id)
+        {
+            boot_cpu_t bsp = cpus[i];
+            cpus[i] = cpus[0];
+            cpus[0] = bsp;
+            cpus[0].flags |= BOOT_CPU_BSP;
+            break;
+        }
+    }
+
+    acpi->rsdp = (UINT64)(UINTN)rsdp;
+    acpi->cpus = region + cpus_offset;
+    acpi->ioapics = region + ioapics_offset;
+    acpi->overrides = region + overrides_offset;
+    acpi->numa_ranges = region + ranges_offset;
+    acpi->distances = locality_count > 0 ? region + distances_offset : 0;
+    acpi->locality_count = locality_count;
+    acpi->region = region;
+    acpi->region_pages = pages;
+    return EFI_SUCCESS;
+}
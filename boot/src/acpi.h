@@ -0,0 +1,182 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "bootinfo.h"
+
+// --------------------------
+// Table constants
+// --------------------------
+
+#define ACPI_RSDP_SIGNATURE 0x2052545020445352ULL  // "RSD PTR "
+#define ACPI_MADT_SIGNATURE 0x43495041              // "APIC"
+#define ACPI_SRAT_SIGNATURE 0x54415253              // "SRAT"
+#define ACPI_SLIT_SIGNATURE 0x54494C53              // "SLIT"
+
+// MADT entry types
+#define ACPI_MADT_LOCAL_APIC 0
+#define ACPI_MADT_IOAPIC 1
+#define ACPI_MADT_INTERRUPT_OVERRIDE 2
+#define ACPI_MADT_LOCAL_APIC_ADDRESS 5
+#define ACPI_MADT_LOCAL_X2APIC 9
+
+// SRAT entry types
+#define ACPI_SRAT_LOCAL_APIC 0
+#define ACPI_SRAT_MEMORY 1
+#define ACPI_SRAT_LOCAL_X2APIC 2
+
+// Flags
+#define ACPI_PROCESSOR_ENABLED 1
+#define ACPI_PROCESSOR_ONLINE_CAPABLE 2
+#define ACPI_MADT_PCAT_COMPAT 1
+#define ACPI_SRAT_ENABLED 1
+#define ACPI_SRAT_HOT_PLUGGABLE 2
+#define ACPI_SRAT_NON_VOLATILE 4
+
+// The arrays handed to the kernel each start on one of these
+#define ACPI_CACHE_LINE 64
+
+// --------------------------
+// Table structures
+// --------------------------
+
+typedef struct
+{
+    UINT64 signature;               // ACPI_RSDP_SIGNATURE
+    UINT8 checksum;                 // Covers the first 20 bytes
+    UINT8 oem_id[6];
+    UINT8 revision;                 // 2 or more if the fields after rsdt_address are there
+    UINT32 rsdt_address;
+    UINT32 length;
+    UINT64 xsdt_address;
+    UINT8 extended_checksum;
+    UINT8 reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct
+{
+    UINT32 signature;
+    UINT32 length;                  // Including this header
+    UINT8 revision;
+    UINT8 checksum;
+    UINT8 oem_id[6];
+    UINT8 oem_table_id[8];
+    UINT32 oem_revision;
+    UINT32 creator_id;
+    UINT32 creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+// Every MADT and SRAT entry starts with this
+typedef struct
+{
+    UINT8 type;
+    UINT8 length;
+} __attribute__((packed)) acpi_entry_t;
+
+typedef struct
+{
+    acpi_header_t header;
+    UINT32 local_apic;
+    UINT32 flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT8 acpi_id;
+    UINT8 apic_id;
+    UINT32 flags;
+} __attribute__((packed)) acpi_madt_local_apic_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT8 id;
+    UINT8 reserved;
+    UINT32 address;
+    UINT32 gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT8 bus;
+    UINT8 source;
+    UINT32 gsi;
+    UINT16 flags;
+} __attribute__((packed)) acpi_madt_interrupt_override_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT16 reserved;
+    UINT64 address;
+} __attribute__((packed)) acpi_madt_local_apic_address_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT16 reserved;
+    UINT32 apic_id;
+    UINT32 flags;
+    UINT32 acpi_id;
+} __attribute__((packed)) acpi_madt_local_x2apic_t;
+
+typedef struct
+{
+    acpi_header_t header;
+    UINT32 reserved1;
+    UINT64 reserved2;
+} __attribute__((packed)) acpi_srat_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT8 domain_low;
+    UINT8 apic_id;
+    UINT32 flags;
+    UINT8 sapic_eid;
+    UINT8 domain_high[3];
+    UINT32 clock_domain;
+} __attribute__((packed)) acpi_srat_local_apic_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT32 domain;
+    UINT16 reserved1;
+    UINT64 base;
+    UINT64 length;
+    UINT32 reserved2;
+    UINT32 flags;
+    UINT64 reserved3;
+} __attribute__((packed)) acpi_srat_memory_t;
+
+typedef struct
+{
+    acpi_entry_t entry;
+    UINT16 reserved1;
+    UINT32 domain;
+    UINT32 apic_id;
+    UINT32 flags;
+    UINT32 clock_domain;
+    UINT32 reserved2;
+} __attribute__((packed)) acpi_srat_local_x2apic_t;
+
+typedef struct
+{
+    acpi_header_t header;
+    UINT64 locality_count;
+    UINT8 distances[];              // locality_count * locality_count
+} __attribute__((packed)) acpi_slit_t;
+
+// --------------------------
+// Topology
+// --------------------------
+
+// Find the RSDP in the configuration tables and fill in boot_acpi_t from the MADT, SRAT and SLIT. Tables with bad
+// checksums are skipped, and acpi is left empty if there's no MADT
+EFI_STATUS acpi_parse(OUT boot_acpi_t *acpi);
+
+#endif
@@ -0,0 +1,164 @@
+#include "arena.h"
+
+// Chunks are kept in a list in the order they are used, and each one starts with this header
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    UINTN size;             // Including the header
+    UINTN pages;
+} arena_chunk_t;
+
+#define CHUNK_HEADER_SIZE ((sizeof(arena_chunk_t) + ARENA_DEFAULT_ALIGN - 1) & ~(UINTN)(ARENA_DEFAULT_ALIGN - 1))
+
+static arena_chunk_t *first = NULL;
+static arena_chunk_t *current = NULL;
+static UINTN used = 0;              // Bytes used in the current chunk, including its header
+static UINTN in_use = 0;            // Bytes handed out from every chunk up to and including the current one
+static arena_mark_t keep_mark = { NULL, 0, 0 };  // Resets never go back past this
+static arena_stats_t stats;
+
+// Helper function to get a new chunk from the firmware
+static arena_chunk_t *new_chunk(UINTN size)
+{
+    EFI_PHYSICAL_ADDRESS pages;
+    UINTN page_count = EFI_SIZE_TO_PAGES(size);
+
+    if (EFI_ERROR(uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, page_count, &pages)))
+        return NULL;
+
+    arena_chunk_t *chunk = (arena_chunk_t *)(UINTN)pages;
+    chunk->next = NULL;
+    chunk->size = page_count * EFI_PAGE_SIZE;
+    chunk->pages = page_count;
+
+    stats.reserved += chunk->size;
+    ++stats.chunk_count;
+    return chunk;
+}
+
+// Helper function to move on to a chunk with room for size bytes at an alignment, reusing ones from before a reset
+static BOOLEAN next_chunk(UINTN size, UINTN align)
+{
+    UINTN needed = CHUNK_HEADER_SIZE + size + (align > ARENA_DEFAULT_ALIGN ? align : 0);
+
+    // Chunks after the current one were used before and then reset, so use the next one if it's big enough
+    if (current != NULL && current->next != NULL && current->next->size >= needed)
+    {
+        current = current->next;
+        used = CHUNK_HEADER_SIZE;
+        return TRUE;
+    }
+
+    arena_chunk_t *chunk = new_chunk(needed > ARENA_CHUNK_SIZE ? needed : ARENA_CHUNK_SIZE);
+    if (chunk == NULL)
+        return FALSE;
+
+    // Put it right after the current one, so any smaller chunks after it stay available
+    if (current == NULL)
+        first = chunk;
+    else
+    {
+        chunk->next = current->next;
+        current->next = chunk;
+    }
+
+    current = chunk;
+    used = CHUNK_HEADER_SIZE;
+    return TRUE;
+}
+
+EFI_STATUS arena_init(VOID)
+{
+    if (first != NULL)
+        return EFI_SUCCESS;
+
+    first = new_chunk(ARENA_INITIAL_SIZE);
+    if (first == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    current = first;
+    used = CHUNK_HEADER_SIZE;
+    return EFI_SUCCESS;
+}
+
+VOID *arena_alloc(IN UINTN size, IN UINTN align)
+{
+    if (align < ARENA_DEFAULT_ALIGN)
+        align = ARENA_DEFAULT_ALIGN;
+    if ((align & (align - 1)) != 0)
+        return NULL;
+
+    if (current == NULL && EFI_ERROR(arena_init()))
+        return NULL;
+
+    // Alignment is worked out on the real address, since a chunk is only page aligned
+    UINTN base = (UINTN)current;
+    UINTN offset = ((base + used + align - 1) & ~(align - 1)) - base;
+    if (offset + size > current->size || offset + size < offset)
+    {
+        if (!next_chunk(size, align))
+            return NULL;
+
+        base = (UINTN)current;
+        offset = ((base + used + align - 1) & ~(align - 1)) - base;
+    }
+
+    in_use += offset + size - used;
+    used = offset + size;
+    if (in_use > stats.high_water)
+        stats.high_water = in_use;
+    ++stats.allocations;
+
+    return (UINT8 *)current + offset;
+}
+
+VOID *arena_alloc_zero(IN UINTN size, IN UINTN align)
+{
+    VOID *buffer = arena_alloc(size, align);
+    if (buffer != NULL)
+        ZeroMem(buffer, size);
+    return buffer;
+}
+
+VOID *arena_alloc_io(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN UINTN size)
+{
+    // IoAlign is 0 or 1 for no requirement, otherwise a power of two
+    UINTN align = block_io->Media->IoAlign > EFI_PAGE_SIZE ? block_io->Media->IoAlign : EFI_PAGE_SIZE;
+    return arena_alloc(size, align);
+}
+
+arena_mark_t arena_mark(VOID)
+{
+    arena_mark_t mark = { current, used, in_use };
+    return mark;
+}
+
+VOID arena_reset(IN arena_mark_t mark)
+{
+    // Chunks are only ever used in list order, so the bytes in use say which of two marks came first
+    if (mark.in_use < keep_mark.in_use)
+        mark = keep_mark;
+
+    // A mark from before the first chunk existed goes back to the very start
+    if (mark.chunk == NULL)
+    {
+        current = first;
+        used = CHUNK_HEADER_SIZE;
+        in_use = 0;
+        return;
+    }
+
+    current = mark.chunk;
+    used = mark.used;
+    in_use = mark.in_use;
+}
+
+VOID arena_keep(VOID)
+{
+    keep_mark = arena_mark();
+}
+
+VOID arena_get_stats(OUT arena_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
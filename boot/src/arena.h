@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// Size of the first chunk the arena gets from AllocatePages (enough for probing a few disks and loading a kernel)
+#define ARENA_INITIAL_SIZE (4 * 1024 * 1024)
+
+// Smallest chunk the arena grows by once the first one is full (bigger allocations get a chunk of their own size)
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+// Alignment of allocations that don't ask for one
+#define ARENA_DEFAULT_ALIGN 16
+
+// Where the arena was up to, to go back to with arena_reset
+typedef struct
+{
+    VOID *chunk;
+    UINTN used;         // Bytes used in that chunk
+    UINTN in_use;       // Bytes used across every chunk
+} arena_mark_t;
+
+typedef struct
+{
+    UINTN high_water;       // Most bytes that were ever in use at once
+    UINTN reserved;         // Bytes the arena has from the firmware
+    UINTN chunk_count;      // AllocatePages calls the arena has made
+    UINT64 allocations;     // Allocations it has handed out
+} arena_stats_t;
+
+// Get the first chunk (arena_alloc does this itself if it has to, but it's better done before anything is timed)
+EFI_STATUS arena_init(VOID);
+
+// Allocate size bytes aligned to align (a power of two, or 0 for ARENA_DEFAULT_ALIGN). Nothing is freed on its own,
+// everything allocated after a mark goes away together when the arena is reset to it
+VOID *arena_alloc(IN UINTN size, IN UINTN align);
+
+// Allocate zeroed memory
+VOID *arena_alloc_zero(IN UINTN size, IN UINTN align);
+
+// Allocate a buffer that reads from a device can go straight into (aligned to both IoAlign and the page size)
+VOID *arena_alloc_io(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN UINTN size);
+
+// Remember where the arena is up to
+arena_mark_t arena_mark(VOID);
+
+// Throw away everything allocated since a mark (chunks are kept for next time, not given back)
+VOID arena_reset(IN arena_mark_t mark);
+
+// Never reuse anything allocated so far, even after resetting to an earlier mark (for buffers a device might still
+// write into)
+VOID arena_keep(VOID);
+
+// Get the usage counters
+VOID arena_get_stats(OUT arena_stats_t *stats);
+
+#endif
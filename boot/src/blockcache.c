@@ -0,0 +1,298 @@
+#include "blockcache.h"
+#include "ioqueue.h"
+
+#define NO_ENTRY -1
+
+// A cached block. Blocks are keyed by the device's media (the EFI_BLOCK_IO_MEDIA pointer plus
+// MediaId, since MediaId alone is 0 on most devices) and the LBA
+typedef struct
+{
+    EFI_BLOCK_IO_MEDIA *media;
+    UINT32 media_id;
+    EFI_LBA lba;
+    UINT8 *data;
+    INT32 prev;         // More recently used entry
+    INT32 next;         // Less recently used entry
+    INT32 hash_next;    // Next entry in the same hash bucket
+} cache_entry_t;
+
+static cache_entry_t entries[BLOCK_CACHE_ENTRIES];
+static INT32 buckets[BLOCK_CACHE_BUCKETS];
+static INT32 lru_head = NO_ENTRY;   // Most recently used
+static INT32 lru_tail = NO_ENTRY;   // Least recently used (the next one to be evicted)
+static UINT8 *read_ahead_buffer = NULL;
+static BOOLEAN initialized = FALSE;
+static block_cache_stats_t stats;
+
+// Helper function to hash a cache key into a bucket
+static UINTN hash_key(EFI_BLOCK_IO_MEDIA *media, UINT32 media_id, EFI_LBA lba)
+{
+    UINT64 key = lba ^ ((UINT64)(UINTN)media >> 4) ^ ((UINT64)media_id << 32);
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (UINTN)(key >> 32) & (BLOCK_CACHE_BUCKETS - 1);
+}
+
+// Helper function to take an entry out of the LRU list
+static VOID lru_unlink(INT32 index)
+{
+    cache_entry_t *entry = &entries[index];
+
+    if (entry->prev != NO_ENTRY)
+        entries[entry->prev].next = entry->next;
+    else
+        lru_head = entry->next;
+
+    if (entry->next != NO_ENTRY)
+        entries[entry->next].prev = entry->prev;
+    else
+        lru_tail = entry->prev;
+}
+
+// Helper function to put an entry at the front of the LRU list
+static VOID lru_push_front(INT32 index)
+{
+    entries[index].prev = NO_ENTRY;
+    entries[index].next = lru_head;
+
+    if (lru_head != NO_ENTRY)
+        entries[lru_head].prev = index;
+    lru_head = index;
+
+    if (lru_tail == NO_ENTRY)
+        lru_tail = index;
+}
+
+// Helper function to find a cached block (NO_ENTRY if it isn't cached)
+static INT32 lookup(EFI_BLOCK_IO_MEDIA *media, EFI_LBA lba)
+{
+    for (INT32 i = buckets[hash_key(media, media->MediaId, lba)]; i != NO_ENTRY; i = entries[i].hash_next)
+    {
+        if (entries[i].lba == lba && entries[i].media == media && entries[i].media_id == media->MediaId)
+            return i;
+    }
+
+    return NO_ENTRY;
+}
+
+// Helper function to remove an entry from its hash bucket
+static VOID unhash(INT32 index)
+{
+    cache_entry_t *entry = &entries[index];
+    INT32 *link = &buckets[hash_key(entry->media, entry->media_id, entry->lba)];
+
+    while (*link != NO_ENTRY)
+    {
+        if (*link == index)
+        {
+            *link = entry->hash_next;
+            return;
+        }
+        link = &entries[*link].hash_next;
+    }
+}
+
+// Helper function to store a block that was just read from the device
+static VOID insert(EFI_BLOCK_IO_MEDIA *media, EFI_LBA lba, VOID *data)
+{
+    // Reuse the least recently used entry
+    INT32 index = lru_tail;
+    cache_entry_t *entry = &entries[index];
+
+    if (entry->media != NULL)
+    {
+        unhash(index);
+        ++stats.evictions;
+    }
+
+    entry->media = media;
+    entry->media_id = media->MediaId;
+    entry->lba = lba;
+    CopyMem(entry->data, data, media->BlockSize);
+
+    UINTN bucket = hash_key(media, media->MediaId, lba);
+    entry->hash_next = buckets[bucket];
+    buckets[bucket] = index;
+
+    lru_unlink(index);
+    lru_push_front(index);
+}
+
+// Helper function to check if a device can go through the cache at all
+static BOOLEAN cacheable(EFI_BLOCK_IO_PROTOCOL *block_io)
+{
+    return initialized && block_io->Media->BlockSize <= BLOCK_CACHE_BLOCK_SIZE;
+}
+
+EFI_STATUS block_cache_init(VOID)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS slab;
+
+    if (initialized)
+        return EFI_SUCCESS;
+
+    // One page-aligned slab for every cached block plus the read-ahead buffer (page alignment covers any IoAlign)
+    UINTN slab_size = (BLOCK_CACHE_ENTRIES + BLOCK_CACHE_MAX_CACHED_READ) * BLOCK_CACHE_BLOCK_SIZE;
+    status = uefi_call_wrapper(BS->AllocatePages, 4,
+        AllocateAnyPages,
+        EfiLoaderData,
+        EFI_SIZE_TO_PAGES(slab_size),
+        &slab
+    );
+    if (EFI_ERROR(status))
+        return status;
+
+    for (UINTN i = 0; i < BLOCK_CACHE_BUCKETS; ++i)
+        buckets[i] = NO_ENTRY;
+
+    // Every entry starts out empty and in the LRU list
+    for (INT32 i = 0; i < BLOCK_CACHE_ENTRIES; ++i)
+    {
+        entries[i].media = NULL;
+        entries[i].data = (UINT8 *)(UINTN)slab + i * BLOCK_CACHE_BLOCK_SIZE;
+        entries[i].hash_next = NO_ENTRY;
+        lru_push_front(i);
+    }
+
+    read_ahead_buffer = (UINT8 *)(UINTN)slab + BLOCK_CACHE_ENTRIES * BLOCK_CACHE_BLOCK_SIZE;
+    initialized = TRUE;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS block_cache_read(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer)
+{
+    EFI_STATUS status;
+    EFI_BLOCK_IO_MEDIA *media = block_io->Media;
+    UINTN block_size = media->BlockSize;
+    UINTN blocks = size / block_size;
+    UINT8 *dest = buffer;
+
+    // Big reads would just push everything else out, so send them straight to the device
+    if (!cacheable(block_io) || blocks > BLOCK_CACHE_MAX_CACHED_READ || size % block_size != 0)
+    {
+        ++stats.device_reads;
+        return io_read(block_io, lba, size, buffer);
+    }
+
+    UINTN i = 0;
+    while (i < blocks)
+    {
+        // Copy out cached blocks
+        INT32 index = lookup(media, lba + i);
+        if (index != NO_ENTRY)
+        {
+            CopyMem(dest + i * block_size, entries[index].data, block_size);
+            lru_unlink(index);
+            lru_push_front(index);
+            ++stats.hits;
+            ++i;
+            continue;
+        }
+
+        // Read the whole run of missing blocks with one call (it can start part way into the buffer, so it goes through
+        // the I/O queue in case that isn't aligned for the device)
+        UINTN run = 1;
+        while (i + run < blocks && lookup(media, lba + i + run) == NO_ENTRY)
+            ++run;
+
+        ++stats.device_reads;
+        status = io_read(block_io, lba + i, run * block_size, dest + i * block_size);
+        if (EFI_ERROR(status))
+            return status;
+
+        for (UINTN j = 0; j < run; ++j)
+            insert(media, lba + i + j, dest + (i + j) * block_size);
+
+        stats.misses += run;
+        i += run;
+    }
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS block_cache_read_ahead(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN blocks)
+{
+    EFI_STATUS status;
+    EFI_BLOCK_IO_MEDIA *media = block_io->Media;
+
+    if (!cacheable(block_io))
+        return EFI_UNSUPPORTED;
+
+    if (blocks > BLOCK_CACHE_MAX_CACHED_READ)
+        blocks = BLOCK_CACHE_MAX_CACHED_READ;
+
+    // Don't run past the end of the device
+    if (lba > media->LastBlock)
+        return EFI_INVALID_PARAMETER;
+    if (lba + blocks > media->LastBlock + 1)
+        blocks = media->LastBlock + 1 - lba;
+
+    // Trim blocks that are already cached off both ends
+    while (blocks > 0 && lookup(media, lba) != NO_ENTRY)
+    {
+        ++lba;
+        --blocks;
+    }
+    while (blocks > 0 && lookup(media, lba + blocks - 1) != NO_ENTRY)
+        --blocks;
+
+    if (blocks == 0)
+        return EFI_SUCCESS;
+
+    ++stats.device_reads;
+    status = uefi_call_wrapper(block_io->ReadBlocks, 5,
+        block_io,
+        media->MediaId,
+        lba,
+        blocks * media->BlockSize,
+        read_ahead_buffer
+    );
+    if (EFI_ERROR(status))
+        return status;
+
+    // Only insert what isn't cached yet so nothing is in the cache twice
+    for (UINTN i = 0; i < blocks; ++i)
+    {
+        if (lookup(media, lba + i) == NO_ENTRY)
+        {
+            insert(media, lba + i, read_ahead_buffer + i * media->BlockSize);
+            ++stats.misses;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+VOID block_cache_fill(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, IN VOID *buffer)
+{
+    EFI_BLOCK_IO_MEDIA *media = block_io->Media;
+    UINTN blocks = size / media->BlockSize;
+
+    if (!cacheable(block_io) || blocks > BLOCK_CACHE_MAX_CACHED_READ)
+        return;
+
+    for (UINTN i = 0; i < blocks; ++i)
+    {
+        if (lookup(media, lba + i) == NO_ENTRY)
+            insert(media, lba + i, (UINT8 *)buffer + i * media->BlockSize);
+    }
+}
+
+BOOLEAN block_cache_contains(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN blocks)
+{
+    if (!cacheable(block_io))
+        return FALSE;
+
+    for (UINTN i = 0; i < blocks; ++i)
+    {
+        if (lookup(block_io->Media, lba + i) == NO_ENTRY)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID block_cache_get_stats(OUT block_cache_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
@@ -0,0 +1,45 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// How many device blocks the cache holds
+#define BLOCK_CACHE_ENTRIES 512
+
+// Biggest device block size the cache stores (devices with bigger blocks skip the cache)
+#define BLOCK_CACHE_BLOCK_SIZE 4096
+
+// Reads longer than this many blocks (e.g. file data) go straight to the device and are not cached
+#define BLOCK_CACHE_MAX_CACHED_READ 64
+
+// Hash buckets used to look blocks up (must be a power of two)
+#define BLOCK_CACHE_BUCKETS 1024
+
+typedef struct
+{
+    UINT64 hits;          // Blocks served from the cache
+    UINT64 misses;        // Blocks that had to come from the device
+    UINT64 device_reads;  // ReadBlocks calls made on behalf of the cache
+    UINT64 evictions;     // Blocks thrown out to make room for new ones
+} block_cache_stats_t;
+
+// Set up the cache (if this fails every read just goes to the device)
+EFI_STATUS block_cache_init(VOID);
+
+// Read size bytes starting at lba, the same way ReadBlocks would, but through the cache
+EFI_STATUS block_cache_read(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer);
+
+// Hint that blocks starting at lba will be read soon, so fetch the missing ones in a single ReadBlocks
+EFI_STATUS block_cache_read_ahead(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN blocks);
+
+// Store blocks that were already read some other way (e.g. asynchronously) so later reads hit
+VOID block_cache_fill(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, IN VOID *buffer);
+
+// Check if every block in a range is already cached
+BOOLEAN block_cache_contains(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN blocks);
+
+// Get the hit/miss counters
+VOID block_cache_get_stats(OUT block_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#define BOOT_INFO_MAGIC 0x4F464E49544F4F42  // "BOOTINFO"
+#define BOOT_INFO_VERSION 1
+
+// Types of memory range
+#define BOOT_MEMORY_FREE 1              // Free now (and marked free in the bitmap)
+#define BOOT_MEMORY_RECLAIMABLE 2       // Boot services memory, free once the kernel is off the firmware's stack
+
+// A run of pages of one type
+typedef struct
+{
+    UINT64 start;                   // Physical, page aligned
+    UINT64 pages;
+    UINT32 type;                    // BOOT_MEMORY_*
+    UINT32 reserved;
+} boot_memory_range_t;
+
+// Memory as it was left at ExitBootServices, with a page frame allocator ready to use
+typedef struct
+{
+    // Free and reclaimable memory, sorted by address with neighbours of the same type merged
+    UINT64 ranges;                  // Physical address of the boot_memory_range_t array
+    UINT64 range_count;
+
+    // One bit per page from first_page (set means free), covering every free and reclaimable range except page 0
+    UINT64 bitmap;                  // Physical address, 8 byte aligned
+    UINT64 first_page;              // Page number of bit 0
+    UINT64 page_count;
+    UINT64 free_pages;
+    UINT64 search_hint;             // 64 bit word of the bitmap to start looking for a free page in
+
+    // Where the ranges and bitmap live (marked as used, so neither is in the free ranges)
+    UINT64 region;
+    UINT64 region_pages;
+
+    // The firmware's map, for runtime services (in loader data pages of its own, so nothing reclaims it)
+    UINT64 efi_map;
+    UINT64 efi_map_size;
+    UINT64 efi_descriptor_size;
+    UINT32 efi_descriptor_version;
+    UINT32 reserved;
+} boot_memory_t;
+
+// Take a free page from the bitmap (0 if there aren't any left)
+static inline UINT64 boot_memory_allocate_page(boot_memory_t *memory)
+{
+    UINT64 *bitmap = (UINT64 *)(UINTN)memory->bitmap;
+    UINT64 words = (memory->page_count + 63) / 64;
+
+    if (memory->free_pages == 0)
+        return 0;
+
+    // Everything before the hint is used, so the search almost always ends on the first word
+    for (UINT64 word = memory->search_hint; word < words; ++word)
+    {
+        if (bitmap[word] == 0)
+            continue;
+
+        UINT64 bit = __builtin_ctzll(bitmap[word]);
+        bitmap[word] &= ~(1ULL << bit);
+        --memory->free_pages;
+        memory->search_hint = word;
+        return (memory->first_page + word * 64 + bit) * EFI_PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+// Give a page back to the bitmap (this is also how reclaimable ranges become free)
+static inline VOID boot_memory_free_page(boot_memory_t *memory, UINT64 address)
+{
+    UINT64 page = address / EFI_PAGE_SIZE;
+    if (page < memory->first_page || page >= memory->first_page + memory->page_count)
+        return;
+
+    UINT64 index = page - memory->first_page;
+    UINT64 *bitmap = (UINT64 *)(UINTN)memory->bitmap;
+    if (bitmap[index / 64] & (1ULL << (index % 64)))
+        return;
+
+    bitmap[index / 64] |= 1ULL << (index % 64);
+    ++memory->free_pages;
+    if (index / 64 < memory->search_hint)
+        memory->search_hint = index / 64;
+}
+
+// Pixel formats
+#define BOOT_FRAMEBUFFER_RGBX 1         // Red in the lowest byte
+#define BOOT_FRAMEBUFFER_BGRX 2         // Blue in the lowest byte
+
+// Linear framebuffer the console was drawing to (base is 0 if there isn't one)
+typedef struct
+{
+    UINT64 base;                    // Physical
+    UINT64 size;
+    UINT32 width;
+    UINT32 height;
+    UINT32 pixels_per_line;
+    UINT32 format;                  // BOOT_FRAMEBUFFER_*
+    UINT32 cursor_column;           // Where the console left off, so the kernel can carry on below it
+    UINT32 cursor_row;
+} boot_framebuffer_t;
+
+// Page tables the kernel is called with (pml4 is 0 if they couldn't be built and the firmware's are still in use)
+typedef struct
+{
+    UINT64 pml4;                    // Physical address CR3 was set to
+    UINT64 tables;                  // Every table is in this one block of pages (physical)
+    UINT64 table_pages;
+    UINT64 identity_end;            // Physical memory from 0 up to here is identity mapped
+    UINT64 identity_page_size;      // 1GB where the CPU has them, otherwise 2MB (smaller only around the framebuffer)
+    UINT64 kernel_virtual_start;    // The kernel image is also mapped here, on 2MB pages, in the higher half
+    UINT64 kernel_virtual_size;
+    UINT64 pat;                     // IA32_PAT as it was set up (PWT alone selects write-combining), 0 if unchanged
+} boot_paging_t;
+
+// Processor flags
+#define BOOT_CPU_ENABLED 1              // Usable now
+#define BOOT_CPU_ONLINE_CAPABLE 2       // Disabled, but can be brought online later
+#define BOOT_CPU_BSP 4                  // The one the bootloader ran on (always first)
+#define BOOT_CPU_X2APIC 8               // Came from an x2APIC entry (the ID might not fit in 8 bits)
+
+// A processor from the MADT
+typedef struct
+{
+    UINT32 apic_id;
+    UINT32 acpi_id;                 // ACPI processor UID
+    UINT32 node;                    // Proximity domain from the SRAT (0 without one)
+    UINT32 flags;                   // BOOT_CPU_*
+} boot_cpu_t;
+
+// An I/O APIC from the MADT
+typedef struct
+{
+    UINT64 address;                 // Physical address of its registers
+    UINT32 id;
+    UINT32 gsi_base;                // First global system interrupt it handles
+} boot_ioapic_t;
+
+// An ISA interrupt that isn't identity mapped to a global system interrupt
+typedef struct
+{
+    UINT8 bus;                      // Always 0 (ISA)
+    UINT8 source;                   // ISA IRQ
+    UINT16 flags;                   // MPS INTI polarity (bits 0-1) and trigger mode (bits 2-3)
+    UINT32 gsi;
+} boot_interrupt_override_t;
+
+// Memory range flags
+#define BOOT_NUMA_HOT_PLUGGABLE 1
+#define BOOT_NUMA_NON_VOLATILE 2
+
+// A physical memory range and the node it belongs to, from the SRAT
+typedef struct
+{
+    UINT64 start;
+    UINT64 size;
+    UINT32 node;
+    UINT32 flags;                   // BOOT_NUMA_*
+} boot_numa_range_t;
+
+// MADT flags
+#define BOOT_ACPI_PCAT_COMPAT 1         // There are 8259 PICs as well, which need masking
+
+// Processor and interrupt controller layout from ACPI (rsdp is 0 if the firmware didn't give the tables, and
+// everything else is empty then). The arrays are all in one block of pages, each starting on a cache line
+typedef struct
+{
+    UINT64 rsdp;                    // Physical address, for the kernel's own ACPI code
+    UINT64 local_apic;              // Physical address of the local APIC registers
+    UINT32 madt_flags;              // BOOT_ACPI_*
+    UINT32 node_count;              // Highest proximity domain in the SRAT plus one (0 without one)
+
+    UINT64 cpus;                    // Physical address of the boot_cpu_t array
+    UINT64 cpu_count;
+    UINT64 ioapics;                 // boot_ioapic_t
+    UINT64 ioapic_count;
+    UINT64 overrides;               // boot_interrupt_override_t
+    UINT64 override_count;
+    UINT64 numa_ranges;             // boot_numa_range_t
+    UINT64 numa_range_count;
+
+    // Relative distances from the SLIT: distances[from * locality_count + to], 10 meaning local (0 without one)
+    UINT64 distances;
+    UINT64 locality_count;
+
+    UINT64 region;
+    UINT64 region_pages;
+} boot_acpi_t;
+
+// Filesystems (the same numbers as the bootloader's filesystem_t)
+#define BOOT_FS_NONE 0
+#define BOOT_FS_FAT12 1
+#define BOOT_FS_FAT16 2
+#define BOOT_FS_FAT32 3
+#define BOOT_FS_EXT2 4
+#define BOOT_FS_EXT3 5
+#define BOOT_FS_EXT4 6
+#define BOOT_FS_NTFS 7
+#define BOOT_FS_XFS 8
+#define BOOT_FS_BTRFS 9
+#define BOOT_FS_SWAP 10
+
+// Disk flags
+#define BOOT_DISK_GPT 1                 // Has a valid GPT (partition_count is 0 otherwise)
+#define BOOT_DISK_NO_MEDIA 2
+#define BOOT_DISK_REMOVABLE 4
+#define BOOT_DISK_READ_ONLY 8
+#define BOOT_DISK_LOGICAL 16            // The firmware's handle for a partition rather than a whole disk
+
+// A Block IO device the bootloader probed
+typedef struct
+{
+    UINT64 last_block;
+    UINT64 device_path;             // Physical address of the firmware's device path for it (0 if it had none)
+    UINT32 device_path_size;        // Bytes, including the end node
+    UINT32 block_size;
+    UINT32 io_align;                // Buffers have to be aligned to this (0 or 1 means any address will do)
+    UINT32 transfer_granularity;    // Blocks reads should be a multiple of (0 if the firmware didn't say)
+    UINT32 flags;                   // BOOT_DISK_*
+    UINT32 first_partition;         // Its partitions are together in the partition array, starting here
+    UINT32 partition_count;
+    UINT32 reserved;
+} boot_disk_t;
+
+// Partition flags
+#define BOOT_PARTITION_PROBED 1         // The filesystem was checked (without this, BOOT_FS_NONE means unknown)
+#define BOOT_PARTITION_BOOT 2           // The kernel was loaded from it
+
+// A GPT partition
+typedef struct
+{
+    EFI_GUID unique_guid;
+    EFI_GUID type_guid;
+    UINT64 offset;                  // Bytes from the start of the disk
+    UINT64 size;                    // Bytes
+    UINT32 disk;                    // Index into the disk array
+    UINT8 filesystem;               // BOOT_FS_*
+    UINT8 confidence;               // How sure the probe was about it, 0 to 100
+    UINT8 flags;                    // BOOT_PARTITION_*
+    UINT8 volume_id_size;           // 16 for a UUID, 4 or 8 for a FAT or NTFS serial number, 0 if there's none
+    UINT8 volume_id[16];
+    CHAR16 name[36];                // From the GPT
+    CHAR16 label[33];               // From the filesystem (empty if it has none)
+} boot_partition_t;
+
+#define BOOT_DISKS_VERSION 1
+
+// Every device and partition the bootloader found, so the kernel doesn't have to read the GPTs and probe again
+// (version is 0 if there's no inventory). Everything is in one block of pages
+typedef struct
+{
+    UINT32 version;                 // BOOT_DISKS_VERSION
+    UINT32 boot_partition;          // Index of the partition the kernel came from
+    UINT64 disks;                   // Physical address of the boot_disk_t array
+    UINT64 disk_count;
+    UINT64 partitions;              // boot_partition_t
+    UINT64 partition_count;
+
+    // Open addressing table of partitions by unique GUID: UINT32 slots holding a partition index plus one (0 is
+    // empty), starting at boot_guid_hash(guid) & (index_size - 1) and going on to the next slot until a match or an
+    // empty one. If partitions share a GUID (a cloned disk) the first one probed is found
+    UINT64 index;
+    UINT64 index_size;              // A power of two, at least twice partition_count
+
+    UINT64 region;
+    UINT64 region_pages;
+} boot_disks_t;
+
+// Hash a unique GUID for boot_disks_t's index (FNV-1a, the kernel has to hash the same way)
+static inline UINT64 boot_guid_hash(const EFI_GUID *guid)
+{
+    const UINT8 *bytes = (const UINT8 *)guid;
+    UINT64 hash = 0xCBF29CE484222325ULL;
+    for (UINTN i = 0; i < sizeof(EFI_GUID); ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+// What the bootloader hands the kernel (new fields only ever go on the end, so check size before using them)
+typedef struct
+{
+    UINT64 magic;                   // BOOT_INFO_MAGIC
+    UINT32 version;                 // BOOT_INFO_VERSION
+    UINT32 size;                    // sizeof(boot_info_t) when it was filled in
+
+    // Where the kernel ended up (physical, page aligned)
+    UINT64 kernel_physical_start;
+    UINT64 kernel_physical_end;
+    UINT64 kernel_entry;
+    INT64 kernel_load_bias;         // Added to every address in the ELF file (0 unless it was relocated)
+
+    // Initial ramdisk from the ESP (0 if there isn't one)
+    UINT64 initrd_address;
+    UINT64 initrd_size;
+
+    // Filled in at ExitBootServices
+    boot_memory_t memory;
+
+    boot_framebuffer_t framebuffer;
+
+    boot_paging_t paging;
+
+    boot_acpi_t acpi;
+
+    boot_disks_t disks;
+} boot_info_t;
+
+// Kernel entry point (called with the System V ABI, so boot_info arrives in RDI)
+typedef VOID (__attribute__((sysv_abi)) *kernel_entry_t)(boot_info_t *boot_info);
+
+#endif
@@ -1,85 +1,245 @@
 #include "bootio.h"
+#include "console.h"
 
-UINTN read_number(const CHAR16 *message, UINTN max)
+static idle_work_t idle_work = NULL;
+
+// Helper function to add a string to the echo buffer
+static VOID echo(CHAR16 *buffer, UINTN *length, const CHAR16 *text)
 {
-    EFI_STATUS status;
+    for (; *text != 0 && *length + 1 < MAX_LINE_LENGTH * 4; ++text)
+        buffer[(*length)++] = *text;
+    buffer[*length] = 0;
+}
+
+// Helper function to back off after reading a key failed, so a caller that asks again doesn't spin
+static VOID key_failed(VOID)
+{
+    uefi_call_wrapper(BS->Stall, 1, KEY_ERROR_DELAY);
+}
 
-tryagain:
-    UINTN selected = 0;
-    INTN typed = 0;
-    Print(message);
+// Helper function to edit a line until enter is pressed (or until keys can't be read, which leaves it empty). Every key
+// that has already arrived is handled before anything is echoed, so a burst of typing costs one redraw rather than one
+// per key
+static VOID read_line(CHAR16 *line, UINTN *length, BOOLEAN (*accept)(CHAR16 c))
+{
+    *length = 0;
     while (TRUE)
     {
+        CHAR16 echoed[MAX_LINE_LENGTH * 4];
+        UINTN echoed_length = 0;
+        BOOLEAN done = FALSE;
         EFI_INPUT_KEY key;
-        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2,
-            ST->ConIn,
-            &key
-        );
 
+        // Sleep until there's a key, then take every one that's waiting
+        EFI_STATUS status = wait_for_key(&key, 0);
         if (EFI_ERROR(status))
-            continue;
-
-        if (key.UnicodeChar >= '0' && key.UnicodeChar <= '9')
         {
-            selected = selected * 10 + (key.UnicodeChar - '0');
-            Print(L"%c", key.UnicodeChar);
-            ++typed;
+            key_failed();
+            *length = 0;
+            break;
         }
-        else if (key.UnicodeChar == CHAR_BACKSPACE && typed > 0)
+        while (!EFI_ERROR(status) && !done)
         {
-            selected = selected / 10;
-            Print(L"\b \b");
-            --typed;
+            if (key.UnicodeChar == CHAR_CARRIAGE_RETURN)
+                done = TRUE;
+            else if (key.UnicodeChar == CHAR_BACKSPACE && *length > 0)
+            {
+                --*length;
+                echo(echoed, &echoed_length, L"\b \b");
+            }
+            else if (key.ScanCode == SCAN_ESC)
+            {
+                // Throw the whole line away
+                for (; *length > 0; --*length)
+                    echo(echoed, &echoed_length, L"\b \b");
+            }
+            else if (*length < MAX_LINE_LENGTH && accept(key.UnicodeChar))
+            {
+                CHAR16 typed[2] = {key.UnicodeChar, 0};
+                line[(*length)++] = key.UnicodeChar;
+                echo(echoed, &echoed_length, typed);
+            }
+
+            if (!done)
+                status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &key);
         }
-        else if (key.UnicodeChar == CHAR_CARRIAGE_RETURN)
+
+        if (echoed_length > 0)
+            console_print(L"%s", echoed);
+        if (done)
             break;
     }
 
-    if (selected >= max)
+    line[*length] = 0;
+}
+
+// Helper function to accept digits
+static BOOLEAN is_digit(CHAR16 c)
+{
+    return c >= '0' && c <= '9';
+}
+
+UINTN read_number(const CHAR16 *message, UINTN max)
+{
+    CHAR16 line[MAX_LINE_LENGTH + 1];
+    UINTN length;
+
+    while (TRUE)
     {
-        Print(L"\nOver");
-        goto tryagain;
-    }
+        console_print(message);
+        read_line(line, &length, is_digit);
+
+        // Give up on the line as soon as it can't be below max, so a long one can't wrap around into range
+        UINTN selected = 0;
+        for (UINTN i = 0; i < length; ++i)
+        {
+            UINTN digit = line[i] - '0';
+            if (digit >= max || selected > (max - 1 - digit) / 10)
+            {
+                selected = max;
+                break;
+            }
+            selected = selected * 10 + digit;
+        }
 
-    Print(L"\n");
-    return selected;
+        if (selected < max)
+        {
+            console_print(L"\n");
+            return selected;
+        }
+
+        console_print(L"\nOver");
+    }
 }
 
 BOOLEAN yes_or_no(const CHAR16 *message)
 {
-    EFI_STATUS status;
-
     BOOLEAN result = FALSE;
-    Print(message);
-    Print(L"No ");
+    console_print(message);
+    console_print(L"No ");
     while (TRUE)
     {
         EFI_INPUT_KEY key;
-        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2,
-            ST->ConIn,
-            &key
-        );
-        if (EFI_ERROR(status))
-            continue;
+        if (EFI_ERROR(wait_for_key(&key, 0)))
+        {
+            key_failed();
+            if (result)
+                console_print(L"\b \b\b \b\b \bNo ");
+            result = FALSE;
+            break;
+        }
 
         if (key.UnicodeChar == CHAR_CARRIAGE_RETURN)
             break;
         else if (key.UnicodeChar == 'y')
         {
-            if (result <= 1)
-                Print(L"\b \b\b \b\b \b");
-            Print(L"Yes");
-            result = 1;
+            console_print(L"\b \b\b \b\b \bYes");
+            result = TRUE;
         }
         else if (key.UnicodeChar == 'n')
         {
-            if (result <= 1)
-                Print(L"\b \b\b \b\b \b");
-            Print(L"No ");
-            result = 0;
+            console_print(L"\b \b\b \b\b \bNo ");
+            result = FALSE;
         }
     }
 
-    Print(L"\n");
+    console_print(L"\n");
     return result;
 }
+
+BOOLEAN key_pressed(VOID)
+{
+    EFI_INPUT_KEY key;
+    return !EFI_ERROR(uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &key));
+}
+
+EFI_STATUS wait_for_key(OUT EFI_INPUT_KEY *key, IN UINT64 timeout)
+{
+    EFI_STATUS status;
+    EFI_EVENT events[2] = {ST->ConIn->WaitForKey, NULL};
+    UINTN event_count = 1;
+    UINTN index;
+
+    // The timer goes alongside the key event, and whichever fires first wakes us up
+    if (timeout > 0)
+    {
+        status = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL, &events[1]);
+        if (EFI_ERROR(status))
+            return status;
+
+        // SetTimer counts in 100ns units
+        status = uefi_call_wrapper(BS->SetTimer, 3, events[1], TimerRelative, timeout * 10);
+        if (EFI_ERROR(status))
+        {
+            uefi_call_wrapper(BS->CloseEvent, 1, events[1]);
+            return status;
+        }
+        event_count = 2;
+    }
+
+    // Do the idle work a piece at a time until a key comes in, the time runs out or there's none left
+    BOOLEAN waiting = TRUE;
+    while (idle_work != NULL && waiting)
+    {
+        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, key);
+        if (status != EFI_NOT_READY)
+            waiting = FALSE;
+        else if (event_count == 2 && uefi_call_wrapper(BS->CheckEvent, 1, events[1]) == EFI_SUCCESS)
+        {
+            status = EFI_TIMEOUT;
+            waiting = FALSE;
+        }
+        else if (!idle_work())
+            idle_work = NULL;
+    }
+
+    while (waiting)
+    {
+        status = uefi_call_wrapper(BS->WaitForEvent, 3, event_count, events, &index);
+        if (EFI_ERROR(status))
+            break;
+        if (index == 1)
+        {
+            status = EFI_TIMEOUT;
+            break;
+        }
+
+        // The key event can be signalled with nothing to read (e.g. for a key that was released), so go back to sleep
+        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, key);
+        if (status != EFI_NOT_READY)
+            break;
+    }
+
+    if (event_count == 2)
+        uefi_call_wrapper(BS->CloseEvent, 1, events[1]);
+    return status;
+}
+
+VOID set_idle_work(IN idle_work_t work)
+{
+    idle_work = work;
+}
+
+BOOLEAN countdown(const CHAR16 *message, UINTN seconds)
+{
+    for (UINTN left = seconds; left > 0; --left)
+    {
+        console_print(L"\r%s (%lu) ", message, left);
+
+        EFI_INPUT_KEY key;
+        EFI_STATUS status = wait_for_key(&key, 1000 * 1000);
+
+        // Input that can't be read is the same as nobody pressing anything (the menu would never get an answer), so
+        // sit out the second and carry on
+        if (EFI_ERROR(status) && status != EFI_TIMEOUT)
+            uefi_call_wrapper(BS->Stall, 1, 1000 * 1000);
+        else if (!EFI_ERROR(status))
+        {
+            console_print(L"\n");
+            return key.UnicodeChar == CHAR_CARRIAGE_RETURN;
+        }
+    }
+
+    console_print(L"\n");
+    return TRUE;
+}
@@ -4,10 +4,36 @@
 #include <efi.h>
 #include <efilib.h>
 
-// Read a number from 0 - max (default is 0)
+// Seconds the menu waits before booting the default partition on its own
+#define AUTO_BOOT_TIMEOUT 5
+
+// Microseconds to back off for when reading a key fails, so a caller that keeps asking doesn't spin
+#define KEY_ERROR_DELAY (100 * 1000)
+
+// Most characters a line being typed in can hold
+#define MAX_LINE_LENGTH 20
+
+// Read a number from 0 - max (default is 0, which is also what it gives if keys can't be read)
 UINTN read_number(const CHAR16 *message, UINTN max);
 
-// Read Y or N (default is N)
+// Read Y or N (default is N, which is also what it gives if keys can't be read)
 BOOLEAN yes_or_no(const CHAR16 *message);
 
+// Check if a key is waiting (without blocking), throwing it away
+BOOLEAN key_pressed(VOID);
+
+// Sleep until a key comes in or timeout microseconds pass (0 means no timeout), EFI_TIMEOUT if it was the timeout. Any
+// idle work is done before sleeping
+EFI_STATUS wait_for_key(OUT EFI_INPUT_KEY *key, IN UINT64 timeout);
+
+// Work done while waiting for a key, a piece at a time (it returns FALSE once there's nothing left)
+typedef BOOLEAN (*idle_work_t)(VOID);
+
+// Set the work wait_for_key does before it goes to sleep (NULL for none)
+VOID set_idle_work(IN idle_work_t work);
+
+// Show message with the seconds left every second, TRUE if they all ran out or enter was pressed (FALSE for any other
+// key). Input errors count as no key, so a broken console still boots
+BOOLEAN countdown(const CHAR16 *message, UINTN seconds);
+
 #endif
@@ -0,0 +1,43 @@
+#include "bootvar.h"
+
+// Vendor GUID that our variables live under
+static EFI_GUID boot_vendor_guid = {0x6E0B1C52, 0x3A8F, 0x4D0B, {0x9F, 0x1E, 0x2C, 0x7D, 0x44, 0xB1, 0x0A, 0x93}};
+
+EFI_STATUS load_boot_partition_guid(OUT EFI_GUID *guid)
+{
+    UINTN size = sizeof(EFI_GUID);
+    UINT32 attributes;
+
+    EFI_STATUS status = uefi_call_wrapper(RT->GetVariable, 5,
+        BOOT_PARTITION_VARIABLE,
+        &boot_vendor_guid,
+        &attributes,
+        &size,
+        guid
+    );
+
+    // Anything that isn't exactly a GUID isn't ours
+    if (!EFI_ERROR(status) && size != sizeof(EFI_GUID))
+        return EFI_NOT_FOUND;
+    if (status == EFI_BUFFER_TOO_SMALL)
+        return EFI_NOT_FOUND;
+
+    return status;
+}
+
+EFI_STATUS save_boot_partition_guid(IN EFI_GUID *guid)
+{
+    EFI_GUID saved;
+
+    // Don't wear out the flash rewriting the same value every boot
+    if (!EFI_ERROR(load_boot_partition_guid(&saved)) && CompareGuid(&saved, guid) == 0)
+        return EFI_SUCCESS;
+
+    return uefi_call_wrapper(RT->SetVariable, 5,
+        BOOT_PARTITION_VARIABLE,
+        &boot_vendor_guid,
+        EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+        sizeof(EFI_GUID),
+        guid
+    );
+}
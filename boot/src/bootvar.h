@@ -0,0 +1,16 @@
+#ifndef BOOTVAR_H
+#define BOOTVAR_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// Name of the UEFI variable holding the unique GUID of the partition that was booted last
+#define BOOT_PARTITION_VARIABLE L"BootPartition"
+
+// Get the unique GUID of the partition that was booted last (EFI_NOT_FOUND if nothing was saved)
+EFI_STATUS load_boot_partition_guid(OUT EFI_GUID *guid);
+
+// Save the unique GUID of the chosen partition so the next boot can skip the menu
+EFI_STATUS save_boot_partition_guid(IN EFI_GUID *guid);
+
+#endif
@@ -0,0 +1,318 @@
+#include "console.h"
+#include "trace.h"
+
+// Part of a text row that has been drawn to the back buffer but not the screen (clean when first > last)
+typedef struct
+{
+    UINT32 first;
+    UINT32 last;
+} dirty_span_t;
+
+static EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = NULL;
+static UINT32 *back_buffer;             // Same layout as the screen, one EFI_GRAPHICS_OUTPUT_BLT_PIXEL per pixel
+static UINTN width, height;
+static UINTN columns, rows;
+static UINTN cursor_column, cursor_row;
+static dirty_span_t *dirty;             // One per text row
+static SIMPLE_TEXT_OUTPUT_INTERFACE *mirrors[CONSOLE_MAX_MIRRORS];     // Text outputs that aren't this screen
+static UINTN mirror_count = 0;
+
+// Helper function to mark a row as needing no Blt
+static VOID mark_clean(UINTN row)
+{
+    dirty[row].first = columns;
+    dirty[row].last = 0;
+}
+
+// Helper function to note that a column of a row changed
+static VOID mark_dirty(UINTN row, UINTN first, UINTN last)
+{
+    if (first < dirty[row].first)
+        dirty[row].first = first;
+    if (last > dirty[row].last)
+        dirty[row].last = last;
+}
+
+// Helper function to fill a run of text rows in the back buffer with the background
+static VOID clear_rows(UINTN first_row, UINTN count)
+{
+    UINT32 *pixel = back_buffer + first_row * FONT_HEIGHT * width;
+    UINTN pixel_count = count * FONT_HEIGHT * width;
+
+    for (UINTN i = 0; i < pixel_count; ++i)
+        pixel[i] = CONSOLE_BACKGROUND;
+}
+
+// Helper function to put what changed on the screen, with one Blt for every run of neighbouring dirty rows
+static VOID flush(VOID)
+{
+    UINTN row = 0;
+
+    while (row < rows)
+    {
+        if (dirty[row].first > dirty[row].last)
+        {
+            ++row;
+            continue;
+        }
+
+        // Take in the rows after it that are dirty too, widening to cover all of them
+        UINTN first_row = row;
+        UINTN first = dirty[row].first;
+        UINTN last = dirty[row].last;
+        for (; row < rows && dirty[row].first <= dirty[row].last; ++row)
+        {
+            if (dirty[row].first < first)
+                first = dirty[row].first;
+            if (dirty[row].last > last)
+                last = dirty[row].last;
+            mark_clean(row);
+        }
+
+        uefi_call_wrapper(gop->Blt, 10,
+            gop,
+            (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)back_buffer,
+            EfiBltBufferToVideo,
+            first * FONT_WIDTH, first_row * FONT_HEIGHT,
+            first * FONT_WIDTH, first_row * FONT_HEIGHT,
+            (last - first + 1) * FONT_WIDTH, (row - first_row) * FONT_HEIGHT,
+            width * sizeof(UINT32)
+        );
+    }
+}
+
+// Helper function to move everything up a row, copying on the screen rather than redrawing it
+static VOID scroll(VOID)
+{
+    // The screen has to match the back buffer before it can be moved
+    flush();
+
+    uefi_call_wrapper(gop->Blt, 10,
+        gop,
+        NULL,
+        EfiBltVideoToVideo,
+        0, FONT_HEIGHT,
+        0, 0,
+        width, (rows - 1) * FONT_HEIGHT,
+        0
+    );
+
+    CopyMem(back_buffer, back_buffer + FONT_HEIGHT * width, (rows - 1) * FONT_HEIGHT * width * sizeof(UINT32));
+    clear_rows(rows - 1, 1);
+    mark_dirty(rows - 1, 0, columns - 1);
+}
+
+// Helper function to move to the start of the next line
+static VOID new_line(VOID)
+{
+    cursor_column = 0;
+    if (cursor_row + 1 < rows)
+        ++cursor_row;
+    else
+        scroll();
+}
+
+// Helper function to draw a character at the cursor
+static VOID draw_char(CHAR16 c)
+{
+    if (c < FONT_FIRST_CHAR || c > FONT_LAST_CHAR)
+        c = FONT_REPLACEMENT_CHAR;
+
+    const UINT8 *glyph = font_glyphs[c - FONT_FIRST_CHAR];
+    UINT32 *pixel = back_buffer + cursor_row * FONT_HEIGHT * width + cursor_column * FONT_WIDTH;
+
+    for (UINTN y = 0; y < FONT_HEIGHT; ++y)
+    {
+        for (UINTN x = 0; x < FONT_WIDTH; ++x)
+            pixel[x] = (glyph[y] & (0x80 >> x)) ? CONSOLE_FOREGROUND : CONSOLE_BACKGROUND;
+        pixel += width;
+    }
+
+    mark_dirty(cursor_row, cursor_column, cursor_column);
+}
+
+// Helper function to put a string in the back buffer
+static VOID write_text(const CHAR16 *text)
+{
+    for (; *text != 0; ++text)
+    {
+        switch (*text)
+        {
+        case '\n':
+            new_line();
+            break;
+        case '\r':
+            cursor_column = 0;
+            break;
+        case '\b':
+            if (cursor_column > 0)
+                --cursor_column;
+            break;
+        default:
+            if (cursor_column == columns)
+                new_line();
+            draw_char(*text);
+            ++cursor_column;
+            break;
+        }
+    }
+}
+
+// Helper function to find the text outputs GOP drawing would leave out (a terminal on a serial port, say). Consoles
+// on a screen share their handle with its GOP, and the firmware's combined ConOut has no device path of its own
+static VOID find_mirrors(VOID)
+{
+    EFI_HANDLE *handles;
+    UINTN handle_count;
+
+    EFI_STATUS status = uefi_call_wrapper(BS->LocateHandleBuffer, 5,
+        ByProtocol,
+        &TextOutProtocol,
+        NULL,
+        &handle_count,
+        &handles);
+    if (EFI_ERROR(status))
+        return;
+
+    for (UINTN i = 0; i < handle_count && mirror_count < CONSOLE_MAX_MIRRORS; ++i)
+    {
+        VOID *screen;
+        if (!EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, handles[i], &GraphicsOutputProtocol, &screen)))
+            continue;
+        if (DevicePathFromHandle(handles[i]) == NULL)
+            continue;
+
+        status = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i], &TextOutProtocol, (VOID **)&mirrors[mirror_count]);
+        if (!EFI_ERROR(status))
+            ++mirror_count;
+    }
+
+    FreePool(handles);
+}
+
+// Helper function to send a string to the mirrors, as Print would (a terminal needs "\r\n" to start a new line)
+static VOID write_mirrors(const CHAR16 *text)
+{
+    CHAR16 chunk[64 + 2];
+    UINTN length = 0;
+
+    for (; *text != 0; ++text)
+    {
+        if (*text == '\n')
+            chunk[length++] = '\r';
+        chunk[length++] = *text;
+
+        if (length >= 64 || text[1] == 0)
+        {
+            chunk[length] = 0;
+            for (UINTN i = 0; i < mirror_count; ++i)
+                uefi_call_wrapper(mirrors[i]->OutputString, 2, mirrors[i], chunk);
+            length = 0;
+        }
+    }
+}
+
+EFI_STATUS console_init(VOID)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages;
+
+    status = LibLocateProtocol(&GraphicsOutputProtocol, (VOID **)&gop);
+    if (EFI_ERROR(status))
+    {
+        gop = NULL;
+        return status;
+    }
+
+    width = gop->Mode->Info->HorizontalResolution;
+    height = gop->Mode->Info->VerticalResolution;
+    columns = width / FONT_WIDTH;
+    rows = height / FONT_HEIGHT;
+
+    // The back buffer and the dirty spans share one allocation
+    UINTN buffer_size = width * height * sizeof(UINT32);
+    UINTN page_count = EFI_SIZE_TO_PAGES(buffer_size + rows * sizeof(dirty_span_t));
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, page_count, &pages);
+    if (EFI_ERROR(status) || columns == 0 || rows == 0)
+    {
+        gop = NULL;
+        return EFI_ERROR(status) ? status : EFI_UNSUPPORTED;
+    }
+
+    back_buffer = (UINT32 *)(UINTN)pages;
+    dirty = (dirty_span_t *)((UINT8 *)back_buffer + buffer_size);
+
+    find_mirrors();
+    console_clear();
+    return EFI_SUCCESS;
+}
+
+VOID console_print(IN const CHAR16 *format, ...)
+{
+    CHAR16 buffer[CONSOLE_PRINT_BUFFER_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    VSPrint(buffer, sizeof(buffer), (CHAR16 *)format, args);
+    va_end(args);
+
+    if (gop == NULL)
+    {
+        Print(L"%s", buffer);
+        return;
+    }
+
+    write_text(buffer);
+    flush();
+
+    write_mirrors(buffer);
+}
+
+VOID console_clear(VOID)
+{
+    trace_begin("console_clear");
+
+    if (gop == NULL)
+        uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    else
+    {
+        // One fill does the whole screen, so nothing is left dirty
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL background = {0};
+        *(UINT32 *)&background = CONSOLE_BACKGROUND;
+        uefi_call_wrapper(gop->Blt, 10, gop, &background, EfiBltVideoFill, 0, 0, 0, 0, width, height, 0);
+
+        clear_rows(0, rows);
+        for (UINTN row = 0; row < rows; ++row)
+            mark_clean(row);
+
+        for (UINTN i = 0; i < mirror_count; ++i)
+            uefi_call_wrapper(mirrors[i]->ClearScreen, 1, mirrors[i]);
+    }
+
+    cursor_column = 0;
+    cursor_row = 0;
+    trace_end("console_clear");
+}
+
+VOID console_get_framebuffer(OUT boot_framebuffer_t *framebuffer)
+{
+    ZeroMem(framebuffer, sizeof(*framebuffer));
+    if (gop == NULL)
+        return;
+
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *info = gop->Mode->Info;
+    if (info->PixelFormat == PixelRedGreenBlueReserved8BitPerColor)
+        framebuffer->format = BOOT_FRAMEBUFFER_RGBX;
+    else if (info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor)
+        framebuffer->format = BOOT_FRAMEBUFFER_BGRX;
+    else
+        return;
+
+    framebuffer->base = gop->Mode->FrameBufferBase;
+    framebuffer->size = gop->Mode->FrameBufferSize;
+    framebuffer->width = info->HorizontalResolution;
+    framebuffer->height = info->VerticalResolution;
+    framebuffer->pixels_per_line = info->PixelsPerScanLine;
+    framebuffer->cursor_column = cursor_column;
+    framebuffer->cursor_row = cursor_row;
+}
@@ -0,0 +1,32 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "font.h"
+#include "bootinfo.h"
+
+// Colours (as EFI_GRAPHICS_OUTPUT_BLT_PIXEL, so blue is the lowest byte)
+#define CONSOLE_FOREGROUND 0x00AAAAAA
+#define CONSOLE_BACKGROUND 0x00000000
+
+// Longest single console_print
+#define CONSOLE_PRINT_BUFFER_SIZE 1024
+
+// Most text outputs kept in step with the GOP console (serial terminals and the like)
+#define CONSOLE_MAX_MIRRORS 4
+
+// Find GOP and set up the back buffer (everything falls back to the firmware's text output without it). Text outputs
+// that aren't on the screen, such as a serial terminal, still get everything that's printed
+EFI_STATUS console_init(VOID);
+
+// Print formatted text (the same formats as Print), then put whatever changed on the screen
+VOID console_print(IN const CHAR16 *format, ...);
+
+// Clear the screen and move the cursor to the top left
+VOID console_clear(VOID);
+
+// Describe the framebuffer for the kernel (left zeroed without GOP)
+VOID console_get_framebuffer(OUT boot_framebuffer_t *framebuffer);
+
+#endif
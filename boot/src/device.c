@@ -1,262 +1,343 @@
 #include "device.h"
-
-#define GPT_HEADER_SIGNATURE 0x5452415020494645ULL // "EFI PART"
+#include "probe.h"
+#include "bootvar.h"
+#include "trace.h"
+#include "console.h"
+#include "arena.h"
+#include "prefetch.h"
+#include "inventory.h"
 
 // Helper function to convert filesystem_t to a string
 static const CHAR16 *filesystem_to_string(filesystem_t type)
 {
     switch (type)
     {
+    case FS_FAT12:
+        return L"FAT12";
+    case FS_FAT16:
+        return L"FAT16";
     case FS_FAT32:
         return L"FAT32";
+    case FS_EXT2:
+        return L"EXT2";
+    case FS_EXT3:
+        return L"EXT3";
     case FS_EXT4:
         return L"EXT4";
+    case FS_NTFS:
+        return L"NTFS";
+    case FS_XFS:
+        return L"XFS";
+    case FS_BTRFS:
+        return L"Btrfs";
+    case FS_SWAP:
+        return L"Swap";
     case FS_NONE:
     default:
         return L"Unknown";
     }
 }
 
+// Helper function to count down to booting a partition, TRUE if nobody pressed a key (other than enter) to get the menu
+static BOOLEAN auto_boot(partition_info_t *partition)
+{
+    CHAR16 message[128];
+    SPrint(message, sizeof(message), L"Booting %s, press enter to boot now or any other key for the menu", partition->name);
+    return countdown(message, AUTO_BOOT_TIMEOUT);
+}
+
+// Helper function to find the first partition that can be booted, as the default when nothing was saved
+static BOOLEAN find_default_partition(device_t *devices, UINTN device_count, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition)
+{
+    for (UINTN i = 0; i < device_count; ++i)
+    {
+        if (EFI_ERROR(devices[i].status))
+            continue;
+
+        for (UINTN j = 0; j < devices[i].partition_count; ++j)
+        {
+            if (devices[i].partitions[j].filesystem.type != FS_EXT4)
+                continue;
+
+            *block_io = devices[i].block_io;
+            *partition = devices[i].partitions[j];
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 // Helper function to print all the partitions in a device
 static VOID print_partitions(partition_info_t *partitions, UINTN partition_count)
 {
-    Print(L"id  | Name                    | Size (MB) | Format FS | GUID\n");
-    Print(L"------------------------------------------------------------------------------------------------\n");
+    trace_begin("print_partitions");
+    console_print(L"id  | Name                    | Size (MB) | Format FS | Label            | GUID\n");
+    console_print(L"-------------------------------------------------------------------------------------------------------------------\n");
 
     // Print partition information
     for (UINTN i = 0; i < partition_count; ++i)
     {
-        Print(L"%3d | %-24s | %8d | %-8s | %g\n",
+        // A format that only matched some of its checks gets a question mark
+        console_print(L"%3d | %-24s | %8d | %-6s%-2s | %-16s | %g\n",
               i + 1,
               partitions[i].name,
               partitions[i].size / (1024 * 1024),
-              filesystem_to_string(partitions[i].format_type),
+              filesystem_to_string(partitions[i].filesystem.type),
+              partitions[i].filesystem.type != FS_NONE && partitions[i].filesystem.confidence < PROBE_CERTAIN ? L"?" : L"",
+              partitions[i].filesystem.label,
               &partitions[i].unique_guid);
-        Print(L"------------------------------------------------------------------------------------------------\n");
+        console_print(L"-------------------------------------------------------------------------------------------------------------------\n");
     }
+
+    trace_end("print_partitions");
 }
 
-// Helper function to determine which filesystem a partition is formatted to
-static filesystem_t determine_format_type(partition_info_t partition, EFI_BLOCK_IO_PROTOCOL *block_io)
+// Helper function to find the partition with a given unique GUID, looking only at the GPTs (no filesystem probing)
+static BOOLEAN find_partition_by_guid(device_t *devices, UINTN device_count, EFI_GUID *guid, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition)
 {
-    UINT8 *buffer;
-    filesystem_t fs = FS_NONE;
-
-    // Allocate buffer for reading parteition data
-    uefi_call_wrapper(BS->AllocatePool, 3, EfiLoaderData, 4096, (VOID **)&buffer);
-
-    if (EFI_ERROR(uefi_call_wrapper(block_io->ReadBlocks, 5,
-            block_io,
-            block_io->Media->MediaId,
-            partition.offset / block_io->Media->BlockSize,
-            4096,
-            buffer
-    )))
-        goto done;
-
-    // Check for FAT32
-    if (buffer[82] == 'F' && buffer[83] == 'A' && buffer[84] == 'T' &&
-        buffer[85] == '3' && buffer[86] == '2')
-    {
-        fs = FS_FAT32;
-        goto done;
-    }
+    if (EFI_ERROR(probe_devices(devices, device_count, FALSE)))
+        return FALSE;
 
-    // Check for EXT4
-    else if (buffer[1080] == 0x53 && buffer[1081] == 0xEF)
+    for (UINTN i = 0; i < device_count; ++i)
     {
-        fs = FS_EXT4;
-        goto done;
+        for (UINTN j = 0; j < devices[i].partition_count; ++j)
+        {
+            partition_info_t *candidate = &devices[i].partitions[j];
+            if (CompareGuid(&candidate->unique_guid, guid) != 0)
+                continue;
+
+            // It has to still be bootable, which only takes one read to check
+            if (probe_filesystem(devices[i].block_io, candidate) != FS_EXT4)
+                return FALSE;
+
+            *block_io = devices[i].block_io;
+            *partition = *candidate;
+            return TRUE;
+        }
     }
 
-done:
-    uefi_call_wrapper(BS->FreePool, 1, buffer);
-    return fs;
+    return FALSE;
 }
 
-// Helper function to find all the partitions in a device (false means error and message should be printed)
-static BOOLEAN get_partitions(OUT partition_info_t partitions[MAX_PARTITIONS], OUT UINTN *count, IN EFI_BLOCK_IO_PROTOCOL *block_io)
+// Helper function to guess which partition will be booted once every device has been probed: the saved one if it's
+// still bootable, otherwise the first that is
+static BOOLEAN find_likely_partition(device_t *devices, UINTN device_count, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition)
 {
-    EFI_STATUS status;
-    EFI_PARTITION_TABLE_HEADER *gpt_header;
-    EFI_PARTITION_ENTRY *partition_entries;
-    UINTN entry_size;
-    UINTN num_entries;
-
-    // Read the GPT header
-    gpt_header = AllocatePool(block_io->Media->BlockSize);
-    status = uefi_call_wrapper(block_io->ReadBlocks, 5,
-        block_io,
-        block_io->Media->MediaId,
-        1,
-        block_io->Media->BlockSize,
-        gpt_header
-    );
-    if (EFI_ERROR(status))
+    EFI_GUID saved_guid;
+    if (!EFI_ERROR(load_boot_partition_guid(&saved_guid)))
     {
-        uefi_call_wrapper(BS->FreePool, 1, gpt_header);
-        Print(L"Failed to read GPT header! Status: %r\n", status);
-        return FALSE;
-    }
+        for (UINTN i = 0; i < device_count; ++i)
+        {
+            if (EFI_ERROR(devices[i].status))
+                continue;
 
-    // Validate the signature
-    if (gpt_header->Header.Signature != GPT_HEADER_SIGNATURE)
-    {
-        uefi_call_wrapper(BS->FreePool, 1, gpt_header);
-        Print(L"Disk is not GPT-Partitioned! (Signature is incorrect)\n");
-        return FALSE;
-    }
+            for (UINTN j = 0; j < devices[i].partition_count; ++j)
+            {
+                partition_info_t *candidate = &devices[i].partitions[j];
+                if (candidate->filesystem.type != FS_EXT4 || CompareGuid(&candidate->unique_guid, &saved_guid) != 0)
+                    continue;
 
-    // Read partition entries
-    entry_size = gpt_header->SizeOfPartitionEntry;
-    num_entries = gpt_header->NumberOfPartitionEntries;
-
-    partition_entries = AllocatePool(entry_size * num_entries);
-    status = uefi_call_wrapper(block_io->ReadBlocks, 5,
-        block_io,
-        block_io->Media->MediaId,
-        gpt_header->PartitionEntryLBA,
-        entry_size * num_entries,
-        partition_entries
-    );
-
-    // Process each partition entry
-    UINTN valid_partitions_count = 0;
-    for (UINTN j = 0; j < num_entries; ++j)
-    {
-        // Check that we are not over
-        if (valid_partitions_count >= MAX_PARTITIONS)
-            break;
-        
-        // Check that the partition is not unused
-        if (CompareGuid(&partition_entries[j].PartitionTypeGUID, &NullGuid) == 0)
-            continue;
-        
-        // Fill out partition information
-        partitions[valid_partitions_count].size = partition_entries[j].EndingLBA - partition_entries[j].StartingLBA - 1;
-        partitions[valid_partitions_count].size *= block_io->Media->BlockSize;
-        partitions[valid_partitions_count].offset = partition_entries[j].StartingLBA * block_io->Media->BlockSize;
-        partitions[valid_partitions_count].format_type = determine_format_type(partitions[valid_partitions_count], block_io);
-        CopyMem(&partitions[valid_partitions_count].type_guid, &partition_entries[j].PartitionTypeGUID, sizeof(EFI_GUID));
-        CopyMem(&partitions[valid_partitions_count].unique_guid, &partition_entries[j].UniquePartitionGUID, sizeof(EFI_GUID));
-        StrCpy(partitions[valid_partitions_count].name, partition_entries[j].PartitionName);
-
-        // Update the valid partitions count value
-        ++valid_partitions_count;
+                *block_io = devices[i].block_io;
+                *partition = *candidate;
+                return TRUE;
+            }
+        }
     }
 
-    // Set the count
-    *count = valid_partitions_count;
-
-    return TRUE;
+    return find_default_partition(devices, device_count, block_io, partition);
 }
 
-EFI_STATUS find_boot_partition(OUT EFI_BLOCK_IO_PROTOCOL *block_io, OUT partition_info_t *partition)
+// Helper function to probe the devices and pick the partition to boot, either on its own or by asking
+static EFI_STATUS choose_partition(device_t *devices, UINTN device_count, IN const char *kernel_path, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition)
 {
     EFI_STATUS status;
-    EFI_HANDLE *handle_buffer;
-    UINTN handle_count, selected_device, partition_count;
-    partition_info_t partitions[MAX_PARTITIONS];
+    UINTN selected_device, partition_count;
+    partition_info_t *partitions;
 
-    // Get all Block IO handles
-    status = uefi_call_wrapper(BS->LocateHandleBuffer, 5,
-        ByProtocol,
-        &gEfiBlockIoProtocolGuid,
-        NULL,
-        &handle_count,
-        &handle_buffer);
-    
+    // Boot the partition that was chosen last time straight away, unless a key is held down
+    EFI_GUID saved_guid;
+    BOOLEAN skip_menu = !key_pressed();
+    if (skip_menu && !EFI_ERROR(load_boot_partition_guid(&saved_guid)))
+    {
+        trace_begin("find_partition_by_guid");
+        BOOLEAN found = find_partition_by_guid(devices, device_count, &saved_guid, block_io, partition);
+        trace_end("find_partition_by_guid");
+        if (found)
+            return EFI_SUCCESS;
+    }
+
+    // Read every device's partitions up front, all at the same time
+    trace_begin("probe_devices");
+    status = probe_devices(devices, device_count, TRUE);
+    trace_end("probe_devices");
     if (EFI_ERROR(status))
     {
-        Print(L"Failed to locate Block IO handles! Status: %r\n", status);
+        console_print(L"Failed to probe block io devices! Status: %r\n", status);
         return status;
     }
 
-    // Get all of the Block IO devices
-    EFI_BLOCK_IO_PROTOCOL *devices[handle_count];
-    for (UINTN i = 0; i < handle_count; ++i)
+    // Read ahead from the partition that's most likely to be picked while the countdown or the menu waits
+    EFI_BLOCK_IO_PROTOCOL *likely_block_io;
+    partition_info_t likely_partition;
+    if (find_likely_partition(devices, device_count, &likely_block_io, &likely_partition))
     {
-        status = uefi_call_wrapper(BS->HandleProtocol, 3,
-            handle_buffer[i],
-            &gEfiBlockIoProtocolGuid,
-            (VOID**)&devices[i]
-        );
-        if (EFI_ERROR(status))
-        {
-            Print(L"Failed to get block io device for handle %d! Status: %r\n", i, status);
-            return status;
-        }
-
-        // Check if the device's media is present
-        if (devices[i]->Media->MediaPresent)
-        {
-            Print(L"Failed to block io device for handle %d! (Media not present)\n", i);
-        }
+        prefetch_start(likely_block_io, &likely_partition, kernel_path);
+        set_idle_work(prefetch_step);
     }
 
+    // Nothing saved (or it's gone), so count down to the first bootable partition instead
+    if (skip_menu && find_default_partition(devices, device_count, block_io, partition) && auto_boot(partition))
+        return EFI_SUCCESS;
+
     // Ask
-    uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    console_clear();
     while (TRUE)
     {
-        Print(L"%d handles were found.", handle_count);
+        console_print(L"%d handles were found.", device_count);
         selected_device = read_number(
             L"\nPlease select one device to view the metadata of (0):",
-            handle_count
+            device_count
         );
 
         // Clear the screen
-        uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+        console_clear();
 
         // Print the partitions in that device
-        if (get_partitions(partitions, &partition_count, devices[selected_device]))
+        device_t *device = &devices[selected_device];
+        if (device->status == EFI_NOT_FOUND)
         {
-            Print(L"Metadata for device %d\n", selected_device);
-            Print(L"Bytes per block: %lu\n", devices[selected_device]->Media->BlockSize);
-            Print(devices[selected_device]->Media->RemovableMedia ? L"Removable\n" : L"Nonremovable\n");
-            Print(L"Partitions:\n");
-            print_partitions(partitions, partition_count);
+            console_print(L"Disk is not GPT-Partitioned! (Signature is incorrect)\n");
+            continue;
         }
-        else
+        else if (device->status == EFI_NO_MEDIA)
+        {
+            console_print(L"Media not present!\n");
             continue;
+        }
+        else if (EFI_ERROR(device->status))
+        {
+            console_print(L"Failed to read GPT header! Status: %r\n", device->status);
+            continue;
+        }
+
+        partitions = device->partitions;
+        partition_count = device->partition_count;
+        console_print(L"Metadata for device %d\n", selected_device);
+        console_print(L"Bytes per block: %lu\n", device->block_io->Media->BlockSize);
+        console_print(device->block_io->Media->RemovableMedia ? L"Removable\n" : L"Nonremovable\n");
+        console_print(L"Partitions:\n");
+        print_partitions(partitions, partition_count);
         
         // Check if the user wants to boot from here
         if (yes_or_no(L"\nIs this the device YOU want to use: "))
         {
-            *block_io = *devices[selected_device];
+            *block_io = device->block_io;
         }
         else
             continue;
         
         // Determine the partition on this disk the user wants to use
         UINTN chosen_partition;
-        uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+        console_clear();
         while (TRUE)
         {
-            Print(L"Partitions in device %d:\n", selected_device);
+            console_print(L"Partitions in device %d:\n", selected_device);
             print_partitions(partitions, partition_count);
             chosen_partition = read_number(L"\nWhat partition do you want to boot from? Select the partition id or 0 to clear the screen (0): ", partition_count + 1);
             
             // Check if we want to clear the screen
             if (chosen_partition == 0)
             {
-                uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+                console_clear();
                 continue;
             }
 
             --chosen_partition;
 
             // Check if the partition matches the requirements
-            if (partitions[chosen_partition].format_type != FS_EXT4)
+            if (partitions[chosen_partition].filesystem.type != FS_EXT4)
             {
-                uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
-                Print(L"Partition not EXT4 formatted\n");
+                console_clear();
+                console_print(L"Partition not EXT4 formatted\n");
                 continue;
             }
 
+            // Remember it so the next boot can skip all of this
             *partition = partitions[chosen_partition];
+            save_boot_partition_guid(&partition->unique_guid);
             return EFI_SUCCESS;
         }
 
-        Print(L"\n");
+        console_print(L"\n");
+    }
+}
+
+EFI_STATUS find_boot_partition(IN const char *kernel_path, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition)
+{
+    EFI_STATUS status;
+    EFI_HANDLE *handle_buffer;
+    UINTN handle_count;
+    arena_mark_t mark = arena_mark();
+
+    // Get all Block IO handles
+    trace_begin("LocateHandleBuffer");
+    status = uefi_call_wrapper(BS->LocateHandleBuffer, 5,
+        ByProtocol,
+        &gEfiBlockIoProtocolGuid,
+        NULL,
+        &handle_count,
+        &handle_buffer);
+    trace_end("LocateHandleBuffer");
+    
+    if (EFI_ERROR(status))
+    {
+        console_print(L"Failed to locate Block IO handles! Status: %r\n", status);
+        return status;
+    }
+
+    // Get all of the Block IO devices (they're only needed until a partition is chosen)
+    device_t *devices = arena_alloc_zero(handle_count * sizeof(device_t), 0);
+    if (devices == NULL)
+    {
+        FreePool(handle_buffer);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    trace_begin("HandleProtocol");
+    for (UINTN i = 0; i < handle_count; ++i)
+    {
+        devices[i].handle = handle_buffer[i];
+        status = uefi_call_wrapper(BS->HandleProtocol, 3,
+            handle_buffer[i],
+            &gEfiBlockIoProtocolGuid,
+            (VOID**)&devices[i].block_io
+        );
+        if (EFI_ERROR(status))
+        {
+            console_print(L"Failed to get block io device for handle %d! Status: %r\n", i, status);
+            break;
+        }
+    }
+    trace_end("HandleProtocol");
+    FreePool(handle_buffer);
+
+    if (!EFI_ERROR(status))
+        status = choose_partition(devices, handle_count, kernel_path, block_io, partition);
+
+    // Keep what was found for the kernel (the devices go back to the arena below)
+    if (!EFI_ERROR(status))
+    {
+        EFI_STATUS inventory_status = inventory_build(devices, handle_count, *block_io, partition);
+        if (EFI_ERROR(inventory_status))
+            console_print(L"Failed to save the disk inventory! Status: %r\n", inventory_status);
     }
+
+    // Whatever was read ahead stays for the kernel to be loaded from, unless nothing was chosen
+    set_idle_work(NULL);
+    if (EFI_ERROR(status))
+        prefetch_release();
+
+    arena_reset(mark);
+    return status;
 }
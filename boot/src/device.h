@@ -5,27 +5,61 @@
 #include <efilib.h>
 #include <efigpt.h>
 #include "bootio.h"
+#include "blockcache.h"
 
 #define MAX_PARTITIONS 128
 
+#define MAX_LABEL_LENGTH 32
+
 typedef enum
 {
     FS_NONE,
+    FS_FAT12,
+    FS_FAT16,
     FS_FAT32,
+    FS_EXT2,
+    FS_EXT3,
     FS_EXT4,
+    FS_NTFS,
+    FS_XFS,
+    FS_BTRFS,
+    FS_SWAP,
 } filesystem_t;
 
+// What probing a partition found out about its filesystem
+typedef struct
+{
+    filesystem_t type;
+    UINT8 confidence;                   // 0 (nothing matched) to 100 (every check passed)
+    UINT8 volume_id_size;               // 16 for a UUID, 4 or 8 for a FAT or NTFS serial number, 0 if there's none
+    UINT8 volume_id[16];
+    CHAR16 label[MAX_LABEL_LENGTH + 1]; // Empty if the filesystem has none (or keeps it somewhere we didn't read)
+} filesystem_info_t;
+
 typedef struct
 {
     CHAR16 name[36];
-    filesystem_t format_type;
+    filesystem_info_t filesystem;
     UINT64 size;
     UINT64 offset;
     EFI_GUID type_guid;
     EFI_GUID unique_guid;
 } partition_info_t;
 
-// Out of all of the partitions on all of the devices, find the ONE partition that the user chooses to boot from (this system will probably be changed in the future)
-EFI_STATUS find_boot_partition(OUT EFI_BLOCK_IO_PROTOCOL *block_io, OUT partition_info_t *partition);
+typedef struct
+{
+    EFI_HANDLE handle;
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    EFI_BLOCK_IO2_PROTOCOL *block_io2;    // NULL if the firmware doesn't provide it for this device
+    EFI_STATUS status;                    // Why the device couldn't be probed (EFI_NOT_FOUND means it isn't GPT-partitioned)
+    BOOLEAN filesystems_probed;           // FALSE if only the GPT was read
+    UINTN partition_count;
+    partition_info_t partitions[MAX_PARTITIONS];
+} device_t;
+
+// Out of all of the partitions on all of the devices, find the ONE partition that the user chooses to boot from
+// (the choice is saved, and the next boot uses it straight away unless it's gone or a key is held down). While it
+// waits on the user, the start of kernel_path is read ahead from the partition most likely to be chosen
+EFI_STATUS find_boot_partition(IN const char *kernel_path, OUT EFI_BLOCK_IO_PROTOCOL **block_io, OUT partition_info_t *partition);
 
 #endif
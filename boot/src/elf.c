@@ -0,0 +1,318 @@
+#include "elf.h"
+#include "console.h"
+
+#define PAGE_DOWN(address) ((address) & ~(UINT64)(EFI_PAGE_SIZE - 1))
+#define PAGE_UP(address) PAGE_DOWN((address) + EFI_PAGE_SIZE - 1)
+
+// Pages allocated for the segments, so they can be given back if loading fails
+typedef struct
+{
+    EFI_PHYSICAL_ADDRESS address;
+    UINTN pages;
+} allocation_t;
+
+// Helper function to get the address a segment wants (position independent files only have a virtual one that means anything)
+static UINT64 segment_address(elf64_header_t *header, elf64_program_header_t *segment)
+{
+    return header->type == ELF_TYPE_DYN ? segment->vaddr : segment->paddr;
+}
+
+// Helper function to check the header describes something we can run
+static EFI_STATUS check_header(elf64_header_t *header)
+{
+    if (header->magic != ELF_MAGIC || header->class != ELF_CLASS_64 || header->data != ELF_DATA_LITTLE_ENDIAN)
+        return EFI_LOAD_ERROR;
+    if (header->machine != ELF_MACHINE_X86_64)
+        return EFI_UNSUPPORTED;
+    if (header->type != ELF_TYPE_EXEC && header->type != ELF_TYPE_DYN)
+        return EFI_UNSUPPORTED;
+    if (header->phentsize != sizeof(elf64_program_header_t) || header->phnum == 0 || header->phnum > ELF_MAX_PROGRAM_HEADERS)
+        return EFI_LOAD_ERROR;
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to check the segments make sense and find the pages they cover
+static EFI_STATUS check_segments(elf64_header_t *header, elf64_program_header_t *segments, OUT UINT64 *start, OUT UINT64 *end)
+{
+    UINT64 previous_end = 0;
+    BOOLEAN found = FALSE;
+
+    for (UINTN i = 0; i < header->phnum; ++i)
+    {
+        elf64_program_header_t *segment = &segments[i];
+        if (segment->type != ELF_PT_LOAD || segment->memsz == 0)
+            continue;
+
+        UINT64 address = segment_address(header, segment);
+        if (segment->filesz > segment->memsz || address + segment->memsz < address)
+            return EFI_LOAD_ERROR;
+
+        // PT_LOAD segments have to come in address order and can't overlap
+        if (found && address < previous_end)
+            return EFI_LOAD_ERROR;
+
+        if (!found)
+            *start = PAGE_DOWN(address);
+        previous_end = address + segment->memsz;
+        found = TRUE;
+    }
+
+    if (!found)
+        return EFI_LOAD_ERROR;
+
+    *end = PAGE_UP(previous_end);
+    return EFI_SUCCESS;
+}
+
+// Helper function to give back everything allocated so far
+static VOID free_allocations(allocation_t *allocations, UINTN count)
+{
+    for (UINTN i = 0; i < count; ++i)
+        uefi_call_wrapper(BS->FreePages, 2, allocations[i].address, allocations[i].pages);
+}
+
+// Helper function to allocate the pages of each segment at its own address (a page shared with the previous segment
+// is already allocated, so it's skipped)
+static EFI_STATUS allocate_in_place(elf64_header_t *header, elf64_program_header_t *segments,
+    OUT allocation_t *allocations, OUT UINTN *allocation_count)
+{
+    EFI_STATUS status;
+    UINT64 allocated_end = 0;
+
+    *allocation_count = 0;
+    for (UINTN i = 0; i < header->phnum; ++i)
+    {
+        elf64_program_header_t *segment = &segments[i];
+        if (segment->type != ELF_PT_LOAD || segment->memsz == 0)
+            continue;
+
+        UINT64 address = segment_address(header, segment);
+        UINT64 first = PAGE_DOWN(address);
+        UINT64 last = PAGE_UP(address + segment->memsz);
+        if (first < allocated_end)
+            first = allocated_end;
+        if (first >= last)
+            continue;
+
+        EFI_PHYSICAL_ADDRESS pages = first;
+        status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress, EfiLoaderData, EFI_SIZE_TO_PAGES(last - first), &pages);
+        if (EFI_ERROR(status))
+        {
+            free_allocations(allocations, *allocation_count);
+            *allocation_count = 0;
+            return status;
+        }
+
+        allocations[*allocation_count].address = pages;
+        allocations[*allocation_count].pages = EFI_SIZE_TO_PAGES(last - first);
+        ++*allocation_count;
+        allocated_end = last;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to allocate the whole image anywhere, keeping the biggest alignment a segment asks for
+static EFI_STATUS allocate_anywhere(elf64_header_t *header, elf64_program_header_t *segments, UINT64 start, UINT64 end,
+    OUT allocation_t *allocation, OUT UINT64 *base)
+{
+    EFI_STATUS status;
+    UINT64 align = EFI_PAGE_SIZE;
+
+    for (UINTN i = 0; i < header->phnum; ++i)
+    {
+        if (segments[i].type == ELF_PT_LOAD && segments[i].align > align)
+            align = segments[i].align;
+    }
+    if ((align & (align - 1)) != 0)
+        return EFI_LOAD_ERROR;
+
+    // Over-allocate by the alignment, then give back the slack on either side
+    UINTN image_pages = EFI_SIZE_TO_PAGES(end - start);
+    UINTN slack_pages = EFI_SIZE_TO_PAGES(align) - 1;
+    EFI_PHYSICAL_ADDRESS pages;
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, image_pages + slack_pages, &pages);
+    if (EFI_ERROR(status))
+        return status;
+
+    UINT64 aligned = (pages + align - 1) & ~(align - 1);
+    UINTN before = EFI_SIZE_TO_PAGES(aligned - pages);
+    if (before > 0)
+        uefi_call_wrapper(BS->FreePages, 2, pages, before);
+    if (slack_pages - before > 0)
+        uefi_call_wrapper(BS->FreePages, 2, aligned + image_pages * EFI_PAGE_SIZE, slack_pages - before);
+
+    allocation->address = aligned;
+    allocation->pages = image_pages;
+    *base = aligned;
+    return EFI_SUCCESS;
+}
+
+// Helper function to apply the RELATIVE relocations of a position independent image (the only kind a freestanding
+// kernel should have)
+static EFI_STATUS relocate(elf64_header_t *header, elf64_program_header_t *segments, elf_image_t *image)
+{
+    elf64_program_header_t *dynamic_segment = NULL;
+    UINT64 rela = 0;
+    UINT64 rela_size = 0;
+    UINT64 rela_entry_size = sizeof(elf64_rela_t);
+
+    for (UINTN i = 0; i < header->phnum; ++i)
+    {
+        if (segments[i].type == ELF_PT_DYNAMIC)
+            dynamic_segment = &segments[i];
+    }
+
+    // Nothing to fix up
+    if (dynamic_segment == NULL)
+        return EFI_SUCCESS;
+
+    // Everything the relocations touch has to be inside the image we just loaded
+    #define IN_IMAGE(address, size) ((address) >= image->physical_start && (size) <= image->physical_end - (address))
+
+    UINT64 dynamic_address = dynamic_segment->vaddr + image->load_bias;
+    if (!IN_IMAGE(dynamic_address, dynamic_segment->memsz))
+        return EFI_LOAD_ERROR;
+
+    elf64_dynamic_t *dynamic = (elf64_dynamic_t *)(UINTN)dynamic_address;
+    for (UINTN i = 0; i < dynamic_segment->memsz / sizeof(elf64_dynamic_t) && dynamic[i].tag != ELF_DT_NULL; ++i)
+    {
+        if (dynamic[i].tag == ELF_DT_RELA)
+            rela = dynamic[i].value + image->load_bias;
+        else if (dynamic[i].tag == ELF_DT_RELASZ)
+            rela_size = dynamic[i].value;
+        else if (dynamic[i].tag == ELF_DT_RELAENT)
+            rela_entry_size = dynamic[i].value;
+    }
+
+    if (rela_size == 0)
+        return EFI_SUCCESS;
+    if (rela_entry_size < sizeof(elf64_rela_t) || !IN_IMAGE(rela, rela_size))
+        return EFI_LOAD_ERROR;
+
+    for (UINT64 offset = 0; offset + rela_entry_size <= rela_size; offset += rela_entry_size)
+    {
+        elf64_rela_t *entry = (elf64_rela_t *)(UINTN)(rela + offset);
+        UINT32 type = (UINT32)entry->info;
+
+        if (type == ELF_R_X86_64_NONE)
+            continue;
+        if (type != ELF_R_X86_64_RELATIVE)
+            return EFI_UNSUPPORTED;
+
+        UINT64 target = entry->offset + image->load_bias;
+        if (!IN_IMAGE(target, sizeof(UINT64)))
+            return EFI_LOAD_ERROR;
+
+        *(UINT64 *)(UINTN)target = image->load_bias + entry->addend;
+    }
+
+    #undef IN_IMAGE
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS elf_load(IN file_t *file, OUT elf_image_t *image)
+{
+    EFI_STATUS status;
+    elf64_header_t header;
+    elf64_program_header_t segments[ELF_MAX_PROGRAM_HEADERS];
+    allocation_t allocations[ELF_MAX_PROGRAM_HEADERS];
+    UINTN allocation_count = 0;
+    UINT64 start, end;
+
+    // Only the headers are read up front, the segments go straight to where they belong
+    status = file_read(file, 0, sizeof(header), &header);
+    if (EFI_ERROR(status))
+        return status;
+
+    status = check_header(&header);
+    if (EFI_ERROR(status))
+        return status;
+
+    status = file_read(file, header.phoff, header.phnum * sizeof(elf64_program_header_t), segments);
+    if (EFI_ERROR(status))
+        return status;
+
+    status = check_segments(&header, segments, &start, &end);
+    if (EFI_ERROR(status))
+        return status;
+
+    // Try to put it where it asked to go, and move it if that's taken and it can be moved
+    image->load_bias = 0;
+    status = allocate_in_place(&header, segments, allocations, &allocation_count);
+    if (EFI_ERROR(status))
+    {
+        if (header.type != ELF_TYPE_DYN)
+        {
+            console_print(L"Kernel wants 0x%lx-0x%lx, which is taken, and it can't be relocated\n", start, end);
+            return status;
+        }
+
+        UINT64 base;
+        status = allocate_anywhere(&header, segments, start, end, &allocations[0], &base);
+        if (EFI_ERROR(status))
+            return status;
+
+        allocation_count = 1;
+        image->load_bias = (INT64)(base - start);
+    }
+
+    image->physical_start = start + image->load_bias;
+    image->physical_end = end + image->load_bias;
+
+    // Read each segment into place and zero its BSS (the padding around segments is left alone)
+    for (UINTN i = 0; i < header.phnum; ++i)
+    {
+        elf64_program_header_t *segment = &segments[i];
+        if (segment->type != ELF_PT_LOAD || segment->memsz == 0)
+            continue;
+
+        UINT8 *dest = (UINT8 *)(UINTN)(segment_address(&header, segment) + image->load_bias);
+        status = file_read(file, segment->offset, segment->filesz, dest);
+        if (EFI_ERROR(status))
+            goto fail;
+
+        if (segment->memsz > segment->filesz)
+            ZeroMem(dest + segment->filesz, segment->memsz - segment->filesz);
+    }
+
+    if (header.type == ELF_TYPE_DYN)
+    {
+        status = relocate(&header, segments, image);
+        if (EFI_ERROR(status))
+            goto fail;
+
+        image->entry = header.entry + image->load_bias;
+        image->virtual_start = image->physical_start;
+        image->virtual_entry = image->entry;
+        return EFI_SUCCESS;
+    }
+
+    // The first segment says where the image was linked to run
+    for (UINTN i = 0; i < header.phnum; ++i)
+    {
+        if (segments[i].type == ELF_PT_LOAD && segments[i].memsz != 0)
+        {
+            image->virtual_start = PAGE_DOWN(segments[i].vaddr);
+            break;
+        }
+    }
+    image->virtual_entry = header.entry;
+
+    // Fixed kernels can be linked to run somewhere else (e.g. the higher half), so find where the entry point was put
+    for (UINTN i = 0; i < header.phnum; ++i)
+    {
+        elf64_program_header_t *segment = &segments[i];
+        if (segment->type == ELF_PT_LOAD && header.entry >= segment->vaddr && header.entry - segment->vaddr < segment->memsz)
+        {
+            image->entry = segment->paddr + (header.entry - segment->vaddr);
+            return EFI_SUCCESS;
+        }
+    }
+    status = EFI_LOAD_ERROR;
+
+fail:
+    free_allocations(allocations, allocation_count);
+    return status;
+}
@@ -0,0 +1,109 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "file.h"
+
+// --------------------------
+// On-disk constants
+// --------------------------
+
+#define ELF_MAGIC 0x464C457F            // "\x7FELF"
+#define ELF_CLASS_64 2
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define ELF_MACHINE_X86_64 62
+
+// Types
+#define ELF_TYPE_EXEC 2                 // Fixed addresses
+#define ELF_TYPE_DYN 3                  // Position independent
+
+// Program header types
+#define ELF_PT_LOAD 1
+#define ELF_PT_DYNAMIC 2
+
+// Dynamic tags
+#define ELF_DT_NULL 0
+#define ELF_DT_RELA 7
+#define ELF_DT_RELASZ 8
+#define ELF_DT_RELAENT 9
+
+// Relocation types
+#define ELF_R_X86_64_NONE 0
+#define ELF_R_X86_64_RELATIVE 8
+
+// Most program headers we'll look at
+#define ELF_MAX_PROGRAM_HEADERS 64
+
+// --------------------------
+// On-disk structures
+// --------------------------
+
+typedef struct
+{
+    UINT32 magic;                   // ELF_MAGIC
+    UINT8 class;
+    UINT8 data;
+    UINT8 ident_version;
+    UINT8 os_abi;
+    UINT8 abi_version;
+    UINT8 pad[7];
+    UINT16 type;
+    UINT16 machine;
+    UINT32 version;
+    UINT64 entry;
+    UINT64 phoff;                   // File offset of the program headers
+    UINT64 shoff;
+    UINT32 flags;
+    UINT16 ehsize;
+    UINT16 phentsize;
+    UINT16 phnum;
+    UINT16 shentsize;
+    UINT16 shnum;
+    UINT16 shstrndx;
+} __attribute__((packed)) elf64_header_t;
+
+typedef struct
+{
+    UINT32 type;
+    UINT32 flags;
+    UINT64 offset;                  // Where the data is in the file
+    UINT64 vaddr;
+    UINT64 paddr;                   // Where it should be in physical memory
+    UINT64 filesz;
+    UINT64 memsz;                   // Anything past filesz is zeroed (BSS)
+    UINT64 align;
+} __attribute__((packed)) elf64_program_header_t;
+
+typedef struct
+{
+    INT64 tag;
+    UINT64 value;
+} __attribute__((packed)) elf64_dynamic_t;
+
+typedef struct
+{
+    UINT64 offset;
+    UINT64 info;                    // Type in the low 32 bits
+    INT64 addend;
+} __attribute__((packed)) elf64_rela_t;
+
+// --------------------------
+// Loader
+// --------------------------
+
+typedef struct
+{
+    UINT64 entry;                   // Entry point, after relocation
+    UINT64 physical_start;          // First page the segments were put in
+    UINT64 physical_end;            // End of the last page
+    INT64 load_bias;                // What was added to the addresses in the file (0 unless relocated)
+    UINT64 virtual_start;           // Where physical_start was linked to run (the same for relocated files)
+    UINT64 virtual_entry;           // Entry point at that address
+} elf_image_t;
+
+// Put each PT_LOAD segment at its physical address (or anywhere, relocated, if that's taken and the file is
+// position independent), reading the file data straight into place
+EFI_STATUS elf_load(IN file_t *file, OUT elf_image_t *image);
+
+#endif
@@ -0,0 +1,455 @@
+#include "ext4.h"
+
+// Something that gets called for every extent of a file, in logical order
+typedef EFI_STATUS (*extent_visitor_t)(ext4_file_t *file, UINT64 logical, UINT64 physical, UINT64 length, BOOLEAN uninit, VOID *context);
+
+// State for reading a range of a file
+typedef struct
+{
+    UINT64 start;       // First byte wanted
+    UINT64 end;         // One past the last byte wanted
+    UINT64 filled;      // Everything before this has been written to the buffer
+    UINT8 *buffer;      // Where start goes
+    BOOLEAN overrun;    // The buffer has room up to the end of the last block, so it can be read whole
+    io_queue_t *queue;  // Whole blocks wait here to be read together once every extent has been seen
+} read_context_t;
+
+// Helper function to read bytes of metadata through the block cache (size must fit in the scratch buffer)
+static EFI_STATUS read_metadata(ext4_fs_t *fs, UINT64 byte_offset, UINTN size, VOID *dest)
+{
+    EFI_STATUS status;
+    UINT32 device_block_size = fs->block_io->Media->BlockSize;
+    UINT64 first_byte = fs->offset + byte_offset;
+    EFI_LBA first_lba = first_byte / device_block_size;
+    EFI_LBA last_lba = (first_byte + size - 1) / device_block_size;
+    UINTN read_size = (last_lba - first_lba + 1) * device_block_size;
+
+    if (read_size > fs->scratch_size)
+        return EFI_BAD_BUFFER_SIZE;
+
+    status = block_cache_read(fs->block_io, first_lba, read_size, fs->scratch);
+    if (EFI_ERROR(status))
+        return status;
+
+    CopyMem(dest, fs->scratch + (first_byte - first_lba * device_block_size), size);
+    return EFI_SUCCESS;
+}
+
+// Helper function to queue whole filesystem blocks to be read straight into the destination
+static EFI_STATUS queue_blocks(ext4_fs_t *fs, io_queue_t *queue, UINT64 block, UINT64 count, VOID *dest)
+{
+    UINT32 device_block_size = fs->block_io->Media->BlockSize;
+    return io_queue_add(queue, (fs->offset + block * fs->block_size) / device_block_size, count * fs->block_size, dest);
+}
+
+// Helper function to read an inode
+static EFI_STATUS read_inode(ext4_fs_t *fs, UINT32 number, OUT ext4_inode_t *inode)
+{
+    EFI_STATUS status;
+    ext4_group_desc_t desc;
+
+    if (number == 0 || number > fs->inodes_per_group * fs->group_count)
+        return EFI_NOT_FOUND;
+
+    // Find the inode table through the group descriptor
+    UINT64 group = (number - 1) / fs->inodes_per_group;
+    UINT64 index = (number - 1) % fs->inodes_per_group;
+    UINT64 desc_offset = (UINT64)(fs->first_data_block + 1) * fs->block_size + group * fs->desc_size;
+
+    ZeroMem(&desc, sizeof(desc));
+    status = read_metadata(fs, desc_offset, fs->desc_size < sizeof(desc) ? fs->desc_size : sizeof(desc), &desc);
+    if (EFI_ERROR(status))
+        return status;
+
+    UINT64 inode_table = desc.inode_table_lo;
+    if (fs->desc_size >= sizeof(desc))
+        inode_table |= (UINT64)desc.inode_table_hi << 32;
+
+    return read_metadata(fs, inode_table * fs->block_size + index * fs->inode_size, sizeof(ext4_inode_t), inode);
+}
+
+// Helper function to walk an extent tree node (root is inside the inode, the rest are whole blocks). node_size is how
+// many bytes the node has, which the entries on disk can't be trusted to stay inside
+static EFI_STATUS walk_extents(ext4_file_t *file, ext4_extent_header_t *header, UINTN node_size, UINTN depth_left,
+                               UINT64 first_wanted, UINT64 last_wanted, extent_visitor_t visit, VOID *context)
+{
+    EFI_STATUS status = EFI_SUCCESS;
+    ext4_fs_t *fs = file->fs;
+
+    if (header->magic != EXT4_EXTENT_MAGIC || depth_left == 0 || header->depth >= depth_left)
+        return EFI_VOLUME_CORRUPTED;
+
+    // Extents and indexes are both 12 bytes, the same as the header
+    if (header->entries > header->max
+        || sizeof(ext4_extent_header_t) + (UINTN)header->max * sizeof(ext4_extent_t) > node_size)
+        return EFI_VOLUME_CORRUPTED;
+
+    // Leaf: hand every extent to the visitor
+    if (header->depth == 0)
+    {
+        ext4_extent_t *extents = (ext4_extent_t *)(header + 1);
+        for (UINTN i = 0; i < header->entries; ++i)
+        {
+            UINT64 length = extents[i].len;
+            BOOLEAN uninit = length > EXT4_UNINIT_EXTENT_LEN;
+            if (uninit)
+                length -= EXT4_UNINIT_EXTENT_LEN;
+
+            // Skip what's outside the range we care about
+            if (extents[i].block + length <= first_wanted)
+                continue;
+            if (extents[i].block > last_wanted)
+                break;
+
+            UINT64 physical = ((UINT64)extents[i].start_hi << 32) | extents[i].start_lo;
+            status = visit(file, extents[i].block, physical, length, uninit, context);
+            if (EFI_ERROR(status))
+                return status;
+        }
+        return EFI_SUCCESS;
+    }
+
+    // Index: only go down the subtrees that overlap the range
+    ext4_extent_idx_t *indexes = (ext4_extent_idx_t *)(header + 1);
+    arena_mark_t mark = arena_mark();
+    UINT8 *node = arena_alloc(fs->block_size, 0);
+    if (node == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    for (UINTN i = 0; i < header->entries; ++i)
+    {
+        if (i + 1 < header->entries && indexes[i + 1].block <= first_wanted)
+            continue;
+        if (indexes[i].block > last_wanted)
+            break;
+
+        UINT64 leaf = ((UINT64)indexes[i].leaf_hi << 32) | indexes[i].leaf_lo;
+        status = read_metadata(fs, leaf * fs->block_size, fs->block_size, node);
+        if (EFI_ERROR(status))
+            break;
+
+        // Every level down has to be exactly one less deep
+        if (((ext4_extent_header_t *)node)->depth != header->depth - 1)
+        {
+            status = EFI_VOLUME_CORRUPTED;
+            break;
+        }
+
+        status = walk_extents(file, (ext4_extent_header_t *)node, fs->block_size, depth_left - 1, first_wanted,
+            last_wanted, visit, context);
+        if (EFI_ERROR(status))
+            break;
+    }
+
+    arena_reset(mark);
+    return status;
+}
+
+// Helper function to copy part of a single block into the buffer (for the unaligned ends of a range)
+static EFI_STATUS read_partial_block(ext4_fs_t *fs, UINT64 physical_block, UINTN offset_in_block, UINTN length, UINT8 *dest)
+{
+    return read_metadata(fs, physical_block * fs->block_size + offset_in_block, length, dest);
+}
+
+// Helper function to read the part of one extent that falls inside the wanted range
+static EFI_STATUS read_extent(ext4_file_t *file, UINT64 logical, UINT64 physical, UINT64 length, BOOLEAN uninit, VOID *context)
+{
+    EFI_STATUS status;
+    read_context_t *read = context;
+    ext4_fs_t *fs = file->fs;
+    UINT64 block_size = fs->block_size;
+
+    // Clip the extent to the range
+    UINT64 from = logical * block_size;
+    UINT64 to = (logical + length) * block_size;
+    if (from < read->filled)
+        from = read->filled;
+    if (to > read->end)
+        to = read->end;
+    if (from >= to)
+        return EFI_SUCCESS;
+
+    // Anything skipped since the last extent is a hole
+    if (from > read->filled)
+        ZeroMem(read->buffer + (read->filled - read->start), from - read->filled);
+
+    UINT8 *dest = read->buffer + (from - read->start);
+    read->filled = to;
+
+    // Unwritten extents read as zeros
+    if (uninit)
+    {
+        ZeroMem(dest, to - from);
+        return EFI_SUCCESS;
+    }
+
+    // Unaligned head
+    if (from % block_size != 0)
+    {
+        UINT64 head_end = (from / block_size + 1) * block_size;
+        if (head_end > to)
+            head_end = to;
+
+        status = read_partial_block(fs, physical + (from / block_size - logical), from % block_size, head_end - from, dest);
+        if (EFI_ERROR(status))
+            return status;
+
+        dest += head_end - from;
+        from = head_end;
+    }
+
+    // Whole blocks in the middle, in one go (taking the last partial block along too if there's room for it)
+    UINT64 direct_end = to;
+    if (read->overrun && to == read->end)
+        direct_end = (to + block_size - 1) / block_size * block_size;
+
+    UINT64 whole_blocks = (direct_end - from) / block_size;
+    if (whole_blocks > 0)
+    {
+        status = queue_blocks(fs, read->queue, physical + (from / block_size - logical), whole_blocks, dest);
+        if (EFI_ERROR(status))
+            return status;
+
+        dest += whole_blocks * block_size;
+        from += whole_blocks * block_size;
+    }
+
+    // Unaligned tail
+    if (from < to && direct_end == to)
+        return read_partial_block(fs, physical + (from / block_size - logical), 0, to - from, dest);
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to look a name up in a directory. Directories are scanned linearly: htree index blocks are
+// disguised as empty entries so the scan steps over them, and boot directories are far too small for hashing to pay off
+static EFI_STATUS find_in_directory(ext4_file_t *directory, const char *name, UINTN name_length, OUT UINT32 *inode)
+{
+    EFI_STATUS status;
+    UINT8 *entries;
+    ext4_fs_t *fs = directory->fs;
+    arena_mark_t mark = arena_mark();
+
+    if ((directory->inode.mode & EXT4_S_IFMT) != EXT4_S_IFDIR)
+        return EFI_NOT_FOUND;
+
+    entries = arena_alloc(directory->size, 0);
+    if (entries == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    status = ext4_read(directory, 0, directory->size, entries);
+    if (EFI_ERROR(status))
+        goto done;
+
+    status = EFI_NOT_FOUND;
+    for (UINT64 block = 0; block < directory->size; block += fs->block_size)
+    {
+        UINTN offset = 0;
+        while (offset + sizeof(ext4_dir_entry_t) <= fs->block_size && block + offset < directory->size)
+        {
+            ext4_dir_entry_t *entry = (ext4_dir_entry_t *)(entries + block + offset);
+
+            // A record length of 0 or 65535 means the rest of a 64K block
+            UINTN rec_len = entry->rec_len;
+            if (rec_len == 0 || rec_len == 65535)
+                rec_len = fs->block_size;
+            if (rec_len < sizeof(ext4_dir_entry_t) || offset + rec_len > fs->block_size)
+                break;
+
+            if (entry->inode != 0 && entry->name_len == name_length &&
+                CompareMem(entry->name, name, name_length) == 0)
+            {
+                *inode = entry->inode;
+                status = EFI_SUCCESS;
+                goto done;
+            }
+
+            offset += rec_len;
+        }
+    }
+
+done:
+    arena_reset(mark);
+    return status;
+}
+
+// Helper function to fill out a file from its inode number
+static EFI_STATUS open_inode(ext4_fs_t *fs, UINT32 number, OUT ext4_file_t *file)
+{
+    EFI_STATUS status = read_inode(fs, number, &file->inode);
+    if (EFI_ERROR(status))
+        return status;
+
+    file->fs = fs;
+    file->number = number;
+    file->size = file->inode.size_lo | ((UINT64)file->inode.size_high << 32);
+
+    // Only extent-mapped files are supported
+    if (!(file->inode.flags & EXT4_EXTENTS_FL) || (file->inode.flags & EXT4_INLINE_DATA_FL))
+        return EFI_UNSUPPORTED;
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS ext4_mount(OUT ext4_fs_t *fs, IN EFI_BLOCK_IO_PROTOCOL *block_io, IN partition_info_t *partition)
+{
+    EFI_STATUS status;
+    ext4_superblock_t superblock;
+
+    // Big enough for the largest block plus the device blocks it can straddle (it goes when the filesystem is unmounted)
+    fs->block_io = block_io;
+    fs->offset = partition->offset;
+    fs->mark = arena_mark();
+    fs->scratch_size = EXT4_MAX_BLOCK_SIZE + 2 * block_io->Media->BlockSize;
+    fs->scratch = arena_alloc_io(block_io, fs->scratch_size);
+    if (fs->scratch == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    // Read the superblock
+    status = read_metadata(fs, EXT4_SUPERBLOCK_OFFSET, sizeof(superblock), &superblock);
+    if (EFI_ERROR(status))
+        goto fail;
+
+    status = EFI_UNSUPPORTED;
+    if (superblock.magic != EXT4_SUPERBLOCK_MAGIC)
+        goto fail;
+    if (superblock.feature_incompat & EXT4_FEATURE_INCOMPAT_UNSUPPORTED)
+        goto fail;
+    if (superblock.log_block_size > 6)
+        goto fail;
+
+    fs->block_size = 1024 << superblock.log_block_size;
+    fs->first_data_block = superblock.first_data_block;
+    fs->inodes_per_group = superblock.inodes_per_group;
+    fs->inode_size = superblock.rev_level == 0 ? EXT4_GOOD_OLD_INODE_SIZE : superblock.inode_size;
+    fs->desc_size = (superblock.feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT) ? superblock.desc_size : EXT4_MIN_DESC_SIZE;
+    if (fs->desc_size < EXT4_MIN_DESC_SIZE)
+        fs->desc_size = EXT4_MIN_DESC_SIZE;
+
+    // Filesystem blocks have to be made of whole device blocks to be read straight into place
+    if (fs->block_size % block_io->Media->BlockSize != 0 || fs->inodes_per_group == 0 || superblock.blocks_per_group == 0)
+        goto fail;
+
+    UINT64 blocks_count = superblock.blocks_count_lo;
+    if (superblock.feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT)
+        blocks_count |= (UINT64)superblock.blocks_count_hi << 32;
+    fs->group_count = (blocks_count - fs->first_data_block + superblock.blocks_per_group - 1) / superblock.blocks_per_group;
+
+    return EFI_SUCCESS;
+
+fail:
+    ext4_unmount(fs);
+    return status;
+}
+
+VOID ext4_unmount(IN ext4_fs_t *fs)
+{
+    if (fs->scratch != NULL)
+        arena_reset(fs->mark);
+    fs->scratch = NULL;
+}
+
+EFI_STATUS ext4_open(IN ext4_fs_t *fs, IN const char *path, OUT ext4_file_t *file)
+{
+    EFI_STATUS status = open_inode(fs, EXT4_ROOT_INODE, file);
+    if (EFI_ERROR(status))
+        return status;
+
+    // Go down the path one component at a time
+    while (*path != '\0')
+    {
+        while (*path == '/')
+            ++path;
+        if (*path == '\0')
+            break;
+
+        UINTN length = 0;
+        while (path[length] != '\0' && path[length] != '/')
+            ++length;
+
+        UINT32 number;
+        status = find_in_directory(file, path, length, &number);
+        if (EFI_ERROR(status))
+            return status;
+
+        status = open_inode(fs, number, file);
+        if (EFI_ERROR(status))
+            return status;
+
+        path += length;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to read a range of a file (overrun means the buffer can take the rest of the last block)
+static EFI_STATUS read_range(ext4_file_t *file, UINT64 offset, UINTN length, VOID *buffer, BOOLEAN overrun)
+{
+    EFI_STATUS status;
+    io_queue_t queue;
+
+    if (offset + length > file->size)
+        return EFI_END_OF_FILE;
+    if (length == 0)
+        return EFI_SUCCESS;
+
+    io_queue_init(&queue, file->fs->block_io);
+    read_context_t read = {
+        .start = offset,
+        .end = offset + length,
+        .filled = offset,
+        .buffer = buffer,
+        .overrun = overrun,
+        .queue = &queue,
+    };
+
+    status = walk_extents(file, (ext4_extent_header_t *)file->inode.block, sizeof(file->inode.block),
+        EXT4_MAX_EXTENT_DEPTH + 1,
+        offset / file->fs->block_size,
+        (offset + length - 1) / file->fs->block_size,
+        read_extent,
+        &read
+    );
+    if (EFI_ERROR(status))
+        return status;
+
+    status = io_queue_flush(&queue);
+    if (EFI_ERROR(status))
+        return status;
+
+    // Sparse tail
+    if (read.filled < read.end)
+        ZeroMem(read.buffer + (read.filled - read.start), read.end - read.filled);
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS ext4_read(IN ext4_file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer)
+{
+    return read_range(file, offset, length, buffer, FALSE);
+}
+
+EFI_STATUS ext4_load_file(IN ext4_file_t *file, OUT VOID **buffer, OUT UINTN *size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages;
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(file->size), &pages);
+    if (EFI_ERROR(status))
+        return status;
+
+    // If the pages reach the end of the last block, the tail doesn't need a separate read
+    UINT64 rounded_size = (file->size + file->fs->block_size - 1) / file->fs->block_size * file->fs->block_size;
+    BOOLEAN overrun = EFI_SIZE_TO_PAGES(file->size) * EFI_PAGE_SIZE >= rounded_size;
+
+    status = read_range(file, 0, file->size, (VOID *)(UINTN)pages, overrun);
+    if (EFI_ERROR(status))
+    {
+        uefi_call_wrapper(BS->FreePages, 2, pages, EFI_SIZE_TO_PAGES(file->size));
+        return status;
+    }
+
+    *buffer = (VOID *)(UINTN)pages;
+    *size = file->size;
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,233 @@
+#ifndef EXT4_H
+#define EXT4_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "device.h"
+#include "blockcache.h"
+#include "arena.h"
+#include "ioqueue.h"
+
+// --------------------------
+// On-disk constants
+// --------------------------
+
+#define EXT4_SUPERBLOCK_OFFSET 1024     // Bytes from the start of the partition
+#define EXT4_SUPERBLOCK_MAGIC 0xEF53
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_ROOT_INODE 2
+#define EXT4_MAX_BLOCK_SIZE 65536
+#define EXT4_MAX_EXTENT_DEPTH 5
+#define EXT4_GOOD_OLD_INODE_SIZE 128
+#define EXT4_MIN_DESC_SIZE 32
+#define EXT4_UNINIT_EXTENT_LEN 32768    // Extents longer than this are preallocated but unwritten
+
+// Incompatible features
+#define EXT4_FEATURE_INCOMPAT_COMPRESSION 0x0001
+#define EXT4_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT4_FEATURE_INCOMPAT_JOURNAL_DEV 0x0008
+#define EXT4_FEATURE_INCOMPAT_META_BG 0x0010
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_DIRDATA 0x1000
+#define EXT4_FEATURE_INCOMPAT_ENCRYPT 0x10000
+
+// Features we can't read around
+#define EXT4_FEATURE_INCOMPAT_UNSUPPORTED (EXT4_FEATURE_INCOMPAT_COMPRESSION | EXT4_FEATURE_INCOMPAT_JOURNAL_DEV | \
+                                           EXT4_FEATURE_INCOMPAT_META_BG | EXT4_FEATURE_INCOMPAT_DIRDATA | \
+                                           EXT4_FEATURE_INCOMPAT_ENCRYPT)
+
+// Inode flags
+#define EXT4_INDEX_FL 0x00001000        // Directory has an htree index
+#define EXT4_EXTENTS_FL 0x00080000      // Inode uses an extent tree
+#define EXT4_INLINE_DATA_FL 0x10000000  // Data lives in the inode itself
+
+// Inode modes
+#define EXT4_S_IFMT 0xF000
+#define EXT4_S_IFDIR 0x4000
+#define EXT4_S_IFREG 0x8000
+
+// --------------------------
+// On-disk structures
+// --------------------------
+
+// Superblock (only the part we use)
+typedef struct
+{
+    UINT32 inodes_count;
+    UINT32 blocks_count_lo;
+    UINT32 r_blocks_count_lo;
+    UINT32 free_blocks_count_lo;
+    UINT32 free_inodes_count;
+    UINT32 first_data_block;        // 1 for 1K blocks, 0 otherwise
+    UINT32 log_block_size;          // Block size is 1024 << log_block_size
+    UINT32 log_cluster_size;
+    UINT32 blocks_per_group;
+    UINT32 clusters_per_group;
+    UINT32 inodes_per_group;
+    UINT32 mtime;
+    UINT32 wtime;
+    UINT16 mnt_count;
+    UINT16 max_mnt_count;
+    UINT16 magic;                   // EXT4_SUPERBLOCK_MAGIC
+    UINT16 state;
+    UINT16 errors;
+    UINT16 minor_rev_level;
+    UINT32 lastcheck;
+    UINT32 checkinterval;
+    UINT32 creator_os;
+    UINT32 rev_level;               // 0 means fixed 128 byte inodes
+    UINT16 def_resuid;
+    UINT16 def_resgid;
+    UINT32 first_ino;
+    UINT16 inode_size;
+    UINT16 block_group_nr;
+    UINT32 feature_compat;
+    UINT32 feature_incompat;
+    UINT32 feature_ro_compat;
+    UINT8 uuid[16];
+    CHAR8 volume_name[16];
+    CHAR8 last_mounted[64];
+    UINT32 algorithm_usage_bitmap;
+    UINT8 prealloc_blocks;
+    UINT8 prealloc_dir_blocks;
+    UINT16 reserved_gdt_blocks;
+    UINT8 journal_uuid[16];
+    UINT32 journal_inum;
+    UINT32 journal_dev;
+    UINT32 last_orphan;
+    UINT32 hash_seed[4];
+    UINT8 def_hash_version;
+    UINT8 jnl_backup_type;
+    UINT16 desc_size;               // Group descriptor size when 64BIT is set
+    UINT32 default_mount_opts;
+    UINT32 first_meta_bg;
+    UINT32 mkfs_time;
+    UINT32 jnl_blocks[17];
+    UINT32 blocks_count_hi;
+} __attribute__((packed)) ext4_superblock_t;
+
+// Block group descriptor (the _hi fields only exist when desc_size is 64)
+typedef struct
+{
+    UINT32 block_bitmap_lo;
+    UINT32 inode_bitmap_lo;
+    UINT32 inode_table_lo;
+    UINT16 free_blocks_count_lo;
+    UINT16 free_inodes_count_lo;
+    UINT16 used_dirs_count_lo;
+    UINT16 flags;
+    UINT32 exclude_bitmap_lo;
+    UINT16 block_bitmap_csum_lo;
+    UINT16 inode_bitmap_csum_lo;
+    UINT16 itable_unused_lo;
+    UINT16 checksum;
+    UINT32 block_bitmap_hi;
+    UINT32 inode_bitmap_hi;
+    UINT32 inode_table_hi;
+} __attribute__((packed)) ext4_group_desc_t;
+
+// Inode (only the part every revision has)
+typedef struct
+{
+    UINT16 mode;
+    UINT16 uid;
+    UINT32 size_lo;
+    UINT32 atime;
+    UINT32 ctime;
+    UINT32 mtime;
+    UINT32 dtime;
+    UINT16 gid;
+    UINT16 links_count;
+    UINT32 blocks_lo;
+    UINT32 flags;
+    UINT32 osd1;
+    UINT32 block[15];               // Extent tree root when EXT4_EXTENTS_FL is set
+    UINT32 generation;
+    UINT32 file_acl_lo;
+    UINT32 size_high;
+    UINT32 obso_faddr;
+    UINT8 osd2[12];
+} __attribute__((packed)) ext4_inode_t;
+
+// Start of every extent tree node
+typedef struct
+{
+    UINT16 magic;                   // EXT4_EXTENT_MAGIC
+    UINT16 entries;
+    UINT16 max;
+    UINT16 depth;                   // 0 means the entries are extents, otherwise indexes
+    UINT32 generation;
+} __attribute__((packed)) ext4_extent_header_t;
+
+// Leaf entry, a run of contiguous blocks
+typedef struct
+{
+    UINT32 block;                   // First logical block
+    UINT16 len;
+    UINT16 start_hi;
+    UINT32 start_lo;                // First physical block
+} __attribute__((packed)) ext4_extent_t;
+
+// Internal entry, points at the next level down
+typedef struct
+{
+    UINT32 block;                   // First logical block covered
+    UINT32 leaf_lo;
+    UINT16 leaf_hi;
+    UINT16 unused;
+} __attribute__((packed)) ext4_extent_idx_t;
+
+// Directory entry
+typedef struct
+{
+    UINT32 inode;
+    UINT16 rec_len;
+    UINT8 name_len;
+    UINT8 file_type;
+    CHAR8 name[];
+} __attribute__((packed)) ext4_dir_entry_t;
+
+// --------------------------
+// Reader
+// --------------------------
+
+typedef struct
+{
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINT64 offset;                  // Start of the partition in bytes
+    UINT32 block_size;
+    UINT32 first_data_block;
+    UINT32 inodes_per_group;
+    UINT32 inode_size;
+    UINT32 desc_size;
+    UINT64 group_count;
+    UINT8 *scratch;                 // Bounce buffer for metadata and partial blocks
+    UINTN scratch_size;
+    arena_mark_t mark;              // Where the arena was before mounting
+} ext4_fs_t;
+
+typedef struct
+{
+    ext4_fs_t *fs;
+    UINT32 number;
+    ext4_inode_t inode;
+    UINT64 size;
+} ext4_file_t;
+
+// Read the superblock and get the partition ready to be read from
+EFI_STATUS ext4_mount(OUT ext4_fs_t *fs, IN EFI_BLOCK_IO_PROTOCOL *block_io, IN partition_info_t *partition);
+
+// Free what ext4_mount allocated
+VOID ext4_unmount(IN ext4_fs_t *fs);
+
+// Open a file by its absolute path (e.g. "/boot/kernel")
+EFI_STATUS ext4_open(IN ext4_fs_t *fs, IN const char *path, OUT ext4_file_t *file);
+
+// Read length bytes from offset into buffer, with one ReadBlocks per contiguous extent (holes are zeroed)
+EFI_STATUS ext4_read(IN ext4_file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer);
+
+// Load a whole file into freshly allocated pages
+EFI_STATUS ext4_load_file(IN ext4_file_t *file, OUT VOID **buffer, OUT UINTN *size);
+
+#endif
@@ -0,0 +1,525 @@
+#include "fat32.h"
+
+// Helper function to read bytes that don't line up with device blocks through the block cache
+static EFI_STATUS read_bytes(fat32_fs_t *fs, UINT64 byte_offset, UINTN size, VOID *dest)
+{
+    EFI_STATUS status;
+    UINT32 device_block_size = fs->block_io->Media->BlockSize;
+    UINT64 first_byte = fs->offset + byte_offset;
+    EFI_LBA first_lba = first_byte / device_block_size;
+    EFI_LBA last_lba = (first_byte + size - 1) / device_block_size;
+    UINTN read_size = (last_lba - first_lba + 1) * device_block_size;
+
+    if (read_size > fs->scratch_size)
+        return EFI_BAD_BUFFER_SIZE;
+
+    status = block_cache_read(fs->block_io, first_lba, read_size, fs->scratch);
+    if (EFI_ERROR(status))
+        return status;
+
+    CopyMem(dest, fs->scratch + (first_byte - first_lba * device_block_size), size);
+    return EFI_SUCCESS;
+}
+
+// Helper function to queue whole device blocks to be read straight into the destination
+static EFI_STATUS queue_direct(fat32_fs_t *fs, io_queue_t *queue, UINT64 byte_offset, UINTN size, VOID *dest)
+{
+    return io_queue_add(queue, (fs->offset + byte_offset) / fs->block_io->Media->BlockSize, size, dest);
+}
+
+// Helper function to look up the cluster after this one, reading the FAT a window at a time
+static EFI_STATUS next_cluster(fat32_fs_t *fs, UINT32 cluster, OUT UINT32 *next)
+{
+    EFI_STATUS status;
+    UINT64 entry_offset = (UINT64)cluster * 4;
+
+    if (entry_offset + 4 > fs->fat_size)
+        return EFI_VOLUME_CORRUPTED;
+
+    // Move the window if the entry isn't in it
+    if (fs->fat_window_size == 0 || entry_offset < fs->fat_window_start ||
+        entry_offset + 4 > fs->fat_window_start + fs->fat_window_size)
+    {
+        UINT64 start = entry_offset / FAT32_FAT_WINDOW_SIZE * FAT32_FAT_WINDOW_SIZE;
+        UINTN size = FAT32_FAT_WINDOW_SIZE;
+        if (start + size > fs->fat_size)
+            size = fs->fat_size - start;
+
+        // The FAT starts on a sector boundary and the window is a multiple of any sector size, so this is aligned
+        UINT32 device_block_size = fs->block_io->Media->BlockSize;
+        UINTN read_size = (size + device_block_size - 1) / device_block_size * device_block_size;
+
+        fs->fat_window_size = 0;
+        status = io_read(fs->block_io, (fs->offset + fs->fat_offset + start) / device_block_size, read_size, fs->fat_window);
+        if (EFI_ERROR(status))
+            return status;
+
+        fs->fat_window_start = start;
+        fs->fat_window_size = size;
+    }
+
+    *next = *(UINT32 *)(fs->fat_window + (entry_offset - fs->fat_window_start)) & FAT32_CLUSTER_MASK;
+    return EFI_SUCCESS;
+}
+
+// Helper function to turn a cluster chain into runs of contiguous clusters
+static EFI_STATUS build_runs(fat32_file_t *file)
+{
+    EFI_STATUS status;
+    fat32_fs_t *fs = file->fs;
+    UINTN capacity = 8;
+    UINT32 cluster = file->first_cluster;
+    UINT32 visited = 0;
+
+    file->run_count = 0;
+    file->runs = arena_alloc(capacity * sizeof(fat32_run_t), 0);
+    if (file->runs == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    // Empty files don't have any clusters
+    if (cluster == 0)
+        return EFI_SUCCESS;
+
+    while (cluster < FAT32_END_OF_CHAIN)
+    {
+        if (cluster < 2 || cluster >= fs->cluster_count + 2 || cluster == FAT32_BAD_CLUSTER)
+            return EFI_VOLUME_CORRUPTED;
+
+        // A chain longer than the volume has clusters loops back on itself
+        if (++visited > fs->cluster_count)
+            return EFI_VOLUME_CORRUPTED;
+
+        fat32_run_t *last = file->run_count > 0 ? &file->runs[file->run_count - 1] : NULL;
+        if (last != NULL && last->first_cluster + last->cluster_count == cluster)
+            ++last->cluster_count;
+        else
+        {
+            if (file->run_count == capacity)
+            {
+                // The old array stays in the arena until the file is closed
+                fat32_run_t *bigger = arena_alloc(capacity * 2 * sizeof(fat32_run_t), 0);
+                if (bigger == NULL)
+                    return EFI_OUT_OF_RESOURCES;
+                CopyMem(bigger, file->runs, capacity * sizeof(fat32_run_t));
+                file->runs = bigger;
+                capacity *= 2;
+            }
+
+            file->runs[file->run_count].first_cluster = cluster;
+            file->runs[file->run_count].cluster_count = 1;
+            ++file->run_count;
+        }
+
+        status = next_cluster(fs, cluster, &cluster);
+        if (EFI_ERROR(status))
+            return status;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to read a range of a file (overrun means the buffer can take the rest of the last sector)
+static EFI_STATUS read_range(fat32_file_t *file, UINT64 offset, UINTN length, UINT8 *buffer, BOOLEAN overrun)
+{
+    EFI_STATUS status;
+    fat32_fs_t *fs = file->fs;
+    UINT64 sector_size = fs->block_io->Media->BlockSize;
+    UINT64 end = offset + length;
+    UINT64 run_start = 0;
+    io_queue_t queue;
+
+    // Whole sectors are queued and read together at the end, the partial ones at either end of a run are read as they
+    // come up
+    io_queue_init(&queue, fs->block_io);
+
+    for (UINTN i = 0; i < file->run_count && run_start < end; ++i)
+    {
+        UINT64 run_size = (UINT64)file->runs[i].cluster_count * fs->cluster_size;
+        UINT64 run_end = run_start + run_size;
+
+        // Clip the run to the range
+        UINT64 from = offset > run_start ? offset : run_start;
+        UINT64 to = end < run_end ? end : run_end;
+        if (from >= to)
+        {
+            run_start = run_end;
+            continue;
+        }
+
+        UINT64 disk = fs->data_offset + (UINT64)(file->runs[i].first_cluster - 2) * fs->cluster_size + (from - run_start);
+        UINT8 *dest = buffer + (from - offset);
+
+        // Unaligned head
+        if (disk % sector_size != 0)
+        {
+            UINT64 head = sector_size - disk % sector_size;
+            if (head > to - from)
+                head = to - from;
+
+            status = read_bytes(fs, disk, head, dest);
+            if (EFI_ERROR(status))
+                return status;
+
+            disk += head;
+            dest += head;
+            from += head;
+        }
+
+        // Whole sectors in one go (taking the last partial sector along too if there's room for it)
+        UINT64 direct = (to - from) / sector_size * sector_size;
+        if (overrun && to == end && direct < to - from)
+            direct += sector_size;
+
+        if (direct > 0)
+        {
+            status = queue_direct(fs, &queue, disk, direct, dest);
+            if (EFI_ERROR(status))
+                return status;
+
+            disk += direct;
+            dest += direct;
+            from += direct;
+        }
+
+        // Unaligned tail
+        if (from < to)
+        {
+            status = read_bytes(fs, disk, to - from, dest);
+            if (EFI_ERROR(status))
+                return status;
+        }
+
+        run_start = run_end;
+    }
+
+    return io_queue_flush(&queue);
+}
+
+// Helper function to compare an ASCII path component with a UCS-2 name, ignoring case
+static BOOLEAN names_match(const char *name, UINTN name_length, CHAR16 *candidate)
+{
+    for (UINTN i = 0; i < name_length; ++i)
+    {
+        CHAR16 a = (UINT8)name[i];
+        CHAR16 b = candidate[i];
+        if (a >= 'a' && a <= 'z')
+            a -= 'a' - 'A';
+        if (b >= 'a' && b <= 'z')
+            b -= 'a' - 'A';
+        if (a != b)
+            return FALSE;
+    }
+
+    return candidate[name_length] == 0;
+}
+
+// Helper function to turn an 8.3 name ("KERNEL  ELF") into its usual form ("KERNEL.ELF")
+static VOID short_name(fat_dir_entry_t *entry, CHAR16 out[13])
+{
+    UINTN length = 0;
+
+    for (UINTN i = 0; i < 8 && entry->name[i] != ' '; ++i)
+        out[length++] = entry->name[i];
+
+    if (entry->name[8] != ' ')
+    {
+        out[length++] = '.';
+        for (UINTN i = 8; i < 11 && entry->name[i] != ' '; ++i)
+            out[length++] = entry->name[i];
+    }
+
+    // 0x05 stands in for a real 0xE5 first byte
+    if (length > 0 && out[0] == 0x05)
+        out[0] = FAT_DIR_ENTRY_FREE;
+
+    out[length] = 0;
+}
+
+// Helper function to work out the checksum long name entries store for their short entry
+static UINT8 short_name_checksum(fat_dir_entry_t *entry)
+{
+    UINT8 sum = 0;
+    for (UINTN i = 0; i < 11; ++i)
+        sum = ((sum & 1) << 7) + (sum >> 1) + (UINT8)entry->name[i];
+    return sum;
+}
+
+// Helper function to look a name up in a directory (matching the long name if there is one, or the 8.3 name)
+static EFI_STATUS find_in_directory(fat32_file_t *directory, const char *name, UINTN name_length, OUT fat_dir_entry_t *found)
+{
+    EFI_STATUS status;
+    UINT8 *entries;
+    CHAR16 long_name[FAT_MAX_NAME + 1];
+    CHAR16 short_buffer[13];
+    UINT8 long_checksum = 0;
+    BOOLEAN have_long_name = FALSE;
+    arena_mark_t mark = arena_mark();
+
+    if (!directory->directory)
+        return EFI_NOT_FOUND;
+
+    entries = arena_alloc(directory->size, 0);
+    if (entries == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    status = read_range(directory, 0, directory->size, entries, FALSE);
+    if (EFI_ERROR(status))
+        goto done;
+
+    status = EFI_NOT_FOUND;
+    for (UINT64 offset = 0; offset + sizeof(fat_dir_entry_t) <= directory->size; offset += sizeof(fat_dir_entry_t))
+    {
+        fat_dir_entry_t *entry = (fat_dir_entry_t *)(entries + offset);
+
+        // A zero first byte means there's nothing after this
+        if ((UINT8)entry->name[0] == 0)
+            break;
+        if ((UINT8)entry->name[0] == FAT_DIR_ENTRY_FREE)
+        {
+            have_long_name = FALSE;
+            continue;
+        }
+
+        // Collect long name pieces (each one knows where it goes)
+        if ((entry->attributes & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME)
+        {
+            fat_lfn_entry_t *lfn = (fat_lfn_entry_t *)entry;
+            UINTN index = ((lfn->order & 0x1F) - 1) * FAT_LFN_CHARS;
+            if ((lfn->order & 0x1F) == 0 || index + FAT_LFN_CHARS > FAT_MAX_NAME)
+            {
+                have_long_name = FALSE;
+                continue;
+            }
+
+            if (lfn->order & FAT_LFN_LAST)
+            {
+                SetMem(long_name, sizeof(long_name), 0);
+                long_checksum = lfn->checksum;
+                have_long_name = TRUE;
+            }
+
+            CopyMem(&long_name[index], lfn->name1, sizeof(lfn->name1));
+            CopyMem(&long_name[index + 5], lfn->name2, sizeof(lfn->name2));
+            CopyMem(&long_name[index + 11], lfn->name3, sizeof(lfn->name3));
+            continue;
+        }
+
+        if (entry->attributes & FAT_ATTR_VOLUME_ID)
+        {
+            have_long_name = FALSE;
+            continue;
+        }
+
+        // Long names are padded with 0xFFFF after their terminating 0
+        BOOLEAN matched = FALSE;
+        if (have_long_name && long_checksum == short_name_checksum(entry))
+        {
+            for (UINTN i = 0; i < FAT_MAX_NAME && long_name[i] != 0; ++i)
+            {
+                if (long_name[i] == 0xFFFF)
+                {
+                    long_name[i] = 0;
+                    break;
+                }
+            }
+            matched = names_match(name, name_length, long_name);
+        }
+        have_long_name = FALSE;
+
+        short_name(entry, short_buffer);
+        if (matched || (name_length <= 12 && names_match(name, name_length, short_buffer)))
+        {
+            *found = *entry;
+            status = EFI_SUCCESS;
+            goto done;
+        }
+    }
+
+done:
+    arena_reset(mark);
+    return status;
+}
+
+// Helper function to set up a file from its first cluster
+static EFI_STATUS open_cluster(fat32_fs_t *fs, UINT32 first_cluster, UINT64 size, BOOLEAN directory, OUT fat32_file_t *file)
+{
+    EFI_STATUS status;
+
+    file->fs = fs;
+    file->first_cluster = first_cluster;
+    file->directory = directory;
+    file->runs = NULL;
+    file->mark = arena_mark();
+
+    status = build_runs(file);
+    if (EFI_ERROR(status))
+    {
+        fat32_close(file);
+        return status;
+    }
+
+    // Directories don't store a size, they're as big as their chain
+    UINT64 chain_size = 0;
+    for (UINTN i = 0; i < file->run_count; ++i)
+        chain_size += (UINT64)file->runs[i].cluster_count * fs->cluster_size;
+
+    file->size = directory ? chain_size : size;
+    if (file->size > chain_size)
+    {
+        fat32_close(file);
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS fat32_mount(OUT fat32_fs_t *fs, IN EFI_BLOCK_IO_PROTOCOL *block_io, IN UINT64 offset)
+{
+    EFI_STATUS status;
+    fat32_bpb_t bpb;
+
+    // One allocation for the FAT window and the bounce buffer (both are read into, and the window is a whole number of
+    // pages so the bounce buffer stays aligned too)
+    fs->block_io = block_io;
+    fs->offset = offset;
+    fs->fat_window_size = 0;
+    fs->mark = arena_mark();
+    fs->scratch_size = FAT32_MAX_CLUSTER_SIZE + 2 * block_io->Media->BlockSize;
+    fs->fat_window = arena_alloc_io(block_io, FAT32_FAT_WINDOW_SIZE + fs->scratch_size);
+    if (fs->fat_window == NULL)
+        return EFI_OUT_OF_RESOURCES;
+    fs->scratch = fs->fat_window + FAT32_FAT_WINDOW_SIZE;
+
+    status = read_bytes(fs, 0, sizeof(bpb), &bpb);
+    if (EFI_ERROR(status))
+        goto fail;
+
+    // Only FAT32 with sectors the device can read directly
+    status = EFI_UNSUPPORTED;
+    if (bpb.fat_size_16 != 0 || bpb.fat_size_32 == 0 || bpb.root_entries != 0)
+        goto fail;
+    if (bpb.bytes_per_sector == 0 || bpb.sectors_per_cluster == 0 || bpb.fat_count == 0)
+        goto fail;
+    if (bpb.bytes_per_sector % block_io->Media->BlockSize != 0)
+        goto fail;
+
+    fs->bytes_per_sector = bpb.bytes_per_sector;
+    fs->cluster_size = (UINT32)bpb.bytes_per_sector * bpb.sectors_per_cluster;
+    if (fs->cluster_size > FAT32_MAX_CLUSTER_SIZE)
+        goto fail;
+
+    fs->fat_offset = (UINT64)bpb.reserved_sectors * bpb.bytes_per_sector;
+    fs->fat_size = (UINT64)bpb.fat_size_32 * bpb.bytes_per_sector;
+    fs->data_offset = fs->fat_offset + bpb.fat_count * fs->fat_size;
+    fs->root_cluster = bpb.root_cluster;
+
+    // The data area has to start inside the volume, and there can't be more clusters than the FAT has entries for
+    // (the first two entries aren't clusters)
+    status = EFI_VOLUME_CORRUPTED;
+    UINT64 total_sectors = bpb.total_sectors_32 != 0 ? bpb.total_sectors_32 : bpb.total_sectors_16;
+    if (fs->data_offset / bpb.bytes_per_sector >= total_sectors || fs->fat_size / 4 <= 2)
+        goto fail;
+
+    UINT64 data_sectors = total_sectors - fs->data_offset / bpb.bytes_per_sector;
+    UINT64 cluster_count = data_sectors / bpb.sectors_per_cluster;
+    if (cluster_count > fs->fat_size / 4 - 2)
+        cluster_count = fs->fat_size / 4 - 2;
+    fs->cluster_count = cluster_count;
+
+    return EFI_SUCCESS;
+
+fail:
+    fat32_unmount(fs);
+    return status;
+}
+
+VOID fat32_unmount(IN fat32_fs_t *fs)
+{
+    if (fs->fat_window != NULL)
+        arena_reset(fs->mark);
+    fs->fat_window = NULL;
+    fs->scratch = NULL;
+}
+
+EFI_STATUS fat32_open(IN fat32_fs_t *fs, IN const char *path, OUT fat32_file_t *file)
+{
+    EFI_STATUS status = open_cluster(fs, fs->root_cluster, 0, TRUE, file);
+    if (EFI_ERROR(status))
+        return status;
+
+    // Go down the path one component at a time
+    while (*path != '\0')
+    {
+        while (*path == '/' || *path == '\\')
+            ++path;
+        if (*path == '\0')
+            break;
+
+        UINTN length = 0;
+        while (path[length] != '\0' && path[length] != '/' && path[length] != '\\')
+            ++length;
+
+        fat_dir_entry_t entry;
+        status = find_in_directory(file, path, length, &entry);
+        fat32_close(file);
+        if (EFI_ERROR(status))
+            return status;
+
+        UINT32 cluster = ((UINT32)entry.first_cluster_hi << 16) | entry.first_cluster_lo;
+        BOOLEAN directory = (entry.attributes & FAT_ATTR_DIRECTORY) != 0;
+
+        // ".." pointing at the root is stored as cluster 0
+        if (directory && cluster == 0)
+            cluster = fs->root_cluster;
+
+        status = open_cluster(fs, cluster, entry.file_size, directory, file);
+        if (EFI_ERROR(status))
+            return status;
+
+        path += length;
+    }
+
+    return EFI_SUCCESS;
+}
+
+VOID fat32_close(IN fat32_file_t *file)
+{
+    if (file->runs != NULL)
+        arena_reset(file->mark);
+    file->runs = NULL;
+    file->run_count = 0;
+}
+
+EFI_STATUS fat32_read(IN fat32_file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer)
+{
+    if (offset + length > file->size)
+        return EFI_END_OF_FILE;
+
+    return read_range(file, offset, length, buffer, FALSE);
+}
+
+EFI_STATUS fat32_load_file(IN fat32_file_t *file, OUT VOID **buffer, OUT UINTN *size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages;
+    UINTN page_count = EFI_SIZE_TO_PAGES(file->size);
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, page_count, &pages);
+    if (EFI_ERROR(status))
+        return status;
+
+    // If the pages reach the end of the last sector, the tail doesn't need a separate read
+    UINT64 sector_size = file->fs->block_io->Media->BlockSize;
+    BOOLEAN overrun = page_count * EFI_PAGE_SIZE >= (file->size + sector_size - 1) / sector_size * sector_size;
+
+    status = read_range(file, 0, file->size, (UINT8 *)(UINTN)pages, overrun);
+    if (EFI_ERROR(status))
+    {
+        uefi_call_wrapper(BS->FreePages, 2, pages, page_count);
+        return status;
+    }
+
+    *buffer = (VOID *)(UINTN)pages;
+    *size = file->size;
+    return EFI_SUCCESS;
+}
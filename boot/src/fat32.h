@@ -0,0 +1,159 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "blockcache.h"
+#include "arena.h"
+#include "ioqueue.h"
+
+// --------------------------
+// On-disk constants
+// --------------------------
+
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF   // Top 4 bits of a FAT entry are reserved
+#define FAT32_BAD_CLUSTER 0x0FFFFFF7
+#define FAT32_END_OF_CHAIN 0x0FFFFFF8    // Anything at or above this ends a chain
+#define FAT32_MAX_CLUSTER_SIZE 65536
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_LONG_NAME 0x0F         // Read only + hidden + system + volume ID means a long name entry
+
+#define FAT_DIR_ENTRY_FREE 0xE5
+#define FAT_LFN_LAST 0x40               // Set in the order byte of the last (first on disk) long name entry
+#define FAT_LFN_CHARS 13                // Characters in each long name entry
+#define FAT_MAX_NAME 255
+
+// How much of the FAT is kept in memory at once (each entry is 4 bytes, so this covers 8192 clusters)
+#define FAT32_FAT_WINDOW_SIZE 32768
+
+// --------------------------
+// On-disk structures
+// --------------------------
+
+// BIOS Parameter Block (the FAT32 flavour)
+typedef struct
+{
+    UINT8 jump[3];
+    CHAR8 oem_name[8];
+    UINT16 bytes_per_sector;
+    UINT8 sectors_per_cluster;
+    UINT16 reserved_sectors;
+    UINT8 fat_count;
+    UINT16 root_entries;        // 0 on FAT32
+    UINT16 total_sectors_16;    // 0 on FAT32
+    UINT8 media;
+    UINT16 fat_size_16;         // 0 on FAT32
+    UINT16 sectors_per_track;
+    UINT16 heads;
+    UINT32 hidden_sectors;
+    UINT32 total_sectors_32;
+    UINT32 fat_size_32;         // Sectors per FAT
+    UINT16 ext_flags;
+    UINT16 fs_version;
+    UINT32 root_cluster;
+    UINT16 fs_info;
+    UINT16 backup_boot_sector;
+    UINT8 reserved[12];
+    UINT8 drive_number;
+    UINT8 reserved1;
+    UINT8 boot_signature;
+    UINT32 volume_id;
+    CHAR8 volume_label[11];
+    CHAR8 fs_type[8];           // "FAT32   "
+} __attribute__((packed)) fat32_bpb_t;
+
+// Short (8.3) directory entry
+typedef struct
+{
+    CHAR8 name[11];
+    UINT8 attributes;
+    UINT8 nt_reserved;
+    UINT8 create_time_tenth;
+    UINT16 create_time;
+    UINT16 create_date;
+    UINT16 access_date;
+    UINT16 first_cluster_hi;
+    UINT16 write_time;
+    UINT16 write_date;
+    UINT16 first_cluster_lo;
+    UINT32 file_size;
+} __attribute__((packed)) fat_dir_entry_t;
+
+// Long file name directory entry (these come right before the short entry, last part first)
+typedef struct
+{
+    UINT8 order;
+    CHAR16 name1[5];
+    UINT8 attributes;           // FAT_ATTR_LONG_NAME
+    UINT8 type;
+    UINT8 checksum;
+    CHAR16 name2[6];
+    UINT16 first_cluster_lo;    // Always 0
+    CHAR16 name3[2];
+} __attribute__((packed)) fat_lfn_entry_t;
+
+// --------------------------
+// Reader
+// --------------------------
+
+// A run of clusters that are next to each other on disk, which takes a single ReadBlocks to read
+typedef struct
+{
+    UINT32 first_cluster;
+    UINT32 cluster_count;
+} fat32_run_t;
+
+typedef struct
+{
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINT64 offset;              // Start of the partition in bytes
+    UINT32 bytes_per_sector;
+    UINT32 cluster_size;
+    UINT64 fat_offset;          // Bytes from the start of the partition
+    UINT64 fat_size;            // Bytes in one FAT
+    UINT64 data_offset;         // Bytes from the start of the partition to cluster 2
+    UINT32 cluster_count;
+    UINT32 root_cluster;
+    UINT8 *fat_window;          // Cached piece of the FAT
+    UINT64 fat_window_start;    // Byte offset into the FAT of the cached piece
+    UINTN fat_window_size;      // 0 if nothing is cached yet
+    UINT8 *scratch;             // Bounce buffer for partial sectors
+    UINTN scratch_size;
+    arena_mark_t mark;          // Where the arena was before mounting
+} fat32_fs_t;
+
+typedef struct
+{
+    fat32_fs_t *fs;
+    UINT32 first_cluster;
+    UINT64 size;
+    BOOLEAN directory;
+    fat32_run_t *runs;          // The cluster chain, as runs (from the arena)
+    UINTN run_count;
+    arena_mark_t mark;          // Where the arena was before opening
+} fat32_file_t;
+
+// Read the BPB and get the partition ready to be read from
+EFI_STATUS fat32_mount(OUT fat32_fs_t *fs, IN EFI_BLOCK_IO_PROTOCOL *block_io, IN UINT64 offset);
+
+// Free what fat32_mount allocated
+VOID fat32_unmount(IN fat32_fs_t *fs);
+
+// Open a file by its absolute path (e.g. "/EFI/BOOT/INITRD", names are matched case-insensitively)
+EFI_STATUS fat32_open(IN fat32_fs_t *fs, IN const char *path, OUT fat32_file_t *file);
+
+// Free what fat32_open allocated
+VOID fat32_close(IN fat32_file_t *file);
+
+// Read length bytes from offset into buffer, with one ReadBlocks per run of contiguous clusters
+EFI_STATUS fat32_read(IN fat32_file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer);
+
+// Load a whole file into freshly allocated pages
+EFI_STATUS fat32_load_file(IN fat32_file_t *file, OUT VOID **buffer, OUT UINTN *size);
+
+#endif
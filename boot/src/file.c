@@ -0,0 +1,49 @@
+#include "file.h"
+
+// Helper functions to forward reads to the right filesystem
+static EFI_STATUS read_ext4(VOID *context, UINT64 offset, UINTN length, VOID *buffer)
+{
+    return ext4_read(context, offset, length, buffer);
+}
+
+static EFI_STATUS read_fat32(VOID *context, UINT64 offset, UINTN length, VOID *buffer)
+{
+    return fat32_read(context, offset, length, buffer);
+}
+
+static EFI_STATUS read_memory(VOID *context, UINT64 offset, UINTN length, VOID *buffer)
+{
+    CopyMem(buffer, (UINT8 *)context + offset, length);
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS file_read(IN file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer)
+{
+    if (offset > file->size || length > file->size - offset)
+        return EFI_END_OF_FILE;
+    if (length == 0)
+        return EFI_SUCCESS;
+
+    return file->read(file->context, offset, length, buffer);
+}
+
+VOID file_from_ext4(IN ext4_file_t *ext4_file, OUT file_t *file)
+{
+    file->read = read_ext4;
+    file->context = ext4_file;
+    file->size = ext4_file->size;
+}
+
+VOID file_from_fat32(IN fat32_file_t *fat32_file, OUT file_t *file)
+{
+    file->read = read_fat32;
+    file->context = fat32_file;
+    file->size = fat32_file->size;
+}
+
+VOID file_from_memory(IN VOID *buffer, IN UINTN size, OUT file_t *file)
+{
+    file->read = read_memory;
+    file->context = buffer;
+    file->size = size;
+}
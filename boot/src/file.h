@@ -0,0 +1,32 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "ext4.h"
+#include "fat32.h"
+
+// Read length bytes from offset into buffer (the range has already been checked against the size)
+typedef EFI_STATUS (*file_read_t)(VOID *context, UINT64 offset, UINTN length, VOID *buffer);
+
+// A file that can be read in pieces, whichever filesystem (or buffer) it comes from
+typedef struct
+{
+    file_read_t read;
+    VOID *context;
+    UINT64 size;
+} file_t;
+
+// Read length bytes from offset into buffer (EFI_END_OF_FILE if the range goes past the end)
+EFI_STATUS file_read(IN file_t *file, IN UINT64 offset, IN UINTN length, OUT VOID *buffer);
+
+// Wrap an open ext4 file (it has to stay open while the wrapper is used)
+VOID file_from_ext4(IN ext4_file_t *ext4_file, OUT file_t *file);
+
+// Wrap an open FAT32 file (it has to stay open while the wrapper is used)
+VOID file_from_fat32(IN fat32_file_t *fat32_file, OUT file_t *file);
+
+// Wrap a file that's already in memory
+VOID file_from_memory(IN VOID *buffer, IN UINTN size, OUT file_t *file);
+
+#endif
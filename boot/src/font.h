@@ -0,0 +1,16 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 16
+#define FONT_FIRST_CHAR 0x20            // Space
+#define FONT_LAST_CHAR 0x7E             // Tilde
+#define FONT_REPLACEMENT_CHAR '?'       // Drawn for anything outside the font
+
+// One byte per row, most significant bit on the left
+extern const UINT8 font_glyphs[FONT_LAST_CHAR - FONT_FIRST_CHAR + 1][FONT_HEIGHT];
+
+#endif
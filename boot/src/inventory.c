@@ -0,0 +1,155 @@
+#include "inventory.h"
+
+#define ALIGN_8(value) (((value) + 7) & ~(UINTN)7)
+
+static boot_disks_t inventory;
+
+// Helper function to describe a device
+static VOID fill_disk(device_t *device, boot_disk_t *disk)
+{
+    EFI_BLOCK_IO_MEDIA *media = device->block_io->Media;
+
+    disk->last_block = media->LastBlock;
+    disk->block_size = media->BlockSize;
+    disk->io_align = media->IoAlign;
+
+    // Only revision 3 of the protocol has the granularity field
+    disk->transfer_granularity = 0;
+    if (device->block_io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3)
+        disk->transfer_granularity = media->OptimalTransferLengthGranularity;
+
+    disk->flags = (!EFI_ERROR(device->status) ? BOOT_DISK_GPT : 0)
+        | (device->status == EFI_NO_MEDIA ? BOOT_DISK_NO_MEDIA : 0)
+        | (media->RemovableMedia ? BOOT_DISK_REMOVABLE : 0)
+        | (media->ReadOnly ? BOOT_DISK_READ_ONLY : 0)
+        | (media->LogicalPartition ? BOOT_DISK_LOGICAL : 0);
+}
+
+// Helper function to copy a partition across
+static VOID fill_partition(partition_info_t *info, UINT32 disk_index, BOOLEAN probed, boot_partition_t *partition)
+{
+    partition->unique_guid = info->unique_guid;
+    partition->type_guid = info->type_guid;
+    partition->offset = info->offset;
+    partition->size = info->size;
+    partition->disk = disk_index;
+    partition->filesystem = info->filesystem.type;
+    partition->confidence = info->filesystem.confidence;
+    partition->flags = probed ? BOOT_PARTITION_PROBED : 0;
+    partition->volume_id_size = info->filesystem.volume_id_size;
+    CopyMem(partition->volume_id, info->filesystem.volume_id, sizeof(partition->volume_id));
+    CopyMem(partition->name, info->name, sizeof(partition->name));
+    CopyMem(partition->label, info->filesystem.label, sizeof(partition->label));
+}
+
+// Helper function to add a partition to the GUID index
+static VOID index_partition(boot_disks_t *disks, UINT32 partition_index)
+{
+    boot_partition_t *partitions = (boot_partition_t *)(UINTN)disks->partitions;
+    UINT32 *slots = (UINT32 *)(UINTN)disks->index;
+    UINT64 slot = boot_guid_hash(&partitions[partition_index].unique_guid) & (disks->index_size - 1);
+
+    while (slots[slot] != 0)
+        slot = (slot + 1) & (disks->index_size - 1);
+    slots[slot] = partition_index + 1;
+}
+
+EFI_STATUS inventory_build(IN device_t *devices, IN UINTN device_count, IN EFI_BLOCK_IO_PROTOCOL *boot_block_io,
+    IN partition_info_t *boot_partition)
+{
+    EFI_STATUS status;
+
+    ZeroMem(&inventory, sizeof(inventory));
+
+    // Count everything so it can all go in one allocation
+    UINTN partition_count = 0;
+    UINTN paths_size = 0;
+    for (UINTN i = 0; i < device_count; ++i)
+    {
+        partition_count += devices[i].partition_count;
+
+        EFI_DEVICE_PATH *path = DevicePathFromHandle(devices[i].handle);
+        if (path != NULL)
+            paths_size += ALIGN_8(DevicePathSize(path));
+    }
+
+    UINTN index_size = 1;
+    while (index_size < partition_count * 2)
+        index_size *= 2;
+
+    UINTN disks_offset = 0;
+    UINTN partitions_offset = disks_offset + ALIGN_8(device_count * sizeof(boot_disk_t));
+    UINTN index_offset = partitions_offset + ALIGN_8(partition_count * sizeof(boot_partition_t));
+    UINTN paths_offset = index_offset + ALIGN_8(index_size * sizeof(UINT32));
+    UINTN pages = EFI_SIZE_TO_PAGES(paths_offset + paths_size);
+
+    EFI_PHYSICAL_ADDRESS region;
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, pages, &region);
+    if (EFI_ERROR(status))
+        return status;
+
+    UINT8 *base = (UINT8 *)(UINTN)region;
+    ZeroMem(base, pages * EFI_PAGE_SIZE);
+
+    boot_disks_t *disks = &inventory;
+    disks->disks = region + disks_offset;
+    disks->disk_count = device_count;
+    disks->partitions = region + partitions_offset;
+    disks->index = region + index_offset;
+    disks->index_size = index_size;
+    disks->region = region;
+    disks->region_pages = pages;
+
+    boot_disk_t *disk_array = (boot_disk_t *)(base + disks_offset);
+    boot_partition_t *partition_array = (boot_partition_t *)(base + partitions_offset);
+    UINT8 *next_path = base + paths_offset;
+    UINT32 next_partition = 0;
+    disks->boot_partition = 0;
+
+    for (UINTN i = 0; i < device_count; ++i)
+    {
+        device_t *device = &devices[i];
+        boot_disk_t *disk = &disk_array[i];
+
+        fill_disk(device, disk);
+
+        EFI_DEVICE_PATH *path = DevicePathFromHandle(device->handle);
+        if (path != NULL)
+        {
+            UINTN size = DevicePathSize(path);
+            CopyMem(next_path, path, size);
+            disk->device_path = (UINT64)(UINTN)next_path;
+            disk->device_path_size = size;
+            next_path += ALIGN_8(size);
+        }
+
+        disk->first_partition = next_partition;
+        disk->partition_count = device->partition_count;
+        for (UINTN j = 0; j < device->partition_count; ++j)
+        {
+            partition_info_t *info = &device->partitions[j];
+            boot_partition_t *partition = &partition_array[next_partition];
+
+            // The chosen partition was always probed, even when the others weren't
+            if (device->block_io == boot_block_io && CompareGuid(&info->unique_guid, &boot_partition->unique_guid) == 0)
+            {
+                fill_partition(boot_partition, i, TRUE, partition);
+                partition->flags |= BOOT_PARTITION_BOOT;
+                disks->boot_partition = next_partition;
+            }
+            else
+                fill_partition(info, i, device->filesystems_probed, partition);
+
+            disks->partition_count = ++next_partition;
+            index_partition(disks, next_partition - 1);
+        }
+    }
+
+    disks->version = BOOT_DISKS_VERSION;
+    return EFI_SUCCESS;
+}
+
+VOID inventory_get(OUT boot_disks_t *disks)
+{
+    *disks = inventory;
+}
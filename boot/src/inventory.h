@@ -0,0 +1,17 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "device.h"
+#include "bootinfo.h"
+
+// Copy what probing found about every device and partition into pages that outlive the probe, and index the
+// partitions by unique GUID. boot_partition is the chosen one (its filesystem was always probed)
+EFI_STATUS inventory_build(IN device_t *devices, IN UINTN device_count, IN EFI_BLOCK_IO_PROTOCOL *boot_block_io,
+    IN partition_info_t *boot_partition);
+
+// Describe the inventory for the kernel (left zeroed if it wasn't built)
+VOID inventory_get(OUT boot_disks_t *disks);
+
+#endif
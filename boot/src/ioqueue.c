@@ -0,0 +1,261 @@
+#include "ioqueue.h"
+#include "arena.h"
+
+// What a flush needs to know about the device
+typedef struct
+{
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINTN block_size;
+    UINTN io_align;         // 1 if any address will do
+    UINT64 granularity;     // In blocks, 1 if the device doesn't say
+    UINTN max_transfer;     // Bytes, a whole number of granules
+    UINTN bounce_size;      // Bytes, a whole number of blocks
+    UINT8 *bounce;          // From the arena, once something needs it
+} io_device_t;
+
+static io_stats_t stats;
+
+// Helper function to work out how reads to a device should be shaped
+static VOID get_device(EFI_BLOCK_IO_PROTOCOL *block_io, OUT io_device_t *device)
+{
+    EFI_BLOCK_IO_MEDIA *media = block_io->Media;
+
+    device->block_io = block_io;
+    device->block_size = media->BlockSize;
+    device->io_align = media->IoAlign > 1 ? media->IoAlign : 1;
+
+    // Only revision 3 of the protocol has the granularity field
+    device->granularity = 1;
+    if (block_io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3 && media->OptimalTransferLengthGranularity > 1)
+        device->granularity = media->OptimalTransferLengthGranularity;
+
+    UINTN granule = device->granularity * device->block_size;
+    device->max_transfer = IO_QUEUE_MAX_TRANSFER / granule * granule;
+    if (device->max_transfer == 0)
+        device->max_transfer = granule;
+
+    device->bounce_size = IO_QUEUE_BOUNCE_SIZE / device->block_size * device->block_size;
+    if (device->bounce_size == 0)
+        device->bounce_size = device->block_size;
+    device->bounce = NULL;
+}
+
+// Helper function to make one call to the device
+static EFI_STATUS read_blocks(io_device_t *device, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+    EFI_BLOCK_IO_PROTOCOL *block_io = device->block_io;
+
+    ++stats.device_reads;
+    return uefi_call_wrapper(block_io->ReadBlocks, 5,
+        block_io,
+        block_io->Media->MediaId,
+        lba,
+        size,
+        buffer
+    );
+}
+
+// Helper function to read into the bounce buffer (it goes back to the arena at the end of the flush)
+static EFI_STATUS read_bounced(io_device_t *device, EFI_LBA lba, UINTN size)
+{
+    if (device->bounce == NULL)
+        device->bounce = arena_alloc_io(device->block_io, device->bounce_size);
+    if (device->bounce == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    stats.bounced_bytes += size;
+    return read_blocks(device, lba, size, device->bounce);
+}
+
+// Helper function to read a range into one destination, in calls that end on granule boundaries. Only the part of the
+// destination that isn't aligned for the device goes through the bounce buffer
+static EFI_STATUS read_span(io_device_t *device, EFI_LBA lba, UINTN size, UINT8 *buffer)
+{
+    EFI_STATUS status;
+    UINTN block_size = device->block_size;
+
+    while (size > 0)
+    {
+        UINTN chunk;
+        UINTN misaligned = (UINTN)buffer % device->io_align;
+
+        if (misaligned != 0)
+        {
+            // If it all fits in the bounce buffer that's one call. Otherwise, when the destination is off by whole blocks,
+            // bouncing the blocks up to the next aligned address lines the rest up, and if it isn't it never lines up
+            UINTN to_aligned = device->io_align - misaligned;
+            chunk = size > device->bounce_size && to_aligned % block_size == 0 ? to_aligned : device->bounce_size;
+            if (chunk > device->bounce_size)
+                chunk = device->bounce_size;
+            if (chunk > size)
+                chunk = size;
+
+            status = read_bounced(device, lba, chunk);
+            if (!EFI_ERROR(status))
+                CopyMem(buffer, device->bounce, chunk);
+        }
+        else
+        {
+            chunk = size < device->max_transfer ? size : device->max_transfer;
+
+            // Split on a granule boundary, so every call after the first starts on one
+            if (chunk < size)
+            {
+                EFI_LBA end = (lba + chunk / block_size) / device->granularity * device->granularity;
+                if (end > lba)
+                    chunk = (end - lba) * block_size;
+            }
+
+            status = read_blocks(device, lba, chunk, buffer);
+        }
+
+        if (EFI_ERROR(status))
+            return status;
+
+        lba += chunk / block_size;
+        buffer += chunk;
+        size -= chunk;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to sort the queue by LBA (it's short, and mostly sorted already)
+static VOID sort_requests(io_queue_t *queue)
+{
+    for (UINTN i = 1; i < queue->count; ++i)
+    {
+        io_request_t request = queue->requests[i];
+        UINTN j = i;
+        while (j > 0 && queue->requests[j - 1].lba > request.lba)
+        {
+            queue->requests[j] = queue->requests[j - 1];
+            --j;
+        }
+        queue->requests[j] = request;
+    }
+}
+
+VOID io_queue_init(OUT io_queue_t *queue, IN EFI_BLOCK_IO_PROTOCOL *block_io)
+{
+    queue->block_io = block_io;
+    queue->count = 0;
+}
+
+EFI_STATUS io_queue_add(IN OUT io_queue_t *queue, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer)
+{
+    EFI_STATUS status;
+    UINTN block_size = queue->block_io->Media->BlockSize;
+
+    if (size == 0)
+        return EFI_SUCCESS;
+    if (size % block_size != 0)
+        return EFI_BAD_BUFFER_SIZE;
+
+    ++stats.requests;
+
+    // Reading on from the last one, on disk and in memory, just makes the last one longer
+    if (queue->count > 0)
+    {
+        io_request_t *last = &queue->requests[queue->count - 1];
+        if (last->lba + last->size / block_size == lba && last->buffer + last->size == (UINT8 *)buffer)
+        {
+            last->size += size;
+            ++stats.merged;
+            return EFI_SUCCESS;
+        }
+    }
+
+    // Out of room, so do what's there first
+    if (queue->count == IO_QUEUE_MAX_REQUESTS)
+    {
+        status = io_queue_flush(queue);
+        if (EFI_ERROR(status))
+            return status;
+    }
+
+    queue->requests[queue->count].lba = lba;
+    queue->requests[queue->count].size = size;
+    queue->requests[queue->count].buffer = buffer;
+    ++queue->count;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS io_queue_flush(IN OUT io_queue_t *queue)
+{
+    EFI_STATUS status = EFI_SUCCESS;
+    io_device_t device;
+    arena_mark_t mark = arena_mark();
+
+    if (queue->count == 0)
+        return EFI_SUCCESS;
+
+    get_device(queue->block_io, &device);
+    sort_requests(queue);
+
+    UINTN i = 0;
+    while (i < queue->count && !EFI_ERROR(status))
+    {
+        io_request_t *first = &queue->requests[i];
+        EFI_LBA end = first->lba + first->size / device.block_size;
+        UINT8 *buffer_end = first->buffer + first->size;
+        BOOLEAN contiguous = TRUE;      // Each read so far carries straight on from the one before, on disk and in memory
+        UINTN j;
+
+        // Take in the reads after it while they're close enough to share the call
+        for (j = i + 1; j < queue->count; ++j)
+        {
+            io_request_t *next = &queue->requests[j];
+            if (next->lba < end || (next->lba - end) * device.block_size > IO_QUEUE_MAX_GAP)
+                break;
+
+            // Reads that don't carry straight on have to fit in the bounce buffer together
+            EFI_LBA next_end = next->lba + next->size / device.block_size;
+            BOOLEAN follows = next->lba == end && next->buffer == buffer_end;
+            if (!(contiguous && follows) && (next_end - first->lba) * device.block_size > device.bounce_size)
+                break;
+
+            contiguous = contiguous && follows;
+            end = next_end;
+            buffer_end = next->buffer + next->size;
+            ++stats.merged;
+        }
+
+        UINTN size = (end - first->lba) * device.block_size;
+        if (contiguous)
+            status = read_span(&device, first->lba, size, first->buffer);
+        else
+        {
+            // Read the whole range (gaps included) and copy each piece out
+            status = read_bounced(&device, first->lba, size);
+            for (UINTN k = i; k < j && !EFI_ERROR(status); ++k)
+            {
+                io_request_t *request = &queue->requests[k];
+                CopyMem(request->buffer, device.bounce + (request->lba - first->lba) * device.block_size, request->size);
+            }
+        }
+
+        i = j;
+    }
+
+    queue->count = 0;
+    arena_reset(mark);
+    return status;
+}
+
+EFI_STATUS io_read(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer)
+{
+    io_queue_t queue;
+
+    io_queue_init(&queue, block_io);
+    EFI_STATUS status = io_queue_add(&queue, lba, size, buffer);
+    if (EFI_ERROR(status))
+        return status;
+
+    return io_queue_flush(&queue);
+}
+
+VOID io_get_stats(OUT io_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
@@ -0,0 +1,58 @@
+#ifndef IOQUEUE_H
+#define IOQUEUE_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// Reads a queue holds before adding another one flushes it
+#define IO_QUEUE_MAX_REQUESTS 64
+
+// Reads at most this many bytes apart are done with one call, reading the gap into the bounce buffer
+#define IO_QUEUE_MAX_GAP (16 * 1024)
+
+// Longest single ReadBlocks the queue makes (rounded down to the device's transfer granularity)
+#define IO_QUEUE_MAX_TRANSFER (4 * 1024 * 1024)
+
+// Bounce buffer for destinations the device can't read into and reads merged across a gap
+#define IO_QUEUE_BOUNCE_SIZE (256 * 1024)
+
+typedef struct
+{
+    EFI_LBA lba;
+    UINTN size;         // Whole device blocks
+    UINT8 *buffer;      // Any alignment
+} io_request_t;
+
+// Reads waiting to be sent to one device
+typedef struct
+{
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINTN count;
+    io_request_t requests[IO_QUEUE_MAX_REQUESTS];
+} io_queue_t;
+
+typedef struct
+{
+    UINT64 requests;        // Reads added to queues
+    UINT64 device_reads;    // ReadBlocks calls made for them
+    UINT64 merged;          // Reads that shared a call with the one before them
+    UINT64 bounced_bytes;   // Bytes that were read into the bounce buffer and copied
+} io_stats_t;
+
+// Start an empty queue for a device
+VOID io_queue_init(OUT io_queue_t *queue, IN EFI_BLOCK_IO_PROTOCOL *block_io);
+
+// Queue a read. Nothing is read until the queue is flushed, so the buffer can't be used before then
+EFI_STATUS io_queue_add(IN OUT io_queue_t *queue, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer);
+
+// Do every queued read in LBA order, merging neighbours and splitting on the device's transfer granularity, and
+// wait for them all. The queue is empty afterwards even if a read failed
+EFI_STATUS io_queue_flush(IN OUT io_queue_t *queue);
+
+// Read blocks into a buffer of any alignment right away (a queue with one read in it)
+EFI_STATUS io_read(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN EFI_LBA lba, IN UINTN size, OUT VOID *buffer);
+
+// Get the counters
+VOID io_get_stats(OUT io_stats_t *stats);
+
+#endif
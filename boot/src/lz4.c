@@ -0,0 +1,160 @@
+#include "lz4.h"
+
+// Helper function to read a little endian 32 bit value
+static UINT32 read32(const UINT8 *data)
+{
+    return (UINT32)data[0] | (UINT32)data[1] << 8 | (UINT32)data[2] << 16 | (UINT32)data[3] << 24;
+}
+
+// Helper function to read one of the length extensions that follow a 15 in a token
+static BOOLEAN read_length(const UINT8 **in, const UINT8 *in_end, UINTN *length)
+{
+    UINT8 byte;
+    do
+    {
+        if (*in >= in_end)
+            return FALSE;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return TRUE;
+}
+
+EFI_STATUS lz4_decompress_block(IN const UINT8 *source, IN UINTN source_size, OUT UINT8 *dest, IN UINTN dest_capacity,
+    OUT UINTN *dest_size)
+{
+    const UINT8 *in = source;
+    const UINT8 *in_end = source + source_size;
+    UINT8 *out = dest;
+    UINT8 *out_end = dest + dest_capacity;
+
+    while (in < in_end)
+    {
+        UINT8 token = *in++;
+
+        // Literals
+        UINTN literals = token >> 4;
+        if (literals == 15 && !read_length(&in, in_end, &literals))
+            return EFI_VOLUME_CORRUPTED;
+        if (literals > (UINTN)(in_end - in) || literals > (UINTN)(out_end - out))
+            return EFI_VOLUME_CORRUPTED;
+
+        for (UINTN i = 0; i < literals; ++i)
+            out[i] = in[i];
+        in += literals;
+        out += literals;
+
+        // The last sequence is only literals
+        if (in == in_end)
+            break;
+
+        // Match
+        if (in_end - in < 2)
+            return EFI_VOLUME_CORRUPTED;
+        UINTN distance = in[0] | (UINTN)in[1] << 8;
+        in += 2;
+        if (distance == 0 || distance > (UINTN)(out - dest))
+            return EFI_VOLUME_CORRUPTED;
+
+        UINTN length = token & 15;
+        if (length == 15 && !read_length(&in, in_end, &length))
+            return EFI_VOLUME_CORRUPTED;
+        length += LZ4_MIN_MATCH;
+        if (length > (UINTN)(out_end - out))
+            return EFI_VOLUME_CORRUPTED;
+
+        // Far enough back that 8 bytes at a time can't read what it's writing
+        const UINT8 *match = out - distance;
+        UINTN i = 0;
+        if (distance >= 8)
+        {
+            for (; i + 8 <= length; i += 8)
+                *(UINT64 *)(out + i) = *(const UINT64 *)(match + i);
+        }
+        for (; i < length; ++i)
+            out[i] = match[i];
+        out += length;
+    }
+
+    *dest_size = out - dest;
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS lz4_parse_frame(IN const UINT8 *data, IN UINTN size, OUT lz4_frame_t *frame)
+{
+    // Magic, FLG, BD, content size and header checksum
+    if (size < 15 || read32(data) != LZ4_FRAME_MAGIC)
+        return EFI_UNSUPPORTED;
+
+    UINT8 flags = data[4];
+    UINT8 block_descriptor = data[5];
+    if ((flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || !(flags & LZ4_FLG_CONTENT_SIZE))
+        return EFI_UNSUPPORTED;
+
+    // Block sizes go 64KB, 256KB, 1MB, 4MB
+    UINTN block_size_id = (block_descriptor >> 4) & 7;
+    if (block_size_id < 4)
+        return EFI_UNSUPPORTED;
+
+    frame->block_max_size = 1 << (8 + 2 * block_size_id);
+    frame->independent = (flags & LZ4_FLG_BLOCK_INDEPENDENCE) != 0;
+    frame->content_size = read32(data + 6) | (UINT64)read32(data + 10) << 32;
+
+    UINTN header_size = 15 + ((flags & LZ4_FLG_DICTIONARY_ID) ? 4 : 0);
+    UINTN checksum_size = (flags & LZ4_FLG_BLOCK_CHECKSUM) ? 4 : 0;
+
+    // Count the blocks, then go through again to note where they are
+    frame->block_count = 0;
+    frame->blocks = NULL;
+    for (UINTN pass = 0; pass < 2; ++pass)
+    {
+        UINTN offset = header_size;
+        UINTN count = 0;
+
+        while (1)
+        {
+            if (size - offset < 4)
+                goto corrupted;
+
+            UINT32 block_size = read32(data + offset);
+            offset += 4;
+            if (block_size == 0)
+                break;
+
+            BOOLEAN uncompressed = (block_size & LZ4_BLOCK_UNCOMPRESSED) != 0;
+            block_size &= ~LZ4_BLOCK_UNCOMPRESSED;
+            if (block_size > frame->block_max_size || block_size + checksum_size > size - offset)
+                goto corrupted;
+
+            if (pass == 1)
+            {
+                frame->blocks[count].offset = offset;
+                frame->blocks[count].size = block_size;
+                frame->blocks[count].uncompressed = uncompressed;
+            }
+
+            offset += block_size + checksum_size;
+            ++count;
+        }
+
+        if (pass == 0)
+        {
+            // Every block but the last has to be full, so the count follows from the content size
+            if (count != (frame->content_size + frame->block_max_size - 1) / frame->block_max_size)
+                goto corrupted;
+
+            frame->blocks = arena_alloc((count > 0 ? count : 1) * sizeof(lz4_block_t), 0);
+            if (frame->blocks == NULL)
+                return EFI_OUT_OF_RESOURCES;
+        }
+        frame->block_count = count;
+    }
+
+    return EFI_SUCCESS;
+
+corrupted:
+    frame->blocks = NULL;
+    frame->block_count = 0;
+    return EFI_VOLUME_CORRUPTED;
+}
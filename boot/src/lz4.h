@@ -0,0 +1,58 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "arena.h"
+
+// --------------------------
+// Frame format constants
+// --------------------------
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A50      // Any of the 16 values from this one up
+#define LZ4_SKIPPABLE_MAGIC_MASK 0xFFFFFFF0
+
+// FLG byte
+#define LZ4_FLG_VERSION_MASK 0xC0
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_FLG_BLOCK_INDEPENDENCE 0x20
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FLG_CONTENT_SIZE 0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICTIONARY_ID 0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000   // High bit of a block size means the data is stored as is
+#define LZ4_MIN_MATCH 4
+
+// --------------------------
+// Decoder
+// --------------------------
+
+// Where one block is in the frame
+typedef struct
+{
+    UINTN offset;                   // Bytes from the start of the frame to the block data
+    UINT32 size;
+    BOOLEAN uncompressed;
+} lz4_block_t;
+
+typedef struct
+{
+    UINT64 content_size;            // Decompressed size
+    UINT32 block_max_size;          // Every block but the last decompresses to exactly this
+    BOOLEAN independent;            // Blocks don't refer back to earlier ones, so they can be decompressed in any order
+    UINTN block_count;
+    lz4_block_t *blocks;
+} lz4_frame_t;
+
+// Walk the block headers of a frame (the frame has to carry its content size). The block list comes from the arena,
+// so it goes when the caller resets it
+EFI_STATUS lz4_parse_frame(IN const UINT8 *data, IN UINTN size, OUT lz4_frame_t *frame);
+
+// Decompress one independent block, never reading or writing outside the buffers (doesn't touch boot services,
+// so it's safe to call from APs)
+EFI_STATUS lz4_decompress_block(IN const UINT8 *source, IN UINTN source_size, OUT UINT8 *dest, IN UINTN dest_capacity,
+    OUT UINTN *dest_size);
+
+#endif
@@ -2,6 +2,28 @@
 #include <efilib.h>
 #include <efigpt.h>
 #include "device.h"
+#include "trace.h"
+#include "ext4.h"
+#include "fat32.h"
+#include "file.h"
+#include "elf.h"
+#include "bootinfo.h"
+#include "payload.h"
+#include "mp.h"
+#include "memory.h"
+#include "console.h"
+#include "arena.h"
+#include "ioqueue.h"
+#include "paging.h"
+#include "acpi.h"
+#include "prefetch.h"
+#include "inventory.h"
+
+// Where the kernel lives on the boot partition
+#define KERNEL_PATH "/boot/kernel"
+
+// Optional initrd on the ESP (the partition this bootloader was loaded from)
+#define INITRD_PATH "/EFI/BOOT/INITRD"
 
 EFI_STATUS
 EFIAPI
@@ -9,23 +31,206 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
     EFI_STATUS status;
     
     InitializeLib(ImageHandle, SystemTable);
+    trace_init();
+
+    // Draw text ourselves if there's a framebuffer (firmware text output is slow)
+    console_init();
+
+    // Set up the block cache (every disk read goes through it, but it's fine if it can't be set up)
+    block_cache_init();
 
-    // Clear the screen
-    uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    // Get the memory for probing and loading up front (allocations try again later if this fails)
+    arena_init();
+
+    // Find the other processors to unpack payloads with (they're just not used if there's no MP services)
+    mp_init();
 
     // Find the partition to boot to
-    EFI_BLOCK_IO_PROTOCOL block_io;
+    EFI_BLOCK_IO_PROTOCOL *block_io;
     partition_info_t partition;
-    status = find_boot_partition(&block_io, &partition);
+    trace_begin("find_boot_partition");
+    status = find_boot_partition(KERNEL_PATH, &block_io, &partition);
+    trace_end("find_boot_partition");
 
     if (EFI_ERROR(status))
-        Print(L"Error finding partition: %r\n", status);
+        console_print(L"Error finding partition: %r\n", status);
     else
     {
-        uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
-        Print(L"Chose partition %s.\n", partition.name);
+        console_clear();
+        console_print(L"Chose partition %s.\n", partition.name);
+
+        // Load the kernel off of it, straight from the disk into its segments
+        ext4_fs_t fs;
+        ext4_file_t kernel_file;
+        file_t kernel;
+        elf_image_t kernel_image;
+
+        trace_begin("load_kernel");
+        status = ext4_mount(&fs, block_io, &partition);
+        if (!EFI_ERROR(status))
+        {
+            status = ext4_open(&fs, KERNEL_PATH, &kernel_file);
+            if (!EFI_ERROR(status))
+            {
+                file_from_ext4(&kernel_file, &kernel);
+
+                // Whatever was read ahead while the menu waited is used instead of reading it again
+                prefetch_attach(&partition, KERNEL_PATH, &kernel);
+
+                // A packed kernel has to be unpacked in memory first, then it's loaded from there
+                VOID *unpacked = NULL;
+                UINTN unpacked_size;
+                if (payload_is_packed(&kernel))
+                {
+                    status = payload_load(&kernel, &unpacked, &unpacked_size);
+                    if (!EFI_ERROR(status))
+                        file_from_memory(unpacked, unpacked_size, &kernel);
+                }
+
+                if (!EFI_ERROR(status))
+                    status = elf_load(&kernel, &kernel_image);
+                if (unpacked != NULL)
+                    payload_free(unpacked, unpacked_size);
+            }
+            ext4_unmount(&fs);
+        }
+        prefetch_release();
+        trace_end("load_kernel");
+
+        if (EFI_ERROR(status))
+            console_print(L"Failed to load %a! Status: %r\n", KERNEL_PATH, status);
+        else
+            console_print(L"Loaded %a at 0x%lx-0x%lx, entry 0x%lx.\n", KERNEL_PATH,
+                  kernel_image.physical_start, kernel_image.physical_end, kernel_image.entry);
+        EFI_STATUS kernel_status = status;
+
+        // Load the initrd off the ESP if there is one
+        EFI_LOADED_IMAGE *loaded_image;
+        EFI_BLOCK_IO_PROTOCOL *esp_block_io;
+        fat32_fs_t esp;
+        fat32_file_t initrd_file;
+        file_t initrd_payload;
+        VOID *initrd = NULL;
+        UINTN initrd_size = 0;
+
+        trace_begin("load_initrd");
+        status = uefi_call_wrapper(BS->HandleProtocol, 3, ImageHandle, &LoadedImageProtocol, (VOID **)&loaded_image);
+        if (!EFI_ERROR(status))
+            status = uefi_call_wrapper(BS->HandleProtocol, 3, loaded_image->DeviceHandle, &BlockIoProtocol, (VOID **)&esp_block_io);
+        if (!EFI_ERROR(status))
+            status = fat32_mount(&esp, esp_block_io, 0);
+        if (!EFI_ERROR(status))
+        {
+            status = fat32_open(&esp, INITRD_PATH, &initrd_file);
+            if (!EFI_ERROR(status))
+            {
+                file_from_fat32(&initrd_file, &initrd_payload);
+                status = payload_load(&initrd_payload, &initrd, &initrd_size);
+                fat32_close(&initrd_file);
+            }
+            fat32_unmount(&esp);
+        }
+        trace_end("load_initrd");
+
+        // It's fine not to have one
+        if (EFI_ERROR(status) && status != EFI_NOT_FOUND)
+            console_print(L"Failed to load %a! Status: %r\n", INITRD_PATH, status);
+        else if (!EFI_ERROR(status))
+            console_print(L"Loaded %a (%lu bytes) at 0x%lx.\n", INITRD_PATH, initrd_size, (UINT64)(UINTN)initrd);
+
+        block_cache_stats_t cache_stats;
+        block_cache_get_stats(&cache_stats);
+        console_print(L"Block cache: %lu hits, %lu misses, %lu device reads\n",
+              cache_stats.hits, cache_stats.misses, cache_stats.device_reads);
+
+        io_stats_t io_stats;
+        io_get_stats(&io_stats);
+        console_print(L"I/O queue: %lu reads in %lu device reads (%lu merged), %lu KB bounced\n",
+              io_stats.requests, io_stats.device_reads, io_stats.merged, io_stats.bounced_bytes / 1024);
+
+        prefetch_stats_t prefetch_stats;
+        prefetch_get_stats(&prefetch_stats);
+        console_print(L"Prefetch: %lu KB read while waiting in %lu steps, %lu KB of it used\n",
+              prefetch_stats.bytes / 1024, prefetch_stats.steps, prefetch_stats.hit_bytes / 1024);
+
+        arena_stats_t arena_stats;
+        arena_get_stats(&arena_stats);
+        console_print(L"Arena: high water %lu KB of %lu KB, %lu chunks, %lu allocations\n",
+              arena_stats.high_water / 1024, arena_stats.reserved / 1024, arena_stats.chunk_count, arena_stats.allocations);
+
+        // Hand over to the kernel
+        status = kernel_status;
+        if (!EFI_ERROR(status))
+        {
+            EFI_PHYSICAL_ADDRESS boot_info_page;
+            status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, 1, &boot_info_page);
+            if (EFI_ERROR(status))
+                console_print(L"Failed to allocate boot info! Status: %r\n", status);
+            else
+            {
+                boot_info_t *boot_info = (boot_info_t *)(UINTN)boot_info_page;
+                ZeroMem(boot_info, EFI_PAGE_SIZE);
+                boot_info->magic = BOOT_INFO_MAGIC;
+                boot_info->version = BOOT_INFO_VERSION;
+                boot_info->size = sizeof(boot_info_t);
+                boot_info->kernel_physical_start = kernel_image.physical_start;
+                boot_info->kernel_physical_end = kernel_image.physical_end;
+                boot_info->kernel_entry = kernel_image.entry;
+                boot_info->kernel_load_bias = kernel_image.load_bias;
+                boot_info->initrd_address = (UINT64)(UINTN)initrd;
+                boot_info->initrd_size = initrd_size;
+                console_get_framebuffer(&boot_info->framebuffer);
+
+                // The kernel can run on the firmware's tables if these can't be built, it just has to make its own
+                status = paging_build(&kernel_image, &boot_info->framebuffer, &boot_info->paging);
+                if (EFI_ERROR(status))
+                    console_print(L"Failed to build page tables (using the firmware's)! Status: %r\n", status);
+                else
+                    console_print(L"Page tables: %ld pages, memory mapped on %ldMB pages, kernel at 0x%lx.\n",
+                          boot_info->paging.table_pages, boot_info->paging.identity_page_size >> 20,
+                          boot_info->paging.kernel_virtual_start);
+
+                // The kernel can do its own ACPI pass if this fails, it just won't get a head start on SMP and NUMA
+                status = acpi_parse(&boot_info->acpi);
+                if (EFI_ERROR(status))
+                    console_print(L"Failed to read the processor layout from ACPI! Status: %r\n", status);
+                else
+                    console_print(L"ACPI: %ld processors, %ld I/O APICs, %d NUMA nodes.\n",
+                          boot_info->acpi.cpu_count, boot_info->acpi.ioapic_count, boot_info->acpi.node_count);
+
+                inventory_get(&boot_info->disks);
+
+                // Write out where the time went (boot services are about to go, and nothing is coming back)
+                console_print(L"Handing off to the kernel.\n");
+                trace_dump(ImageHandle);
+
+                status = memory_exit_boot_services(ImageHandle, boot_info);
+                if (EFI_ERROR(status))
+                    console_print(L"Failed to exit boot services! Status: %r\n", status);
+                else
+                {
+                    // With our tables in place a higher half kernel is entered where it was linked to run
+                    UINT64 entry_address = kernel_image.entry;
+                    if (boot_info->paging.pml4 != 0)
+                    {
+                        paging_enable(&boot_info->paging);
+                        if (kernel_image.virtual_start >= PAGING_HIGHER_HALF)
+                            entry_address = kernel_image.virtual_entry;
+                    }
+
+                    kernel_entry_t entry = (kernel_entry_t)(UINTN)entry_address;
+                    entry(boot_info);
+
+                    // There's no firmware left to go back to
+                    while (1){}
+                }
+            }
+        }
     }
 
+    // Write out where the time went
+    trace_dump(ImageHandle);
+
     while (1){}
     return status;
 }
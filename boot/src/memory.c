@@ -0,0 +1,207 @@
+#include "memory.h"
+
+// Helper function to get the type of range a descriptor counts as (0 if it's not usable by the kernel)
+static UINT32 range_type(EFI_MEMORY_DESCRIPTOR *descriptor)
+{
+    switch (descriptor->Type)
+    {
+        case EfiConventionalMemory:
+            return BOOT_MEMORY_FREE;
+        case EfiBootServicesCode:
+        case EfiBootServicesData:
+            return BOOT_MEMORY_RECLAIMABLE;
+        default:
+            return 0;
+    }
+}
+
+// Helper function to get the memory map into a buffer that's already big enough
+static EFI_STATUS get_map(EFI_MEMORY_DESCRIPTOR *map, IN OUT UINTN *map_size, OUT UINTN *map_key,
+    OUT UINTN *descriptor_size, OUT UINT32 *descriptor_version)
+{
+    return uefi_call_wrapper(BS->GetMemoryMap, 5, map_size, map, map_key, descriptor_size, descriptor_version);
+}
+
+// Helper function to mark a run of pages as free in the bitmap, a word at a time where it can
+static VOID set_free(boot_memory_t *memory, UINT64 first, UINT64 count)
+{
+    UINT64 *bitmap = (UINT64 *)(UINTN)memory->bitmap;
+
+    while (count > 0)
+    {
+        UINT64 bit = first % 64;
+        UINT64 take = 64 - bit < count ? 64 - bit : count;
+        UINT64 mask = take == 64 ? ~0ULL : ((1ULL << take) - 1) << bit;
+
+        bitmap[first / 64] |= mask;
+        first += take;
+        count -= take;
+    }
+}
+
+// Helper function to turn the final map into the range table and bitmap (boot services are gone by now)
+static VOID build(boot_memory_t *memory, UINT8 *map, UINTN map_size, UINTN descriptor_size, UINTN range_capacity)
+{
+    boot_memory_range_t *ranges = (boot_memory_range_t *)(UINTN)memory->ranges;
+    UINTN count = 0;
+
+    // Usable descriptors, kept in order as they go in (the map is nearly always sorted already, so this is cheap)
+    for (UINTN offset = 0; offset + descriptor_size <= map_size; offset += descriptor_size)
+    {
+        EFI_MEMORY_DESCRIPTOR *descriptor = (EFI_MEMORY_DESCRIPTOR *)(map + offset);
+        UINT32 type = range_type(descriptor);
+        if (type == 0 || descriptor->NumberOfPages == 0 || count == range_capacity)
+            continue;
+
+        UINTN i = count++;
+        while (i > 0 && ranges[i - 1].start > descriptor->PhysicalStart)
+        {
+            ranges[i] = ranges[i - 1];
+            --i;
+        }
+
+        ranges[i].start = descriptor->PhysicalStart;
+        ranges[i].pages = descriptor->NumberOfPages;
+        ranges[i].type = type;
+        ranges[i].reserved = 0;
+    }
+
+    // Merge neighbours of the same type
+    UINTN merged = 0;
+    for (UINTN i = 0; i < count; ++i)
+    {
+        boot_memory_range_t *last = merged > 0 ? &ranges[merged - 1] : NULL;
+        if (last != NULL && last->type == ranges[i].type && last->start + last->pages * EFI_PAGE_SIZE == ranges[i].start)
+            last->pages += ranges[i].pages;
+        else
+            ranges[merged++] = ranges[i];
+    }
+    memory->range_count = merged;
+
+    // Free ranges go in the bitmap (clipped to the span it was sized for before the map was final)
+    UINT64 *bitmap = (UINT64 *)(UINTN)memory->bitmap;
+    for (UINT64 i = 0; i < (memory->page_count + 63) / 64; ++i)
+        bitmap[i] = 0;
+
+    memory->free_pages = 0;
+    for (UINTN i = 0; i < merged; ++i)
+    {
+        if (ranges[i].type != BOOT_MEMORY_FREE)
+            continue;
+
+        UINT64 first = ranges[i].start / EFI_PAGE_SIZE;
+        UINT64 end = first + ranges[i].pages;
+        if (first < memory->first_page)
+            first = memory->first_page;
+        if (end > memory->first_page + memory->page_count)
+            end = memory->first_page + memory->page_count;
+        if (first >= end)
+            continue;
+
+        set_free(memory, first - memory->first_page, end - first);
+        memory->free_pages += end - first;
+    }
+
+    memory->search_hint = 0;
+}
+
+EFI_STATUS memory_exit_boot_services(IN EFI_HANDLE image_handle, IN OUT boot_info_t *boot_info)
+{
+    EFI_STATUS status;
+    boot_memory_t *memory = &boot_info->memory;
+    UINTN map_size = 0;
+    UINTN map_key;
+    UINTN descriptor_size;
+    UINT32 descriptor_version;
+
+    // Find out how big the map is, and make the buffer big enough for it to grow a bit
+    status = get_map(NULL, &map_size, &map_key, &descriptor_size, &descriptor_version);
+    if (status != EFI_BUFFER_TOO_SMALL)
+        return EFI_ERROR(status) ? status : EFI_DEVICE_ERROR;
+
+    // The kernel keeps using the map, so it's loader data (pool is boot services data, which counts as reclaimable)
+    UINTN map_pages = EFI_SIZE_TO_PAGES(map_size + MEMORY_MAP_SLACK * descriptor_size);
+    UINTN map_capacity = map_pages * EFI_PAGE_SIZE;
+    EFI_PHYSICAL_ADDRESS map_address;
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, map_pages, &map_address);
+    if (EFI_ERROR(status))
+        return status;
+
+    UINT8 *map = (UINT8 *)(UINTN)map_address;
+
+    map_size = map_capacity;
+    status = get_map((EFI_MEMORY_DESCRIPTOR *)map, &map_size, &map_key, &descriptor_size, &descriptor_version);
+    if (EFI_ERROR(status))
+        goto fail;
+
+    // Size the range table and bitmap from this map (allocating them only carves up ranges that are already in it)
+    UINT64 low = ~0ULL;
+    UINT64 high = 0;
+    for (UINTN offset = 0; offset + descriptor_size <= map_size; offset += descriptor_size)
+    {
+        EFI_MEMORY_DESCRIPTOR *descriptor = (EFI_MEMORY_DESCRIPTOR *)(map + offset);
+        if (range_type(descriptor) == 0)
+            continue;
+
+        UINT64 end = descriptor->PhysicalStart + descriptor->NumberOfPages * EFI_PAGE_SIZE;
+        if (descriptor->PhysicalStart < low)
+            low = descriptor->PhysicalStart;
+        if (end > high)
+            high = end;
+    }
+
+    // Page 0 never goes in the bitmap, so an allocator can use 0 for having run out
+    if (low < EFI_PAGE_SIZE)
+        low = EFI_PAGE_SIZE;
+    if (low >= high)
+    {
+        status = EFI_NOT_FOUND;
+        goto fail;
+    }
+
+    UINTN range_capacity = map_capacity / descriptor_size;
+    memory->first_page = low / EFI_PAGE_SIZE;
+    memory->page_count = (high - low) / EFI_PAGE_SIZE;
+
+    UINTN ranges_size = range_capacity * sizeof(boot_memory_range_t);
+    UINTN bitmap_size = (memory->page_count + 63) / 64 * sizeof(UINT64);
+    EFI_PHYSICAL_ADDRESS region;
+    memory->region_pages = EFI_SIZE_TO_PAGES(ranges_size + bitmap_size);
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, memory->region_pages, &region);
+    if (EFI_ERROR(status))
+        goto fail;
+
+    memory->region = region;
+    memory->ranges = region;
+    memory->bitmap = region + ranges_size;
+
+    // Take the final map and leave (the key goes stale if anything allocates in between, so try again once)
+    for (UINTN attempt = 0; attempt < 2; ++attempt)
+    {
+        map_size = map_capacity;
+        status = get_map((EFI_MEMORY_DESCRIPTOR *)map, &map_size, &map_key, &descriptor_size, &descriptor_version);
+        if (EFI_ERROR(status))
+            break;
+
+        status = uefi_call_wrapper(BS->ExitBootServices, 2, image_handle, map_key);
+        if (status != EFI_INVALID_PARAMETER)
+            break;
+    }
+    if (EFI_ERROR(status))
+    {
+        uefi_call_wrapper(BS->FreePages, 2, region, memory->region_pages);
+        goto fail;
+    }
+
+    memory->efi_map = (UINT64)(UINTN)map;
+    memory->efi_map_size = map_size;
+    memory->efi_descriptor_size = descriptor_size;
+    memory->efi_descriptor_version = descriptor_version;
+
+    build(memory, map, map_size, descriptor_size, range_capacity);
+    return EFI_SUCCESS;
+
+fail:
+    uefi_call_wrapper(BS->FreePages, 2, map_address, map_pages);
+    return status;
+}
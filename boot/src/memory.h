@@ -0,0 +1,15 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "bootinfo.h"
+
+// Spare descriptors to leave room for, since allocating the buffers can split ranges in the map
+#define MEMORY_MAP_SLACK 16
+
+// Take the final memory map, leave boot services and set up boot_info->memory
+// (nothing can Print or call boot services once this succeeds, so trace_dump has to come first)
+EFI_STATUS memory_exit_boot_services(IN EFI_HANDLE image_handle, IN OUT boot_info_t *boot_info);
+
+#endif
@@ -0,0 +1,99 @@
+#include "mp.h"
+
+static EFI_GUID mp_services_guid = MP_SERVICES_PROTOCOL_GUID;
+
+static mp_services_protocol_t *mp_services = NULL;
+static UINTN processor_count = 1;
+
+// What every processor is working through
+typedef struct
+{
+    parallel_work_t work;
+    VOID *context;
+    UINTN count;
+    UINTN next;                 // Next index to hand out
+} job_t;
+
+// Helper function to keep taking indexes until there are none left
+static VOID run_job(job_t *job)
+{
+    while (1)
+    {
+        UINTN index = __atomic_fetch_add(&job->next, 1, __ATOMIC_ACQ_REL);
+        if (index >= job->count)
+            break;
+
+        job->work(index, job->context);
+    }
+}
+
+// Helper function the APs start in
+static VOID __attribute__((ms_abi)) ap_procedure(VOID *argument)
+{
+    run_job(argument);
+}
+
+EFI_STATUS mp_init(VOID)
+{
+    EFI_STATUS status;
+    UINTN total, enabled;
+
+    status = LibLocateProtocol(&mp_services_guid, (VOID **)&mp_services);
+    if (EFI_ERROR(status))
+    {
+        mp_services = NULL;
+        return status;
+    }
+
+    status = uefi_call_wrapper(mp_services->GetNumberOfProcessors, 3, mp_services, &total, &enabled);
+    if (EFI_ERROR(status) || enabled == 0)
+    {
+        mp_services = NULL;
+        return EFI_ERROR(status) ? status : EFI_NOT_FOUND;
+    }
+
+    processor_count = enabled;
+    return EFI_SUCCESS;
+}
+
+UINTN mp_processor_count(VOID)
+{
+    return processor_count;
+}
+
+VOID parallel_for(IN UINTN count, IN parallel_work_t work, IN VOID *context)
+{
+    EFI_STATUS status;
+    EFI_EVENT done = NULL;
+    job_t job = {
+        .work = work,
+        .context = context,
+        .count = count,
+        .next = 0,
+    };
+
+    // Start the APs without waiting for them, so the BSP can take its share too
+    BOOLEAN started = FALSE;
+    if (mp_services != NULL && processor_count > 1 && count > 1)
+    {
+        status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &done);
+        if (!EFI_ERROR(status))
+        {
+            status = uefi_call_wrapper(mp_services->StartupAllAPs, 7, mp_services, ap_procedure, FALSE, done, 0, &job, NULL);
+            started = !EFI_ERROR(status);
+        }
+    }
+
+    run_job(&job);
+
+    // The job lives on this stack, so nothing can return before the APs are finished with it
+    if (started)
+    {
+        UINTN index;
+        uefi_call_wrapper(BS->WaitForEvent, 3, 1, &done, &index);
+    }
+    if (done != NULL)
+        uefi_call_wrapper(BS->CloseEvent, 1, done);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,46 @@
+#ifndef MP_H
+#define MP_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// --------------------------
+// EFI_MP_SERVICES_PROTOCOL (PI spec, not in gnu-efi)
+// --------------------------
+
+#define MP_SERVICES_PROTOCOL_GUID {0x3FDDA605, 0xA76E, 0x4F46, {0xAD, 0x29, 0x12, 0xF4, 0x53, 0x1B, 0x3D, 0x08}}
+
+// Runs on every AP (the firmware calls it with the Microsoft ABI)
+typedef VOID (__attribute__((ms_abi)) *mp_procedure_t)(VOID *argument);
+
+typedef struct mp_services_protocol mp_services_protocol_t;
+
+struct mp_services_protocol
+{
+    EFI_STATUS (*GetNumberOfProcessors)(mp_services_protocol_t *This, UINTN *NumberOfProcessors, UINTN *NumberOfEnabledProcessors);
+    VOID *GetProcessorInfo;
+    EFI_STATUS (*StartupAllAPs)(mp_services_protocol_t *This, mp_procedure_t Procedure, BOOLEAN SingleThread,
+        EFI_EVENT WaitEvent, UINTN TimeoutInMicroSeconds, VOID *ProcedureArgument, UINTN **FailedCpuList);
+    VOID *StartupThisAP;
+    VOID *SwitchBSP;
+    VOID *EnableDisableAP;
+    EFI_STATUS (*WhoAmI)(mp_services_protocol_t *This, UINTN *ProcessorNumber);
+};
+
+// --------------------------
+// Parallel work
+// --------------------------
+
+// Work for one index (this runs on APs too, so it can't call boot services or Print)
+typedef VOID (*parallel_work_t)(UINTN index, VOID *context);
+
+// Find MP services and count the enabled processors (everything runs on the BSP if it isn't there)
+EFI_STATUS mp_init(VOID);
+
+// How many processors parallel_for spreads work over (including the BSP)
+UINTN mp_processor_count(VOID);
+
+// Run work for every index from 0 to count - 1 on every processor, and return once they're all done
+VOID parallel_for(IN UINTN count, IN parallel_work_t work, IN VOID *context);
+
+#endif
@@ -0,0 +1,239 @@
+#include "paging.h"
+#include "arena.h"
+
+#define PAGE_PRESENT (1ULL << 0)
+#define PAGE_WRITABLE (1ULL << 1)
+#define PAGE_PWT (1ULL << 3)                // Selects PAT entry 1, which PAGING_PAT makes write-combining
+#define PAGE_LARGE (1ULL << 7)              // A 2MB or 1GB page rather than the next table down
+#define PAGE_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+
+#define SIZE_4K 0x1000ULL
+#define SIZE_2M 0x200000ULL
+#define SIZE_1G 0x40000000ULL
+#define ALIGN_DOWN(value, size) ((value) & ~((size) - 1))
+#define ALIGN_UP(value, size) ALIGN_DOWN((value) + (size) - 1, size)
+
+#define CPUID_PAT (1U << 16)                // Leaf 1, EDX
+#define CPUID_PAGE_1GB (1U << 26)           // Leaf 0x80000001, EDX
+#define MSR_PAT 0x277
+
+// Tables handed out one page at a time from a single block
+typedef struct
+{
+    UINT8 *base;
+    UINTN used;
+    UINTN capacity;
+} table_pool_t;
+
+// Helper function to ask the CPU about itself
+static VOID cpuid(UINT32 leaf, OUT UINT32 *eax, OUT UINT32 *ebx, OUT UINT32 *ecx, OUT UINT32 *edx)
+{
+    __asm__ __volatile__("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+// Helper function to find where the highest range in the memory map ends (RAM, MMIO or anything else)
+static EFI_STATUS memory_top(OUT UINT64 *top)
+{
+    EFI_STATUS status;
+    UINTN map_size = 0, map_key, descriptor_size;
+    UINT32 descriptor_version;
+    arena_mark_t mark = arena_mark();
+
+    status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, NULL, &map_key, &descriptor_size, &descriptor_version);
+    if (status != EFI_BUFFER_TOO_SMALL)
+        return EFI_ERROR(status) ? status : EFI_SUCCESS;
+
+    // Room for a few more descriptors, in case the arena has to get another chunk for the buffer
+    map_size += 4 * descriptor_size;
+    UINT8 *map = arena_alloc(map_size, 0);
+    if (map == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, (EFI_MEMORY_DESCRIPTOR *)map, &map_key, &descriptor_size, &descriptor_version);
+    if (!EFI_ERROR(status))
+    {
+        *top = 0;
+        for (UINTN offset = 0; offset + descriptor_size <= map_size; offset += descriptor_size)
+        {
+            EFI_MEMORY_DESCRIPTOR *descriptor = (EFI_MEMORY_DESCRIPTOR *)(map + offset);
+            UINT64 end = descriptor->PhysicalStart + descriptor->NumberOfPages * EFI_PAGE_SIZE;
+            if (end > *top)
+                *top = end;
+        }
+    }
+
+    arena_reset(mark);
+    return status;
+}
+
+// Helper function to work out the most tables mapping a range can take (big pages are only used where both
+// addresses line up, so otherwise every level is needed all the way along)
+static UINT64 tables_needed(UINT64 virtual_address, UINT64 physical_address, UINT64 size, BOOLEAN gigabyte_pages)
+{
+    UINT64 offset = virtual_address - physical_address;
+    UINT64 tables = size / (512 * SIZE_1G) + 2;
+
+    tables += gigabyte_pages && offset % SIZE_1G == 0 ? 2 : size / SIZE_1G + 2;
+    tables += offset % SIZE_2M == 0 ? 2 : size / SIZE_2M + 2;
+    return tables;
+}
+
+// Helper function to get a zeroed table from the pool
+static UINT64 *take_table(table_pool_t *pool)
+{
+    if (pool->used == pool->capacity)
+        return NULL;
+
+    UINT64 *table = (UINT64 *)(pool->base + pool->used++ * EFI_PAGE_SIZE);
+    ZeroMem(table, EFI_PAGE_SIZE);
+    return table;
+}
+
+// Helper function to map a range on the biggest pages that fit each part of it
+static EFI_STATUS map_range(table_pool_t *pool, UINT64 *pml4, UINT64 virtual_address, UINT64 physical_address,
+    UINT64 size, UINT64 flags, BOOLEAN gigabyte_pages)
+{
+    while (size > 0)
+    {
+        // Level 3 entries map 1GB, level 2 2MB and level 1 4KB
+        UINTN level = 1;
+        UINT64 page_size = SIZE_4K;
+        if (gigabyte_pages && (virtual_address | physical_address) % SIZE_1G == 0 && size >= SIZE_1G)
+        {
+            level = 3;
+            page_size = SIZE_1G;
+        }
+        else if ((virtual_address | physical_address) % SIZE_2M == 0 && size >= SIZE_2M)
+        {
+            level = 2;
+            page_size = SIZE_2M;
+        }
+
+        // Walk down from the PML4, adding the tables that aren't there yet
+        UINT64 *table = pml4;
+        for (UINTN depth = 4; depth > level; --depth)
+        {
+            UINTN index = (virtual_address >> (12 + 9 * (depth - 1))) & 511;
+            if (!(table[index] & PAGE_PRESENT))
+            {
+                UINT64 *child = take_table(pool);
+                if (child == NULL)
+                    return EFI_BUFFER_TOO_SMALL;
+                table[index] = (UINT64)(UINTN)child | PAGE_PRESENT | PAGE_WRITABLE;
+            }
+            table = (UINT64 *)(UINTN)(table[index] & PAGE_ADDRESS_MASK);
+        }
+
+        UINTN index = (virtual_address >> (12 + 9 * (level - 1))) & 511;
+        table[index] = physical_address | flags | PAGE_PRESENT | PAGE_WRITABLE | (level > 1 ? PAGE_LARGE : 0);
+
+        virtual_address += page_size;
+        physical_address += page_size;
+        size -= page_size;
+    }
+
+    return EFI_SUCCESS;
+}
+
+EFI_STATUS paging_build(IN elf_image_t *kernel, IN boot_framebuffer_t *framebuffer, OUT boot_paging_t *paging)
+{
+    EFI_STATUS status;
+    UINT32 eax, ebx, ecx, edx;
+    UINT64 top;
+
+    ZeroMem(paging, sizeof(*paging));
+
+    // 1GB pages and PAT are both optional
+    BOOLEAN gigabyte_pages = FALSE;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001)
+    {
+        cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        gigabyte_pages = (edx & CPUID_PAGE_1GB) != 0;
+    }
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    BOOLEAN pat = (edx & CPUID_PAT) != 0;
+
+    status = memory_top(&top);
+    if (EFI_ERROR(status))
+        return status;
+    if (top < PAGING_MIN_IDENTITY_END)
+        top = PAGING_MIN_IDENTITY_END;
+
+    // The framebuffer is the only part of the identity map that isn't write-back (without PAT it has to be)
+    UINT64 framebuffer_start = 0, framebuffer_end = 0;
+    if (framebuffer->base != 0 && framebuffer->size != 0 && pat)
+    {
+        framebuffer_start = ALIGN_DOWN(framebuffer->base, SIZE_4K);
+        framebuffer_end = ALIGN_UP(framebuffer->base + framebuffer->size, SIZE_4K);
+        if (framebuffer_end > top)
+            top = framebuffer_end;
+    }
+
+    paging->identity_page_size = gigabyte_pages ? SIZE_1G : SIZE_2M;
+    top = ALIGN_UP(top, paging->identity_page_size);
+
+    // The kernel goes where it was linked if that's in the higher half, and at PAGING_KERNEL_BASE otherwise. It's
+    // padded out to whole 2MB pages when the addresses line up, and gets 4KB pages when they don't
+    UINT64 kernel_physical = kernel->physical_start;
+    UINT64 kernel_virtual = kernel->virtual_start >= PAGING_HIGHER_HALF ? kernel->virtual_start
+        : PAGING_KERNEL_BASE + kernel_physical % SIZE_2M;
+    UINT64 kernel_size = kernel->physical_end - kernel->physical_start;
+    paging->kernel_virtual_start = kernel_virtual;
+    paging->kernel_virtual_size = kernel_size;
+
+    if (kernel_virtual % SIZE_2M == kernel_physical % SIZE_2M)
+    {
+        UINT64 slack = kernel_physical % SIZE_2M;
+        kernel_virtual -= slack;
+        kernel_physical -= slack;
+        kernel_size = ALIGN_UP(kernel_size + slack, SIZE_2M);
+    }
+    if (kernel_virtual + kernel_size < kernel_virtual && kernel_virtual + kernel_size != 0)
+        return EFI_UNSUPPORTED;
+
+    // Every table comes out of one block sized for the worst case, and what's left over is given back
+    table_pool_t pool;
+    EFI_PHYSICAL_ADDRESS block;
+    pool.used = 0;
+    pool.capacity = 1 + tables_needed(0, 0, top, gigabyte_pages)
+        + tables_needed(framebuffer_start, framebuffer_start, framebuffer_end - framebuffer_start, gigabyte_pages)
+        + tables_needed(kernel_virtual, kernel_physical, kernel_size, FALSE);
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, pool.capacity, &block);
+    if (EFI_ERROR(status))
+        return status;
+    pool.base = (UINT8 *)(UINTN)block;
+
+    UINT64 *pml4 = take_table(&pool);
+    status = map_range(&pool, pml4, 0, 0, framebuffer_start, 0, gigabyte_pages);
+    if (!EFI_ERROR(status))
+        status = map_range(&pool, pml4, framebuffer_start, framebuffer_start, framebuffer_end - framebuffer_start, PAGE_PWT, gigabyte_pages);
+    if (!EFI_ERROR(status))
+        status = map_range(&pool, pml4, framebuffer_end, framebuffer_end, top - framebuffer_end, 0, gigabyte_pages);
+    if (!EFI_ERROR(status))
+        status = map_range(&pool, pml4, kernel_virtual, kernel_physical, kernel_size, 0, FALSE);
+    if (EFI_ERROR(status))
+    {
+        uefi_call_wrapper(BS->FreePages, 2, block, pool.capacity);
+        return status;
+    }
+
+    if (pool.used < pool.capacity)
+        uefi_call_wrapper(BS->FreePages, 2, block + pool.used * EFI_PAGE_SIZE, pool.capacity - pool.used);
+
+    paging->pml4 = (UINT64)(UINTN)pml4;
+    paging->tables = block;
+    paging->table_pages = pool.used;
+    paging->identity_end = top;
+    paging->pat = pat ? PAGING_PAT : 0;
+    return EFI_SUCCESS;
+}
+
+VOID paging_enable(IN boot_paging_t *paging)
+{
+    // Nothing the firmware mapped uses PWT on its own, so changing what it means before switching is safe
+    if (paging->pat != 0)
+        __asm__ __volatile__("wrmsr" : : "c"(MSR_PAT), "a"((UINT32)paging->pat), "d"((UINT32)(paging->pat >> 32)));
+
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(paging->pml4) : "memory");
+}
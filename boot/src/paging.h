@@ -0,0 +1,28 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "bootinfo.h"
+#include "elf.h"
+
+// Kernels linked at or above this are mapped where they were linked
+#define PAGING_HIGHER_HALF 0xFFFF800000000000ULL
+
+// Where the kernel is mapped in the higher half when it wasn't linked to run there (the top 2GB, like -mcmodel=kernel)
+#define PAGING_KERNEL_BASE 0xFFFFFFFF80000000ULL
+
+// Physical addresses below this are always identity mapped, RAM or not (it's where the firmware puts MMIO)
+#define PAGING_MIN_IDENTITY_END 0x100000000ULL
+
+// IA32_PAT: the power-on default, except entry 1 (PWT) is write-combining instead of write-through
+#define PAGING_PAT 0x0007040600070106ULL
+
+// Build the page tables the kernel gets called with: all of physical memory identity mapped on the biggest pages the
+// CPU has, the framebuffer write-combining, and the kernel image in the higher half. Nothing is switched yet
+EFI_STATUS paging_build(IN elf_image_t *kernel, IN boot_framebuffer_t *framebuffer, OUT boot_paging_t *paging);
+
+// Set up PAT and switch to the tables (only once boot services are gone, the firmware doesn't expect its tables to change)
+VOID paging_enable(IN boot_paging_t *paging);
+
+#endif
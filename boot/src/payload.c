@@ -0,0 +1,194 @@
+#include "payload.h"
+#include "trace.h"
+
+// What each processor needs to unpack its share of the blocks
+typedef struct
+{
+    lz4_frame_t *frame;
+    const UINT8 *frame_data;
+    UINT8 *output;
+    payload_hash_frame_t *hashes;   // NULL if the payload isn't hashed
+    EFI_STATUS *results;            // One per block
+} unpack_context_t;
+
+// Helper function to decompress and check one block (runs on APs, so no boot services in here)
+static VOID unpack_block(UINTN index, VOID *context)
+{
+    unpack_context_t *unpack = context;
+    lz4_block_t *block = &unpack->frame->blocks[index];
+    const UINT8 *source = unpack->frame_data + block->offset;
+    UINT64 start = (UINT64)index * unpack->frame->block_max_size;
+    UINT8 *dest = unpack->output + start;
+
+    // Every block fills up to the maximum except the last
+    UINTN expected = unpack->frame->block_max_size;
+    if (unpack->frame->content_size - start < expected)
+        expected = unpack->frame->content_size - start;
+
+    UINTN produced;
+    if (block->uncompressed)
+    {
+        produced = block->size;
+        for (UINTN i = 0; i < produced && i < expected; ++i)
+            dest[i] = source[i];
+    }
+    else
+    {
+        EFI_STATUS status = lz4_decompress_block(source, block->size, dest, expected, &produced);
+        if (EFI_ERROR(status))
+        {
+            unpack->results[index] = status;
+            return;
+        }
+    }
+
+    if (produced != expected)
+    {
+        unpack->results[index] = EFI_VOLUME_CORRUPTED;
+        return;
+    }
+
+    if (unpack->hashes != NULL)
+    {
+        UINT8 digest[SHA256_DIGEST_SIZE];
+        sha256(dest, expected, digest);
+
+        for (UINTN i = 0; i < SHA256_DIGEST_SIZE; ++i)
+        {
+            if (digest[i] != unpack->hashes->hashes[index][i])
+            {
+                unpack->results[index] = EFI_SECURITY_VIOLATION;
+                return;
+            }
+        }
+    }
+
+    unpack->results[index] = EFI_SUCCESS;
+}
+
+// Helper function to unpack a packed payload that's already in memory
+static EFI_STATUS unpack(UINT8 *data, UINTN size, OUT VOID **buffer, OUT UINTN *unpacked_size)
+{
+    EFI_STATUS status;
+    payload_hash_frame_t *hashes = NULL;
+    UINTN offset = 0;
+    arena_mark_t mark;
+
+    // Skippable frames come first, and one of them might be the hashes
+    while (size - offset >= 8 && (*(UINT32 *)(data + offset) & LZ4_SKIPPABLE_MAGIC_MASK) == LZ4_SKIPPABLE_MAGIC)
+    {
+        payload_hash_frame_t *skippable = (payload_hash_frame_t *)(data + offset);
+        if (skippable->frame_size > size - offset - 8)
+            return EFI_VOLUME_CORRUPTED;
+
+        if (skippable->magic == PAYLOAD_HASH_FRAME_MAGIC && skippable->frame_size >= 8 && skippable->tag == PAYLOAD_HASH_TAG)
+        {
+            if ((UINT64)skippable->block_count * SHA256_DIGEST_SIZE > skippable->frame_size - 8)
+                return EFI_VOLUME_CORRUPTED;
+            hashes = skippable;
+        }
+
+        offset += 8 + skippable->frame_size;
+    }
+
+    // The block list and results are only needed until it's unpacked
+    lz4_frame_t frame;
+    mark = arena_mark();
+    status = lz4_parse_frame(data + offset, size - offset, &frame);
+    if (EFI_ERROR(status))
+        goto done;
+
+    // Dependent blocks would have to be done one after the other, and the packing script never makes them
+    status = EFI_UNSUPPORTED;
+    if (!frame.independent)
+        goto done;
+
+    status = EFI_VOLUME_CORRUPTED;
+    if (hashes != NULL && hashes->block_count != frame.block_count)
+        goto done;
+
+    EFI_PHYSICAL_ADDRESS pages;
+    UINTN page_count = EFI_SIZE_TO_PAGES(frame.content_size > 0 ? frame.content_size : 1);
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, page_count, &pages);
+    if (EFI_ERROR(status))
+        goto done;
+
+    unpack_context_t context = {
+        .frame = &frame,
+        .frame_data = data + offset,
+        .output = (UINT8 *)(UINTN)pages,
+        .hashes = hashes,
+        .results = arena_alloc((frame.block_count > 0 ? frame.block_count : 1) * sizeof(EFI_STATUS), 0),
+    };
+    if (context.results == NULL)
+    {
+        uefi_call_wrapper(BS->FreePages, 2, pages, page_count);
+        status = EFI_OUT_OF_RESOURCES;
+        goto done;
+    }
+
+    trace_begin("unpack");
+    parallel_for(frame.block_count, unpack_block, &context);
+    trace_end("unpack");
+
+    status = EFI_SUCCESS;
+    for (UINTN i = 0; i < frame.block_count && !EFI_ERROR(status); ++i)
+        status = context.results[i];
+
+    if (EFI_ERROR(status))
+    {
+        uefi_call_wrapper(BS->FreePages, 2, pages, page_count);
+        goto done;
+    }
+
+    *buffer = (VOID *)(UINTN)pages;
+    *unpacked_size = frame.content_size;
+
+done:
+    arena_reset(mark);
+    return status;
+}
+
+BOOLEAN payload_is_packed(IN file_t *file)
+{
+    UINT32 magic;
+
+    if (EFI_ERROR(file_read(file, 0, sizeof(magic), &magic)))
+        return FALSE;
+
+    return magic == LZ4_FRAME_MAGIC || (magic & LZ4_SKIPPABLE_MAGIC_MASK) == LZ4_SKIPPABLE_MAGIC;
+}
+
+EFI_STATUS payload_load(IN file_t *file, OUT VOID **buffer, OUT UINTN *size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages;
+    UINTN page_count = EFI_SIZE_TO_PAGES(file->size > 0 ? file->size : 1);
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, page_count, &pages);
+    if (EFI_ERROR(status))
+        return status;
+
+    status = file_read(file, 0, file->size, (VOID *)(UINTN)pages);
+    if (EFI_ERROR(status) || !payload_is_packed(file))
+    {
+        if (EFI_ERROR(status))
+            uefi_call_wrapper(BS->FreePages, 2, pages, page_count);
+        else
+        {
+            *buffer = (VOID *)(UINTN)pages;
+            *size = file->size;
+        }
+        return status;
+    }
+
+    // The packed copy isn't needed once it's unpacked
+    status = unpack((UINT8 *)(UINTN)pages, file->size, buffer, size);
+    uefi_call_wrapper(BS->FreePages, 2, pages, page_count);
+    return status;
+}
+
+VOID payload_free(IN VOID *buffer, IN UINTN size)
+{
+    uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)buffer, EFI_SIZE_TO_PAGES(size > 0 ? size : 1));
+}
@@ -0,0 +1,35 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "file.h"
+#include "lz4.h"
+#include "sha256.h"
+#include "mp.h"
+
+// Packed payloads (made by scripts/pack_payload.py) are an optional skippable frame with a SHA-256 of every
+// decompressed block, followed by an LZ4 frame with independent blocks and the content size filled in
+#define PAYLOAD_HASH_FRAME_MAGIC (LZ4_SKIPPABLE_MAGIC | 0xB)
+#define PAYLOAD_HASH_TAG 0x32414853     // "SHA2"
+
+// Skippable frame holding the block hashes
+typedef struct
+{
+    UINT32 magic;                   // PAYLOAD_HASH_FRAME_MAGIC
+    UINT32 frame_size;              // Bytes after this field
+    UINT32 tag;                     // PAYLOAD_HASH_TAG
+    UINT32 block_count;
+    UINT8 hashes[][SHA256_DIGEST_SIZE];
+} __attribute__((packed)) payload_hash_frame_t;
+
+// Check whether a file starts with an LZ4 or skippable frame
+BOOLEAN payload_is_packed(IN file_t *file);
+
+// Load a whole file into freshly allocated pages, decompressing and checking its blocks on every processor if it's packed
+EFI_STATUS payload_load(IN file_t *file, OUT VOID **buffer, OUT UINTN *size);
+
+// Give back what payload_load allocated
+VOID payload_free(IN VOID *buffer, IN UINTN size);
+
+#endif
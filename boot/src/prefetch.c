@@ -0,0 +1,134 @@
+#include "prefetch.h"
+
+static EFI_BLOCK_IO_PROTOCOL *prefetch_block_io = NULL;
+static partition_info_t prefetch_partition;
+static const char *prefetch_path = NULL;
+static BOOLEAN active = FALSE;              // There's more to read
+static UINT64 file_size;
+static UINT8 *buffer = NULL;                // The start of the file, from AllocatePages once the file's been found
+static UINTN target;                        // Bytes of it to read
+static UINTN done;                          // Bytes read so far
+static file_t inner;                        // What an attached file reads the rest from
+static prefetch_stats_t stats;
+
+// Helper function to compare two paths
+static BOOLEAN same_path(const char *a, const char *b)
+{
+    while (*a != 0 && *a == *b)
+    {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+// Helper function to read from what was read ahead, then from the file for anything past it
+static EFI_STATUS read_prefetched(VOID *context, UINT64 offset, UINTN length, VOID *destination)
+{
+    UINT8 *dest = destination;
+
+    if (offset < done)
+    {
+        UINTN cached = done - offset < length ? done - offset : length;
+        CopyMem(dest, buffer + offset, cached);
+        stats.hit_bytes += cached;
+
+        offset += cached;
+        dest += cached;
+        length -= cached;
+    }
+
+    if (length == 0)
+        return EFI_SUCCESS;
+    return inner.read(inner.context, offset, length, dest);
+}
+
+VOID prefetch_start(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN partition_info_t *partition, IN const char *path)
+{
+    if (prefetch_path != NULL && block_io == prefetch_block_io
+        && CompareGuid(&partition->unique_guid, &prefetch_partition.unique_guid) == 0 && same_path(path, prefetch_path))
+        return;
+
+    prefetch_release();
+    prefetch_block_io = block_io;
+    prefetch_partition = *partition;
+    prefetch_path = path;
+    active = TRUE;
+}
+
+BOOLEAN prefetch_step(VOID)
+{
+    EFI_STATUS status;
+    ext4_fs_t fs;
+    ext4_file_t file;
+
+    if (!active)
+        return FALSE;
+
+    // Every step mounts and opens the file again (after the first the metadata comes from the block cache), so
+    // nothing stays in the arena while the menu carries on
+    status = ext4_mount(&fs, prefetch_block_io, &prefetch_partition);
+    if (!EFI_ERROR(status))
+    {
+        status = ext4_open(&fs, prefetch_path, &file);
+        if (!EFI_ERROR(status) && buffer == NULL)
+        {
+            // The first step only reads the metadata, then the buffer is ready for the next ones
+            file_size = file.size;
+            target = file.size < PREFETCH_SIZE ? file.size : PREFETCH_SIZE;
+            if (target > 0)
+            {
+                EFI_PHYSICAL_ADDRESS address;
+                status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(target), &address);
+                if (!EFI_ERROR(status))
+                    buffer = (UINT8 *)(UINTN)address;
+            }
+        }
+        else if (!EFI_ERROR(status))
+        {
+            UINTN length = target - done < PREFETCH_STEP_SIZE ? target - done : PREFETCH_STEP_SIZE;
+            status = ext4_read(&file, done, length, buffer + done);
+            if (!EFI_ERROR(status))
+            {
+                done += length;
+                stats.bytes += length;
+            }
+        }
+        ext4_unmount(&fs);
+    }
+
+    // Whatever was read before a failure is still good
+    ++stats.steps;
+    if (EFI_ERROR(status) || done == target)
+        active = FALSE;
+    return active;
+}
+
+VOID prefetch_attach(IN partition_info_t *partition, IN const char *path, IN OUT file_t *file)
+{
+    if (done == 0 || CompareGuid(&partition->unique_guid, &prefetch_partition.unique_guid) != 0
+        || !same_path(path, prefetch_path) || file->size != file_size)
+        return;
+
+    inner = *file;
+    file->read = read_prefetched;
+    file->context = NULL;
+}
+
+VOID prefetch_release(VOID)
+{
+    if (buffer != NULL)
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)buffer, EFI_SIZE_TO_PAGES(target));
+
+    prefetch_block_io = NULL;
+    prefetch_path = NULL;
+    active = FALSE;
+    buffer = NULL;
+    target = 0;
+    done = 0;
+}
+
+VOID prefetch_get_stats(OUT prefetch_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
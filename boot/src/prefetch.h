@@ -0,0 +1,39 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <efi.h>
+#include <efilib.h>
+#include "device.h"
+#include "file.h"
+
+// How much of the start of the file is read ahead
+#define PREFETCH_SIZE (4 * 1024 * 1024)
+
+// Most bytes of the file read in one step, so a key that comes in during one isn't kept waiting long
+#define PREFETCH_STEP_SIZE (256 * 1024)
+
+typedef struct
+{
+    UINT64 steps;           // prefetch_step calls that did something
+    UINT64 bytes;           // Bytes of the file read ahead
+    UINT64 hit_bytes;       // Bytes an attached file got from them
+} prefetch_stats_t;
+
+// Start reading ahead a file on an ext4 partition, dropping anything read ahead from somewhere else (it carries on
+// where it was if it's the same file). Nothing is read until prefetch_step
+VOID prefetch_start(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN partition_info_t *partition, IN const char *path);
+
+// Do the next piece of reading ahead (the filesystem metadata down to the file first, then the file a step at a time),
+// FALSE once there's nothing left to do. Nothing is left allocated from the arena in between
+BOOLEAN prefetch_step(VOID);
+
+// If file is the one that was read ahead, wrap it so the part that was read comes from memory (it's left alone if not)
+VOID prefetch_attach(IN partition_info_t *partition, IN const char *path, IN OUT file_t *file);
+
+// Stop reading ahead and free what was read (attached files go back to reading everything from the disk)
+VOID prefetch_release(VOID);
+
+// Get the counters
+VOID prefetch_get_stats(OUT prefetch_stats_t *stats);
+
+#endif
@@ -0,0 +1,707 @@
+#include "probe.h"
+#include "trace.h"
+#include "ext4.h"
+#include "fat32.h"
+#include "arena.h"
+
+#define GPT_HEADER_SIGNATURE 0x5452415020494645ULL // "EFI PART"
+#define GPT_DEFAULT_ENTRY_ARRAY_SIZE (128 * 128)     // 128 entries of 128 bytes, what almost every disk uses
+#define PROBE_CACHED_SIZE 4096                       // The part of the probe read worth caching (mounting rereads it)
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+// Where the signatures are, in bytes from the start of the partition (or of the superblock for Btrfs)
+#define BOOT_SIGNATURE_OFFSET 510
+#define FAT_EXTENDED_BOOT_SIGNATURE 0x29
+#define FAT16_EXTENDED_BPB_OFFSET 38        // FAT32's comes later, after its longer BPB
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+#define EXT3_FEATURE_COMPAT_HAS_JOURNAL 0x0004
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+#define EXT4_ONLY_FEATURES (EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_FLEX_BG)
+#define NTFS_OEM_ID_OFFSET 3
+#define NTFS_SERIAL_OFFSET 72
+#define XFS_SUPERBLOCK_MAGIC 0x58465342     // "XFSB"
+#define XFS_BLOCK_SIZE_OFFSET 4
+#define XFS_UUID_OFFSET 32
+#define XFS_SECTOR_SIZE_OFFSET 102
+#define XFS_LABEL_OFFSET 108
+#define BTRFS_SUPERBLOCK_OFFSET 65536
+#define BTRFS_FSID_OFFSET 32
+#define BTRFS_BYTENR_OFFSET 48
+#define BTRFS_MAGIC_OFFSET 64
+#define BTRFS_LABEL_OFFSET 299
+#define BTRFS_LABEL_SIZE 256
+#define SWAP_VERSION_OFFSET 1024
+#define SWAP_UUID_OFFSET 1036
+#define SWAP_LABEL_OFFSET 1052
+#define SWAP_SIGNATURE_OFFSET 4086          // The last 10 bytes of a 4K page
+
+static EFI_GUID block_io2_guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+typedef enum
+{
+    STAGE_GPT,          // Waiting for the GPT header (and usually the entry array right after it)
+    STAGE_ENTRIES,      // Waiting for an entry array that wasn't next to the header
+    STAGE_FILESYSTEMS,  // Waiting for partition superblocks
+    STAGE_DONE,
+} probe_stage_t;
+
+// A read that may still be in flight
+typedef struct
+{
+    EFI_BLOCK_IO2_TOKEN token;
+    VOID *buffer;       // From the arena, aligned for the device
+    EFI_LBA lba;
+    UINTN size;
+    BOOLEAN pending;    // The device hasn't finished it yet
+} probe_read_t;
+
+typedef struct
+{
+    device_t *device;
+    probe_stage_t stage;
+    probe_read_t gpt;
+    probe_read_t entries;
+    probe_read_t *filesystems;  // One per partition
+    UINTN filesystems_left;
+    BOOLEAN probe_filesystems;  // Stop after the entry array if this isn't set
+} probe_state_t;
+
+// Recognises one family of filesystems from the start of a partition, returning how sure it is (0 for no match)
+typedef struct
+{
+    UINT8 (*match)(UINT8 *buffer, OUT filesystem_info_t *info);
+    UINTN extent;               // Bytes from the start of the partition it needs to see
+} probe_matcher_t;
+
+// Helper function to read little and big endian numbers out of a superblock at any alignment
+static UINT16 read_le16(UINT8 *p) { return p[0] | (p[1] << 8); }
+static UINT32 read_le32(UINT8 *p) { return read_le16(p) | ((UINT32)read_le16(p + 2) << 16); }
+static UINT64 read_le64(UINT8 *p) { return read_le32(p) | ((UINT64)read_le32(p + 4) << 32); }
+static UINT16 read_be16(UINT8 *p) { return (p[0] << 8) | p[1]; }
+static UINT32 read_be32(UINT8 *p) { return ((UINT32)read_be16(p) << 16) | read_be16(p + 2); }
+
+// Helper function to check for a power of two within a range
+static BOOLEAN is_power_of_two(UINT64 value, UINT64 min, UINT64 max)
+{
+    return value >= min && value <= max && (value & (value - 1)) == 0;
+}
+
+// Helper function to check for the 0x55 0xAA that ends a boot sector
+static BOOLEAN has_boot_signature(UINT8 *buffer)
+{
+    return buffer[BOOT_SIGNATURE_OFFSET] == 0x55 && buffer[BOOT_SIGNATURE_OFFSET + 1] == 0xAA;
+}
+
+// Helper function to copy a space or NUL padded label, leaving out the padding (anything that isn't ASCII becomes '?')
+static VOID copy_label(filesystem_info_t *info, UINT8 *label, UINTN length)
+{
+    UINTN end = 0;
+    for (UINTN i = 0; i < length && i < MAX_LABEL_LENGTH && label[i] != 0; ++i)
+    {
+        info->label[i] = label[i] < 0x80 ? label[i] : '?';
+        if (label[i] != ' ')
+            end = i + 1;
+    }
+    info->label[end] = 0;
+}
+
+// Helper function to copy a UUID or serial number
+static VOID copy_volume_id(filesystem_info_t *info, UINT8 *id, UINTN size)
+{
+    CopyMem(info->volume_id, id, size);
+    info->volume_id_size = size;
+}
+
+// FAT12, FAT16 and FAT32, told apart by cluster count like the specification says (the type string is only a hint)
+static UINT8 match_fat(UINT8 *buffer, filesystem_info_t *info)
+{
+    fat32_bpb_t *bpb = (fat32_bpb_t *)buffer;
+    UINT32 bytes_per_sector = read_le16((UINT8 *)&bpb->bytes_per_sector);
+    UINT32 reserved_sectors = read_le16((UINT8 *)&bpb->reserved_sectors);
+    UINT32 root_entries = read_le16((UINT8 *)&bpb->root_entries);
+    UINT32 fat_size = read_le16((UINT8 *)&bpb->fat_size_16);
+    UINT32 total_sectors = read_le16((UINT8 *)&bpb->total_sectors_16);
+
+    if (fat_size == 0)
+        fat_size = bpb->fat_size_32;
+    if (total_sectors == 0)
+        total_sectors = bpb->total_sectors_32;
+
+    // NTFS and exFAT have a BPB too, but with no FATs
+    if (!is_power_of_two(bytes_per_sector, 512, 4096) || !is_power_of_two(bpb->sectors_per_cluster, 1, 128) ||
+        reserved_sectors == 0 || bpb->fat_count == 0 || fat_size == 0 || total_sectors == 0)
+        return 0;
+
+    UINT32 root_sectors = (root_entries * 32 + bytes_per_sector - 1) / bytes_per_sector;
+    UINT64 metadata_sectors = reserved_sectors + (UINT64)bpb->fat_count * fat_size + root_sectors;
+    if (metadata_sectors >= total_sectors)
+        return 0;
+
+    UINT64 clusters = (total_sectors - metadata_sectors) / bpb->sectors_per_cluster;
+    UINT8 *extended;
+    const char *type_string;
+    if (clusters < FAT12_MAX_CLUSTERS)
+    {
+        info->type = FS_FAT12;
+        extended = buffer + FAT16_EXTENDED_BPB_OFFSET;
+        type_string = "FAT12   ";
+    }
+    else if (clusters < FAT16_MAX_CLUSTERS)
+    {
+        info->type = FS_FAT16;
+        extended = buffer + FAT16_EXTENDED_BPB_OFFSET;
+        type_string = "FAT16   ";
+    }
+    else
+    {
+        info->type = FS_FAT32;
+        extended = &bpb->boot_signature;
+        type_string = "FAT32   ";
+    }
+
+    // The serial number and label only mean anything with the extended boot signature
+    if (extended[0] == FAT_EXTENDED_BOOT_SIGNATURE)
+    {
+        copy_volume_id(info, extended + 1, 4);
+        if (CompareMem(extended + 5, "NO NAME    ", 11) != 0)
+            copy_label(info, extended + 5, 11);
+    }
+
+    UINT8 confidence = 50;
+    if (has_boot_signature(buffer))
+        confidence += 25;
+    if (extended[0] == FAT_EXTENDED_BOOT_SIGNATURE && CompareMem(extended + 16, type_string, 8) == 0)
+        confidence += 25;
+    return confidence;
+}
+
+// ext2, ext3 and ext4, told apart by the features they use
+static UINT8 match_ext(UINT8 *buffer, filesystem_info_t *info)
+{
+    ext4_superblock_t *superblock = (ext4_superblock_t *)(buffer + EXT4_SUPERBLOCK_OFFSET);
+    if (superblock->magic != EXT4_SUPERBLOCK_MAGIC)
+        return 0;
+
+    if (superblock->feature_incompat & EXT4_ONLY_FEATURES)
+        info->type = FS_EXT4;
+    else if (superblock->feature_compat & EXT3_FEATURE_COMPAT_HAS_JOURNAL)
+        info->type = FS_EXT3;
+    else
+        info->type = FS_EXT2;
+
+    copy_volume_id(info, superblock->uuid, sizeof(superblock->uuid));
+    copy_label(info, (UINT8 *)superblock->volume_name, sizeof(superblock->volume_name));
+
+    // Two bytes is a weak signature on its own, so check the geometry is one mkfs could have made
+    UINT8 confidence = 50;
+    if (superblock->log_block_size <= 6 && superblock->rev_level <= 1)
+        confidence += 25;
+    if (superblock->blocks_per_group != 0 && superblock->inodes_per_group != 0 &&
+        superblock->inodes_per_group <= superblock->inodes_count)
+        confidence += 25;
+    return confidence;
+}
+
+// NTFS (the label lives in the $Volume file, so only the serial number is found)
+static UINT8 match_ntfs(UINT8 *buffer, filesystem_info_t *info)
+{
+    if (CompareMem(buffer + NTFS_OEM_ID_OFFSET, "NTFS    ", 8) != 0)
+        return 0;
+
+    info->type = FS_NTFS;
+    copy_volume_id(info, buffer + NTFS_SERIAL_OFFSET, 8);
+
+    UINT8 confidence = 50;
+    if (has_boot_signature(buffer))
+        confidence += 25;
+    if (is_power_of_two(read_le16(buffer + 11), 256, 4096) && ((fat32_bpb_t *)buffer)->fat_count == 0)
+        confidence += 25;
+    return confidence;
+}
+
+// XFS (its superblock is big endian)
+static UINT8 match_xfs(UINT8 *buffer, filesystem_info_t *info)
+{
+    if (read_be32(buffer) != XFS_SUPERBLOCK_MAGIC)
+        return 0;
+
+    info->type = FS_XFS;
+    copy_volume_id(info, buffer + XFS_UUID_OFFSET, 16);
+    copy_label(info, buffer + XFS_LABEL_OFFSET, 12);
+
+    UINT8 confidence = 50;
+    if (is_power_of_two(read_be32(buffer + XFS_BLOCK_SIZE_OFFSET), 512, 65536))
+        confidence += 25;
+    if (is_power_of_two(read_be16(buffer + XFS_SECTOR_SIZE_OFFSET), 512, 32768))
+        confidence += 25;
+    return confidence;
+}
+
+// Btrfs (the superblock is 64K in, which is what makes the shared read as big as it is)
+static UINT8 match_btrfs(UINT8 *buffer, filesystem_info_t *info)
+{
+    UINT8 *superblock = buffer + BTRFS_SUPERBLOCK_OFFSET;
+    if (CompareMem(superblock + BTRFS_MAGIC_OFFSET, "_BHRfS_M", 8) != 0)
+        return 0;
+
+    info->type = FS_BTRFS;
+    copy_volume_id(info, superblock + BTRFS_FSID_OFFSET, 16);
+    copy_label(info, superblock + BTRFS_LABEL_OFFSET, BTRFS_LABEL_SIZE);
+
+    // The superblock records its own position
+    UINT8 confidence = 75;
+    if (read_le64(superblock + BTRFS_BYTENR_OFFSET) == BTRFS_SUPERBLOCK_OFFSET)
+        confidence += 25;
+    return confidence;
+}
+
+// Linux swap (the signature sits at the end of the first page)
+static UINT8 match_swap(UINT8 *buffer, filesystem_info_t *info)
+{
+    UINT8 confidence;
+    if (CompareMem(buffer + SWAP_SIGNATURE_OFFSET, "SWAPSPACE2", 10) == 0)
+        confidence = 75;
+    else if (CompareMem(buffer + SWAP_SIGNATURE_OFFSET, "SWAP-SPACE", 10) == 0)
+        confidence = 50;
+    else
+        return 0;
+
+    info->type = FS_SWAP;
+    if (read_le32(buffer + SWAP_VERSION_OFFSET) == 1)
+    {
+        copy_volume_id(info, buffer + SWAP_UUID_OFFSET, 16);
+        copy_label(info, buffer + SWAP_LABEL_OFFSET, 16);
+        confidence += 25;
+    }
+    return confidence;
+}
+
+// Everything we can recognise, with how far into the partition each one looks (the read covers all of them)
+static const probe_matcher_t matchers[] =
+{
+    { match_fat, BOOT_SIGNATURE_OFFSET + 2 },
+    { match_ext, EXT4_SUPERBLOCK_OFFSET + sizeof(ext4_superblock_t) },
+    { match_ntfs, BOOT_SIGNATURE_OFFSET + 2 },
+    { match_xfs, XFS_LABEL_OFFSET + 12 },
+    { match_btrfs, BTRFS_SUPERBLOCK_OFFSET + BTRFS_LABEL_OFFSET + BTRFS_LABEL_SIZE },
+    { match_swap, SWAP_SIGNATURE_OFFSET + 10 },
+};
+
+// Helper function to get the size of the one read that every matcher shares, in whole blocks
+static UINTN probe_read_size(UINT32 block_size)
+{
+    UINTN extent = 0;
+    for (UINTN i = 0; i < ARRAY_SIZE(matchers); ++i)
+    {
+        if (matchers[i].extent > extent)
+            extent = matchers[i].extent;
+    }
+
+    return (extent + block_size - 1) / block_size * block_size;
+}
+
+// Helper function to run every matcher over the start of a partition and keep the one that's most sure
+static VOID identify(UINT8 *buffer, OUT filesystem_info_t *info)
+{
+    ZeroMem(info, sizeof(*info));
+    for (UINTN i = 0; i < ARRAY_SIZE(matchers); ++i)
+    {
+        filesystem_info_t candidate;
+        ZeroMem(&candidate, sizeof(candidate));
+        candidate.confidence = matchers[i].match(buffer, &candidate);
+
+        if (candidate.confidence >= PROBE_MIN_CONFIDENCE && candidate.confidence > info->confidence)
+            *info = candidate;
+    }
+}
+
+// Helper function to start a read (asynchronously when the device has BlockIo2, otherwise it's done on return)
+static EFI_STATUS submit_read(device_t *device, probe_read_t *read, EFI_LBA lba, UINTN size)
+{
+    EFI_STATUS status;
+
+    read->lba = lba;
+    read->size = size;
+    read->pending = FALSE;
+    read->token.Event = NULL;
+
+    read->buffer = arena_alloc_io(device->block_io, size);
+    if (read->buffer == NULL)
+    {
+        read->token.TransactionStatus = EFI_OUT_OF_RESOURCES;
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // No BlockIo2 (or it was read before), so just read it now
+    if (device->block_io2 == NULL || block_cache_contains(device->block_io, lba, size / device->block_io->Media->BlockSize))
+    {
+        read->token.TransactionStatus = block_cache_read(device->block_io, lba, size, read->buffer);
+        return read->token.TransactionStatus;
+    }
+
+    status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &read->token.Event);
+    if (!EFI_ERROR(status))
+    {
+        status = uefi_call_wrapper(device->block_io2->ReadBlocksEx, 6,
+            device->block_io2,
+            device->block_io2->Media->MediaId,
+            lba,
+            &read->token,
+            size,
+            read->buffer
+        );
+    }
+
+    if (EFI_ERROR(status))
+    {
+        // Some drivers refuse async requests they can't queue, so fall back to a synchronous read
+        if (read->token.Event != NULL)
+            uefi_call_wrapper(BS->CloseEvent, 1, read->token.Event);
+        read->token.Event = NULL;
+        read->token.TransactionStatus = block_cache_read(device->block_io, lba, size, read->buffer);
+        return read->token.TransactionStatus;
+    }
+
+    read->pending = TRUE;
+    return EFI_SUCCESS;
+}
+
+// Helper function to clean up a read that has finished (its buffer goes back with the rest of the arena), FALSE if
+// it's still going
+static BOOLEAN release_read(probe_read_t *read)
+{
+    // The device still owns the buffer and token, so leaking them is the only safe option
+    if (read->pending)
+        return FALSE;
+
+    if (read->token.Event != NULL)
+        uefi_call_wrapper(BS->CloseEvent, 1, read->token.Event);
+
+    read->token.Event = NULL;
+    read->buffer = NULL;
+    return TRUE;
+}
+
+// Helper function to round a byte count up to whole blocks
+static UINTN round_to_blocks(UINTN size, UINT32 block_size)
+{
+    return (size + block_size - 1) / block_size * block_size;
+}
+
+// Helper function to fill out the partitions from the entry array and start reading their superblocks
+static VOID parse_entries(probe_state_t *state, UINT8 *entry_array, UINTN entry_size, UINTN num_entries)
+{
+    device_t *device = state->device;
+    EFI_BLOCK_IO_PROTOCOL *block_io = device->block_io;
+
+    // Process each partition entry
+    UINTN valid_partitions_count = 0;
+    for (UINTN j = 0; j < num_entries; ++j)
+    {
+        EFI_PARTITION_ENTRY *entry = (EFI_PARTITION_ENTRY *)(entry_array + j * entry_size);
+
+        // Check that we are not over
+        if (valid_partitions_count >= MAX_PARTITIONS)
+            break;
+
+        // Check that the partition is not unused
+        if (CompareGuid(&entry->PartitionTypeGUID, &NullGuid) == 0)
+            continue;
+
+        // Fill out partition information
+        partition_info_t *partition = &device->partitions[valid_partitions_count];
+        partition->size = entry->EndingLBA - entry->StartingLBA - 1;
+        partition->size *= block_io->Media->BlockSize;
+        partition->offset = entry->StartingLBA * block_io->Media->BlockSize;
+        ZeroMem(&partition->filesystem, sizeof(partition->filesystem));
+        CopyMem(&partition->type_guid, &entry->PartitionTypeGUID, sizeof(EFI_GUID));
+        CopyMem(&partition->unique_guid, &entry->UniquePartitionGUID, sizeof(EFI_GUID));
+        StrCpy(partition->name, entry->PartitionName);
+
+        // Update the valid partitions count value
+        ++valid_partitions_count;
+    }
+
+    device->partition_count = valid_partitions_count;
+    device->status = EFI_SUCCESS;
+
+    if (valid_partitions_count == 0 || !state->probe_filesystems)
+    {
+        state->stage = STAGE_DONE;
+        return;
+    }
+
+    // Put every superblock read in flight at once
+    state->filesystems = arena_alloc_zero(valid_partitions_count * sizeof(probe_read_t), 0);
+    if (state->filesystems == NULL)
+    {
+        state->stage = STAGE_DONE;
+        return;
+    }
+
+    for (UINTN i = 0; i < valid_partitions_count; ++i)
+    {
+        submit_read(device, &state->filesystems[i],
+            device->partitions[i].offset / block_io->Media->BlockSize,
+            probe_read_size(block_io->Media->BlockSize)
+        );
+    }
+
+    state->filesystems_left = valid_partitions_count;
+    state->stage = STAGE_FILESYSTEMS;
+}
+
+// Helper function to check the GPT header and move on to the entry array
+static VOID parse_gpt(probe_state_t *state)
+{
+    device_t *device = state->device;
+    EFI_BLOCK_IO_PROTOCOL *block_io = device->block_io;
+    UINT32 block_size = block_io->Media->BlockSize;
+    EFI_PARTITION_TABLE_HEADER *gpt_header = state->gpt.buffer;
+
+    if (EFI_ERROR(state->gpt.token.TransactionStatus))
+    {
+        device->status = state->gpt.token.TransactionStatus;
+        state->stage = STAGE_DONE;
+        return;
+    }
+
+    block_cache_fill(block_io, state->gpt.lba, state->gpt.size, state->gpt.buffer);
+
+    // Validate the signature
+    if (gpt_header->Header.Signature != GPT_HEADER_SIGNATURE)
+    {
+        device->status = EFI_NOT_FOUND;
+        state->stage = STAGE_DONE;
+        return;
+    }
+
+    UINTN entry_size = gpt_header->SizeOfPartitionEntry;
+    UINTN num_entries = gpt_header->NumberOfPartitionEntries;
+    UINTN entry_array_size = round_to_blocks(entry_size * num_entries, block_size);
+
+    if (entry_size < sizeof(EFI_PARTITION_ENTRY))
+    {
+        device->status = EFI_VOLUME_CORRUPTED;
+        state->stage = STAGE_DONE;
+        return;
+    }
+
+    // The entry array usually came in with the header
+    if (gpt_header->PartitionEntryLBA > state->gpt.lba &&
+        (gpt_header->PartitionEntryLBA - state->gpt.lba) * block_size + entry_array_size <= state->gpt.size)
+    {
+        parse_entries(state,
+            (UINT8 *)state->gpt.buffer + (gpt_header->PartitionEntryLBA - state->gpt.lba) * block_size,
+            entry_size,
+            num_entries
+        );
+        return;
+    }
+
+    submit_read(device, &state->entries, gpt_header->PartitionEntryLBA, entry_array_size);
+    state->stage = STAGE_ENTRIES;
+}
+
+// Helper function to move a device's probe along as far as its finished reads allow (TRUE if anything changed)
+static BOOLEAN step(probe_state_t *state)
+{
+    BOOLEAN progressed = FALSE;
+
+    switch (state->stage)
+    {
+    case STAGE_GPT:
+        if (state->gpt.pending)
+            return FALSE;
+        parse_gpt(state);
+        return TRUE;
+
+    case STAGE_ENTRIES:
+        if (state->entries.pending)
+            return FALSE;
+        if (EFI_ERROR(state->entries.token.TransactionStatus))
+        {
+            state->device->status = state->entries.token.TransactionStatus;
+            state->stage = STAGE_DONE;
+            return TRUE;
+        }
+        block_cache_fill(state->device->block_io, state->entries.lba, state->entries.size, state->entries.buffer);
+        parse_entries(state,
+            state->entries.buffer,
+            ((EFI_PARTITION_TABLE_HEADER *)state->gpt.buffer)->SizeOfPartitionEntry,
+            ((EFI_PARTITION_TABLE_HEADER *)state->gpt.buffer)->NumberOfPartitionEntries
+        );
+        return TRUE;
+
+    case STAGE_FILESYSTEMS:
+        for (UINTN i = 0; i < state->device->partition_count; ++i)
+        {
+            probe_read_t *read = &state->filesystems[i];
+            if (read->pending || read->buffer == NULL)
+                continue;
+
+            if (!EFI_ERROR(read->token.TransactionStatus))
+            {
+                block_cache_fill(state->device->block_io, read->lba,
+                    round_to_blocks(PROBE_CACHED_SIZE, state->device->block_io->Media->BlockSize), read->buffer);
+                identify(read->buffer, &state->device->partitions[i].filesystem);
+            }
+
+            release_read(read);
+            --state->filesystems_left;
+            progressed = TRUE;
+        }
+
+        if (state->filesystems_left == 0)
+            state->stage = STAGE_DONE;
+        return progressed;
+
+    case STAGE_DONE:
+    default:
+        return FALSE;
+    }
+}
+
+filesystem_t probe_filesystem(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN OUT partition_info_t *partition)
+{
+    arena_mark_t mark = arena_mark();
+    UINTN size = probe_read_size(block_io->Media->BlockSize);
+
+    ZeroMem(&partition->filesystem, sizeof(partition->filesystem));
+    UINT8 *buffer = arena_alloc_io(block_io, size);
+    if (buffer == NULL)
+        return FS_NONE;
+
+    trace_begin("probe_filesystem");
+    if (!EFI_ERROR(block_cache_read(block_io, partition->offset / block_io->Media->BlockSize, size, buffer)))
+        identify(buffer, &partition->filesystem);
+    trace_end("probe_filesystem");
+
+    arena_reset(mark);
+    return partition->filesystem.type;
+}
+
+EFI_STATUS probe_devices(IN OUT device_t *devices, IN UINTN device_count, IN BOOLEAN probe_filesystems)
+{
+    EFI_STATUS status;
+    probe_state_t *states;
+    EFI_EVENT *events;
+    probe_read_t **event_reads;
+    arena_mark_t mark = arena_mark();
+
+    // A device can have at most one read per partition in flight, plus the GPT read
+    states = arena_alloc_zero(device_count * sizeof(probe_state_t), 0);
+    events = arena_alloc(device_count * (MAX_PARTITIONS + 1) * sizeof(EFI_EVENT), 0);
+    event_reads = arena_alloc(device_count * (MAX_PARTITIONS + 1) * sizeof(probe_read_t *), 0);
+    if (states == NULL || events == NULL || event_reads == NULL)
+    {
+        status = EFI_OUT_OF_RESOURCES;
+        goto done;
+    }
+
+    // Put every GPT read in flight
+    for (UINTN i = 0; i < device_count; ++i)
+    {
+        device_t *device = &devices[i];
+        EFI_BLOCK_IO_MEDIA *media = device->block_io->Media;
+
+        states[i].device = device;
+        states[i].probe_filesystems = probe_filesystems;
+        device->filesystems_probed = probe_filesystems;
+        device->partition_count = 0;
+
+        // BlockIo2 is optional, the reads just happen synchronously without it
+        if (EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, device->handle, &block_io2_guid, (VOID **)&device->block_io2)))
+            device->block_io2 = NULL;
+
+        if (!media->MediaPresent)
+        {
+            device->status = EFI_NO_MEDIA;
+            states[i].stage = STAGE_DONE;
+            continue;
+        }
+
+        // Read the header and the entry array that almost always follows it together
+        UINTN blocks = 1 + GPT_DEFAULT_ENTRY_ARRAY_SIZE / media->BlockSize;
+        if (blocks > media->LastBlock)
+            blocks = media->LastBlock > 0 ? media->LastBlock : 1;
+
+        submit_read(device, &states[i].gpt, 1, blocks * media->BlockSize);
+        states[i].stage = STAGE_GPT;
+    }
+
+    while (TRUE)
+    {
+        // Handle everything that has finished, which may start more reads (or finish them, without BlockIo2)
+        BOOLEAN progressed = TRUE;
+        while (progressed)
+        {
+            progressed = FALSE;
+            for (UINTN i = 0; i < device_count; ++i)
+                progressed |= step(&states[i]);
+        }
+
+        // Gather every read still in flight
+        UINTN pending = 0;
+        for (UINTN i = 0; i < device_count; ++i)
+        {
+            probe_read_t *candidates[2] = { &states[i].gpt, &states[i].entries };
+            for (UINTN j = 0; j < 2; ++j)
+            {
+                if (candidates[j]->pending)
+                {
+                    events[pending] = candidates[j]->token.Event;
+                    event_reads[pending++] = candidates[j];
+                }
+            }
+
+            if (states[i].stage != STAGE_FILESYSTEMS)
+                continue;
+
+            for (UINTN j = 0; j < states[i].device->partition_count; ++j)
+            {
+                if (states[i].filesystems[j].pending)
+                {
+                    events[pending] = states[i].filesystems[j].token.Event;
+                    event_reads[pending++] = &states[i].filesystems[j];
+                }
+            }
+        }
+
+        if (pending == 0)
+            break;
+
+        // Sleep until one of them completes
+        UINTN index;
+        trace_begin("WaitForEvent");
+        status = uefi_call_wrapper(BS->WaitForEvent, 3, pending, events, &index);
+        trace_end("WaitForEvent");
+        if (EFI_ERROR(status))
+            goto done;
+
+        event_reads[index]->pending = FALSE;
+    }
+
+    status = EFI_SUCCESS;
+
+done:
+    // Everything the probe allocated goes back in one go, unless a device is still reading into some of it
+    BOOLEAN finished = TRUE;
+    if (states != NULL)
+    {
+        for (UINTN i = 0; i < device_count; ++i)
+        {
+            finished &= release_read(&states[i].gpt);
+            finished &= release_read(&states[i].entries);
+            for (UINTN j = 0; states[i].filesystems != NULL && j < states[i].device->partition_count; ++j)
+                finished &= release_read(&states[i].filesystems[j]);
+        }
+    }
+    if (finished)
+        arena_reset(mark);
+    else
+        arena_keep();
+
+    return status;
+}
@@ -0,0 +1,21 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <efi.h>
+#include <efilib.h>
+#include <efigpt.h>
+#include "device.h"
+#include "blockcache.h"
+
+// Confidence a probe has when every check for a format passed, and the least it needs to report a format at all
+#define PROBE_CERTAIN 100
+#define PROBE_MIN_CONFIDENCE 50
+
+// Read the GPT (and every partition's superblock if probe_filesystems is set) on all of the devices at once,
+// using BlockIo2 where the firmware has it and plain BlockIo otherwise, filling out each device's status and partitions
+EFI_STATUS probe_devices(IN OUT device_t *devices, IN UINTN device_count, IN BOOLEAN probe_filesystems);
+
+// Determine which filesystem a single partition is formatted to, filling out partition->filesystem
+filesystem_t probe_filesystem(IN EFI_BLOCK_IO_PROTOCOL *block_io, IN OUT partition_info_t *partition);
+
+#endif
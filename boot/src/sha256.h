@@ -0,0 +1,12 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+// Hash size bytes of data (doesn't touch boot services, so it's safe to call from APs)
+VOID sha256(IN const VOID *data, IN UINTN size, OUT UINT8 digest[SHA256_DIGEST_SIZE]);
+
+#endif
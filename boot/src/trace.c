@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#define CALIBRATION_US 10000   // How long to Stall for when measuring the TSC frequency
+
+static EFI_GUID serial_io_guid = EFI_SERIAL_IO_PROTOCOL_GUID;
+static EFI_GUID loaded_image_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+
+typedef struct
+{
+    UINT64 tsc;
+    const char *name;
+    CHAR8 phase;    // 'B' for begin, 'E' for end
+} trace_event_t;
+
+static trace_event_t ring[TRACE_RING_SIZE];
+static UINTN recorded = 0;  // Total events recorded (can be more than the ring holds)
+static UINT64 start_tsc = 0;
+
+// Helper function to read the time stamp counter
+static inline UINT64 read_tsc(VOID)
+{
+    UINT32 lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((UINT64)hi << 32) | lo;
+}
+
+// Helper function to add an event to the ring
+static inline VOID record(const char *name, CHAR8 phase)
+{
+    trace_event_t *event = &ring[recorded % TRACE_RING_SIZE];
+    event->tsc = read_tsc();
+    event->name = name;
+    event->phase = phase;
+    ++recorded;
+}
+
+// Helper function to append a number in decimal to an ASCII buffer
+static UINTN append_number(CHAR8 *buffer, UINT64 value)
+{
+    CHAR8 digits[20];
+    UINTN count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (UINTN i = 0; i < count; ++i)
+        buffer[i] = digits[count - 1 - i];
+
+    return count;
+}
+
+// Helper function to append a string to an ASCII buffer
+static UINTN append_string(CHAR8 *buffer, const char *string)
+{
+    UINTN length = 0;
+    while (string[length] != '\0')
+    {
+        buffer[length] = string[length];
+        ++length;
+    }
+    return length;
+}
+
+VOID trace_init(VOID)
+{
+    recorded = 0;
+    start_tsc = read_tsc();
+}
+
+VOID trace_begin(const char *name)
+{
+    record(name, 'B');
+}
+
+VOID trace_end(const char *name)
+{
+    record(name, 'E');
+}
+
+VOID trace_dump(IN EFI_HANDLE image_handle)
+{
+    // Measure how many TSC ticks there are per microsecond (done here so it costs nothing while booting)
+    UINT64 before = read_tsc();
+    uefi_call_wrapper(BS->Stall, 1, CALIBRATION_US);
+    UINT64 ticks_per_us = (read_tsc() - before) / CALIBRATION_US;
+
+    // Format it: a header line, then "<B|E> <ticks since start> <name>" per event
+    UINTN first = recorded > TRACE_RING_SIZE ? recorded - TRACE_RING_SIZE : 0;
+    UINTN size = 64 + (recorded - first) * 96;
+    CHAR8 *text = AllocatePool(size);
+    if (text == NULL)
+        return;
+
+    UINTN length = append_string(text, "TRACE BEGIN ");
+    length += append_number(text + length, ticks_per_us);
+    length += append_string(text + length, " ");
+    length += append_number(text + length, first);
+    text[length++] = '\n';
+
+    for (UINTN i = first; i < recorded; ++i)
+    {
+        trace_event_t *event = &ring[i % TRACE_RING_SIZE];
+        text[length++] = event->phase;
+        text[length++] = ' ';
+        length += append_number(text + length, event->tsc - start_tsc);
+        text[length++] = ' ';
+
+        // Names are short, but don't let one run off the end of its line
+        for (UINTN j = 0; j < 64 && event->name[j] != '\0'; ++j)
+            text[length++] = event->name[j];
+        text[length++] = '\n';
+    }
+    length += append_string(text + length, "TRACE END\n");
+
+    // Send it over serial if there is one
+    EFI_SERIAL_IO_PROTOCOL *serial;
+    if (!EFI_ERROR(LibLocateProtocol(&serial_io_guid, (VOID **)&serial)))
+    {
+        UINTN written = length;
+        uefi_call_wrapper(serial->Write, 3, serial, &written, text);
+    }
+
+    // And write it to the root of the ESP
+    EFI_LOADED_IMAGE *loaded_image;
+    if (!EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, image_handle, &loaded_image_guid, (VOID **)&loaded_image)))
+    {
+        EFI_FILE_HANDLE root = LibOpenRoot(loaded_image->DeviceHandle);
+        EFI_FILE_HANDLE file;
+        if (root != NULL)
+        {
+            // Get rid of the last boot's trace first, otherwise a shorter trace leaves its tail behind
+            if (!EFI_ERROR(uefi_call_wrapper(root->Open, 5, root, &file, TRACE_FILE_NAME, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0)))
+                uefi_call_wrapper(file->Delete, 1, file);
+
+            if (!EFI_ERROR(uefi_call_wrapper(root->Open, 5,
+                    root,
+                    &file,
+                    TRACE_FILE_NAME,
+                    EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                    0
+            )))
+            {
+                UINTN written = length;
+                uefi_call_wrapper(file->Write, 3, file, &written, text);
+                uefi_call_wrapper(file->Close, 1, file);
+            }
+            uefi_call_wrapper(root->Close, 1, root);
+        }
+    }
+
+    FreePool(text);
+}
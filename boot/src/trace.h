@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// How many events the ring holds (the oldest ones are overwritten once it's full)
+#define TRACE_RING_SIZE 1024
+
+// File the trace is written to on the ESP
+#define TRACE_FILE_NAME L"\\trace.txt"
+
+// Start the clock (every timestamp is relative to this)
+VOID trace_init(VOID);
+
+// Record the start of a phase (name must be a string literal, it isn't copied)
+VOID trace_begin(const char *name);
+
+// Record the end of a phase
+VOID trace_end(const char *name);
+
+// Calibrate the TSC against Stall and write the trace to serial and to the ESP the image was loaded from
+// (scripts/trace2json.py turns it into Chrome trace JSON)
+VOID trace_dump(IN EFI_HANDLE image_handle);
+
+#endif
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+# Boot the image headless in QEMU a number of times and report how long the bootloader took to get going.
+# The console goes to serial (there's no display, so the bootloader falls back to firmware text output), and
+# these are timed from when QEMU starts:
+#   first_output  the first byte on serial (firmware or bootloader)
+#   menu          the auto-boot countdown or the boot menu showing up (a saved partition boots without either)
+#   handoff       the bootloader handing off to the kernel (only if the image has a kernel to load)
+# When the menu shows up the keys are typed in (by default enter, which skips the countdown).
+#
+# Usage: python3 scripts/bench_boot.py [--image build/test.img] [--runs 10] [--smp 1] [--memory 256M]
+#                                      [--keys '\r'] [--timeout 60] [--json out.json]
+#                                      [--baseline old.json] [--tolerance 10]
+# With --baseline it exits with an error if the median of any step got more than --tolerance percent slower.
+
+import argparse
+import json
+import os
+import re
+import select
+import shutil
+import subprocess
+import sys
+import time
+
+MARKERS = {
+    "menu": re.compile(r"press enter to boot now|handles were found"),
+    "handoff": re.compile(r"Handing off to the kernel"),
+}
+STEPS = ["first_output", "menu", "handoff"]
+PERCENTILES = [50, 90, 99]
+
+# Terminal escape sequences the firmware sends to serial
+ESCAPES = re.compile(r"\x1b\[[0-9;?]*[A-Za-z]|\x1b[()][0-9A-Za-z]")
+
+
+def qemu_command(args):
+    command = [
+        args.qemu,
+        "-drive", f"format=raw,file={args.image},index=0,snapshot=on",
+        "-bios", args.bios,
+        "-machine", "q35",
+        "-smp", str(args.smp),
+        "-m", args.memory,
+        "-display", "none",
+        "-vga", "none",
+        "-serial", "stdio",
+        "-monitor", "none",
+        "-net", "none",
+        "-no-reboot",
+    ]
+
+    # KVM makes the numbers mean something, but fall back to TCG where it's not there
+    if os.access("/dev/kvm", os.R_OK | os.W_OK):
+        command += ["-accel", "kvm"]
+    return command
+
+
+def boot_once(args, keys):
+    times = {}
+    output = ""
+    start = time.monotonic()
+    qemu = subprocess.Popen(qemu_command(args), stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                            stderr=subprocess.DEVNULL)
+
+    try:
+        while time.monotonic() - start < args.timeout and "handoff" not in times:
+            ready, _, _ = select.select([qemu.stdout], [], [], 0.1)
+            if not ready:
+                if qemu.poll() is not None:
+                    break
+                continue
+
+            chunk = os.read(qemu.stdout.fileno(), 4096)
+            if not chunk:
+                break
+            now = (time.monotonic() - start) * 1000
+            times.setdefault("first_output", now)
+
+            # Only look at the recent output so markers split across reads are still found
+            output = (output + ESCAPES.sub("", chunk.decode("latin-1")))[-4096:]
+            for step, marker in MARKERS.items():
+                if step not in times and marker.search(output):
+                    times[step] = now
+                    if step == "menu" and keys:
+                        qemu.stdin.write(keys)
+                        qemu.stdin.flush()
+                    output = ""
+    finally:
+        qemu.kill()
+        qemu.wait()
+
+    return times
+
+
+def percentile(values, p):
+    values = sorted(values)
+    rank = (len(values) - 1) * p / 100
+    low = int(rank)
+    high = min(low + 1, len(values) - 1)
+    return values[low] + (values[high] - values[low]) * (rank - low)
+
+
+def summarize(runs):
+    summary = {}
+    for step in STEPS:
+        values = [run[step] for run in runs if step in run]
+        if not values:
+            continue
+        summary[step] = {"runs": len(values), "min": min(values), "max": max(values)}
+        for p in PERCENTILES:
+            summary[step][f"p{p}"] = percentile(values, p)
+    return summary
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Headless QEMU boot benchmark")
+    parser.add_argument("--image", default=os.environ.get("TARGET", "build/test.img"))
+    parser.add_argument("--runs", type=int, default=int(os.environ.get("RUNS", 10)))
+    parser.add_argument("--smp", type=int, default=int(os.environ.get("SMP", 1)))
+    parser.add_argument("--memory", default=os.environ.get("MEMORY", "256M"))
+    parser.add_argument("--bios", default=os.environ.get("BIOS", "bios64.bin"))
+    parser.add_argument("--qemu", default=os.environ.get("QEMU", "qemu-system-x86_64"))
+    parser.add_argument("--keys", default=os.environ.get("KEYS", "\\r"),
+                        help="typed in when the menu shows up, with escapes like \\r (empty to wait out the countdown)")
+    parser.add_argument("--timeout", type=float, default=float(os.environ.get("TIMEOUT", 60)))
+    parser.add_argument("--json", default=os.environ.get("JSON"))
+    parser.add_argument("--baseline", default=os.environ.get("BASELINE"))
+    parser.add_argument("--tolerance", type=float, default=float(os.environ.get("TOLERANCE", 10)))
+    args = parser.parse_args()
+
+    if shutil.which(args.qemu) is None:
+        sys.exit(f"{args.qemu} isn't installed")
+    for path in (args.image, args.bios):
+        if not os.path.exists(path):
+            sys.exit(f"{path} doesn't exist (run make first)")
+
+    keys = args.keys.encode("latin-1").decode("unicode_escape").encode("latin-1")
+
+    runs = []
+    for i in range(args.runs):
+        times = boot_once(args, keys)
+        runs.append(times)
+        steps = "  ".join(f"{step} {times[step]:8.1f} ms" if step in times else f"{step} {'-':>8}   "
+                          for step in STEPS)
+        print(f"run {i + 1:3}/{args.runs}: {steps}", flush=True)
+
+    summary = summarize(runs)
+    print(f"\n{'step':<14}{'runs':>6}{'min':>10}" + "".join(f"{'p' + str(p):>10}" for p in PERCENTILES) + f"{'max':>10}")
+    for step in STEPS:
+        if step not in summary:
+            print(f"{step:<14}{0:>6}   (never seen)")
+            continue
+        s = summary[step]
+        print(f"{step:<14}{s['runs']:>6}{s['min']:>10.1f}" + "".join(f"{s['p' + str(p)]:>10.1f}" for p in PERCENTILES)
+              + f"{s['max']:>10.1f}")
+
+    result = {"smp": args.smp, "memory": args.memory, "runs": args.runs, "steps": summary}
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(result, out, indent=1)
+
+    failed = False
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["steps"]
+        print()
+        for step in STEPS:
+            if step not in baseline:
+                continue
+            if step not in summary:
+                print(f"{step}: seen in the baseline but not any more")
+                failed = True
+                continue
+            old, new = baseline[step]["p50"], summary[step]["p50"]
+            change = (new - old) / old * 100 if old else 0
+            slower = change > args.tolerance
+            failed |= slower
+            print(f"{step}: median {old:.1f} -> {new:.1f} ms ({change:+.1f}%){'  SLOWER' if slower else ''}")
+
+    # Every run should at least get to the menu, or straight to the kernel if a partition was saved
+    if any("menu" not in run and "handoff" not in run for run in runs):
+        print("Some runs never got to the menu or the kernel")
+        failed = True
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
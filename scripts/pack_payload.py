@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Pack a kernel or initrd so the bootloader can decompress and check it on every processor at once.
+# The output is a skippable frame with a SHA-256 of every decompressed block, then an LZ4 frame with
+# independent blocks and the content size (made by the lz4 command line tool, which has to be installed).
+#
+# Usage: python3 scripts/pack_payload.py <in> <out> [block size: 4=64KB, 5=256KB, 6=1MB, 7=4MB]
+
+import hashlib
+import struct
+import subprocess
+import sys
+
+HASH_FRAME_MAGIC = 0x184D2A5B
+HASH_TAG = 0x32414853  # "SHA2"
+BLOCK_SIZES = {4: 64 << 10, 5: 256 << 10, 6: 1 << 20, 7: 4 << 20}
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print(f"Usage: {sys.argv[0]} <in> <out> [block size id]", file=sys.stderr)
+        sys.exit(1)
+
+    block_size_id = int(sys.argv[3]) if len(sys.argv) == 4 else 5
+    if block_size_id not in BLOCK_SIZES:
+        print(f"Block size id must be one of {sorted(BLOCK_SIZES)}", file=sys.stderr)
+        sys.exit(1)
+
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    # lz4 fills every block up to the block size, so the hashes line up with fixed-size pieces of the input
+    # (it's given the file rather than stdin because it only writes the content size when it knows it up front)
+    frame = subprocess.run(
+        ["lz4", "-q", "-9", f"-B{block_size_id}", "-BI", "--content-size", "-c", sys.argv[1]],
+        stdout=subprocess.PIPE, check=True,
+    ).stdout
+
+    block_size = BLOCK_SIZES[block_size_id]
+    hashes = [hashlib.sha256(data[i:i + block_size]).digest() for i in range(0, len(data), block_size)]
+    body = struct.pack("<II", HASH_TAG, len(hashes)) + b"".join(hashes)
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(struct.pack("<II", HASH_FRAME_MAGIC, len(body)))
+        f.write(body)
+        f.write(frame)
+
+    print(f"{len(data)} -> {8 + len(body) + len(frame)} bytes, {len(hashes)} blocks of {block_size}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+# Turn a bootloader trace (from trace.txt on the ESP or a serial log) into Chrome trace JSON.
+# Open the result in chrome://tracing or https://ui.perfetto.dev
+#
+# Usage: python3 scripts/trace2json.py <trace.txt|serial.log> [out.json]
+
+import json
+import sys
+
+
+def parse(lines):
+    events = []
+    ticks_per_us = None
+
+    for line in lines:
+        line = line.strip()
+
+        # Serial logs have all the console output around the trace
+        if line.startswith("TRACE BEGIN"):
+            ticks_per_us = int(line.split()[2]) or 1
+            events = []
+            continue
+        if ticks_per_us is None:
+            continue
+        if line == "TRACE END":
+            break
+
+        parts = line.split(" ", 2)
+        if len(parts) != 3 or parts[0] not in ("B", "E"):
+            continue
+
+        events.append({
+            "name": parts[2],
+            "ph": parts[0],
+            "ts": int(parts[1]) / ticks_per_us,
+            "pid": 1,
+            "tid": 1,
+        })
+
+    if ticks_per_us is None:
+        sys.exit("No trace found (looking for a TRACE BEGIN line)")
+
+    return events
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("Usage: trace2json.py <trace.txt|serial.log> [out.json]")
+
+    with open(sys.argv[1], "r", errors="replace") as trace:
+        events = parse(trace)
+
+    output = json.dumps({"traceEvents": events, "displayTimeUnit": "ms"}, indent=1)
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "w") as out:
+            out.write(output)
+    else:
+        print(output)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,303 @@
+#ifndef EFI_H
+#define EFI_H
+
+// The part of gnu-efi's efi.h that the bootloader's disk and memory code use, declared for a normal Linux program so
+// boot/src compiles unchanged on the host (firmware calls become plain calls into the emulator)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+// --------------------------
+// Types
+// --------------------------
+
+typedef uint8_t UINT8;
+typedef int8_t INT8;
+typedef uint16_t UINT16;
+typedef int16_t INT16;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+typedef uint64_t UINTN;
+typedef int64_t INTN;
+typedef uint8_t BOOLEAN;
+typedef void VOID;
+typedef uint16_t CHAR16;
+typedef unsigned char CHAR8;
+
+typedef UINTN EFI_STATUS;
+typedef UINTN EFI_TPL;
+typedef UINT64 EFI_LBA;
+typedef UINT64 EFI_PHYSICAL_ADDRESS;
+typedef UINT64 EFI_VIRTUAL_ADDRESS;
+typedef VOID *EFI_HANDLE;
+typedef VOID *EFI_EVENT;
+
+typedef struct
+{
+    UINT32 Data1;
+    UINT16 Data2;
+    UINT16 Data3;
+    UINT8 Data4[8];
+} EFI_GUID;
+
+#define TRUE 1
+#define FALSE 0
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST const
+#define EFIAPI
+
+// Firmware calls go through this in gnu-efi to switch calling conventions, which the host doesn't need
+#define uefi_call_wrapper(func, va_num, ...) func(__VA_ARGS__)
+
+// --------------------------
+// Status codes
+// --------------------------
+
+#define EFIERR(a) (0x8000000000000000ULL | (a))
+#define EFI_ERROR(a) (((INTN)(a)) < 0)
+
+#define EFI_SUCCESS 0
+#define EFI_LOAD_ERROR EFIERR(1)
+#define EFI_INVALID_PARAMETER EFIERR(2)
+#define EFI_UNSUPPORTED EFIERR(3)
+#define EFI_BAD_BUFFER_SIZE EFIERR(4)
+#define EFI_BUFFER_TOO_SMALL EFIERR(5)
+#define EFI_NOT_READY EFIERR(6)
+#define EFI_DEVICE_ERROR EFIERR(7)
+#define EFI_WRITE_PROTECTED EFIERR(8)
+#define EFI_OUT_OF_RESOURCES EFIERR(9)
+#define EFI_VOLUME_CORRUPTED EFIERR(10)
+#define EFI_VOLUME_FULL EFIERR(11)
+#define EFI_NO_MEDIA EFIERR(12)
+#define EFI_MEDIA_CHANGED EFIERR(13)
+#define EFI_NOT_FOUND EFIERR(14)
+#define EFI_ACCESS_DENIED EFIERR(15)
+#define EFI_TIMEOUT EFIERR(18)
+#define EFI_NOT_STARTED EFIERR(19)
+#define EFI_ABORTED EFIERR(21)
+#define EFI_SECURITY_VIOLATION EFIERR(26)
+#define EFI_CRC_ERROR EFIERR(27)
+#define EFI_END_OF_FILE EFIERR(31)
+#define EFI_COMPROMISED_DATA EFIERR(33)
+
+// --------------------------
+// Memory
+// --------------------------
+
+#define EFI_PAGE_SIZE 4096
+#define EFI_PAGE_MASK 0xFFF
+#define EFI_PAGE_SHIFT 12
+#define EFI_SIZE_TO_PAGES(a) (((a) >> EFI_PAGE_SHIFT) + (((a) & EFI_PAGE_MASK) ? 1 : 0))
+
+typedef enum
+{
+    AllocateAnyPages,
+    AllocateMaxAddress,
+    AllocateAddress,
+    MaxAllocateType
+} EFI_ALLOCATE_TYPE;
+
+typedef enum
+{
+    EfiReservedMemoryType,
+    EfiLoaderCode,
+    EfiLoaderData,
+    EfiBootServicesCode,
+    EfiBootServicesData,
+    EfiRuntimeServicesCode,
+    EfiRuntimeServicesData,
+    EfiConventionalMemory,
+    EfiUnusableMemory,
+    EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,
+    EfiMemoryMappedIO,
+    EfiMemoryMappedIOPortSpace,
+    EfiPalCode,
+    EfiPersistentMemory,
+    EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef struct
+{
+    UINT32 Type;
+    UINT32 Pad;
+    EFI_PHYSICAL_ADDRESS PhysicalStart;
+    EFI_VIRTUAL_ADDRESS VirtualStart;
+    UINT64 NumberOfPages;
+    UINT64 Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+// --------------------------
+// Events
+// --------------------------
+
+#define EVT_TIMER 0x80000000
+#define EVT_NOTIFY_WAIT 0x00000100
+#define EVT_NOTIFY_SIGNAL 0x00000200
+
+#define TPL_APPLICATION 4
+#define TPL_CALLBACK 8
+#define TPL_NOTIFY 16
+
+typedef enum
+{
+    TimerCancel,
+    TimerPeriodic,
+    TimerRelative
+} EFI_TIMER_DELAY;
+
+typedef VOID (*EFI_EVENT_NOTIFY)(EFI_EVENT event, VOID *context);
+
+// --------------------------
+// Console input (bootio.h comes in through device.h, but nothing here reads keys)
+// --------------------------
+
+typedef struct
+{
+    UINT16 ScanCode;
+    CHAR16 UnicodeChar;
+} EFI_INPUT_KEY;
+
+// --------------------------
+// Boot services (only the ones with a real signature are implemented, by the emulator or by tools/memtest)
+// --------------------------
+
+typedef enum
+{
+    AllHandles,
+    ByRegisterNotify,
+    ByProtocol
+} EFI_LOCATE_SEARCH_TYPE;
+
+typedef struct
+{
+    UINT64 Signature;
+    UINT32 Revision;
+    UINT32 HeaderSize;
+    UINT32 CRC32;
+    UINT32 Reserved;
+} EFI_TABLE_HEADER;
+
+typedef struct
+{
+    EFI_TABLE_HEADER Hdr;
+    VOID *RaiseTPL;
+    VOID *RestoreTPL;
+    EFI_STATUS (*AllocatePages)(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, UINTN pages, EFI_PHYSICAL_ADDRESS *memory);
+    EFI_STATUS (*FreePages)(EFI_PHYSICAL_ADDRESS memory, UINTN pages);
+    EFI_STATUS (*GetMemoryMap)(UINTN *map_size, EFI_MEMORY_DESCRIPTOR *map, UINTN *map_key, UINTN *descriptor_size, UINT32 *descriptor_version);
+    EFI_STATUS (*AllocatePool)(EFI_MEMORY_TYPE pool_type, UINTN size, VOID **buffer);
+    EFI_STATUS (*FreePool)(VOID *buffer);
+    EFI_STATUS (*CreateEvent)(UINT32 type, EFI_TPL notify_tpl, EFI_EVENT_NOTIFY notify, VOID *context, EFI_EVENT *event);
+    EFI_STATUS (*SetTimer)(EFI_EVENT event, EFI_TIMER_DELAY type, UINT64 trigger_time);
+    EFI_STATUS (*WaitForEvent)(UINTN count, EFI_EVENT *events, UINTN *index);
+    EFI_STATUS (*SignalEvent)(EFI_EVENT event);
+    EFI_STATUS (*CloseEvent)(EFI_EVENT event);
+    EFI_STATUS (*CheckEvent)(EFI_EVENT event);
+    VOID *InstallProtocolInterface;
+    VOID *ReinstallProtocolInterface;
+    VOID *UninstallProtocolInterface;
+    EFI_STATUS (*HandleProtocol)(EFI_HANDLE handle, EFI_GUID *protocol, VOID **interface);
+    VOID *Reserved;
+    VOID *RegisterProtocolNotify;
+    VOID *LocateHandle;
+    VOID *LocateDevicePath;
+    VOID *InstallConfigurationTable;
+    VOID *LoadImage;
+    VOID *StartImage;
+    VOID *Exit;
+    VOID *UnloadImage;
+    EFI_STATUS (*ExitBootServices)(EFI_HANDLE image_handle, UINTN map_key);
+    VOID *GetNextMonotonicCount;
+    EFI_STATUS (*Stall)(UINTN microseconds);
+    VOID *SetWatchdogTimer;
+    VOID *ConnectController;
+    VOID *DisconnectController;
+    VOID *OpenProtocol;
+    VOID *CloseProtocol;
+    VOID *OpenProtocolInformation;
+    VOID *ProtocolsPerHandle;
+    VOID *LocateHandleBuffer;
+    VOID *LocateProtocol;
+    VOID *InstallMultipleProtocolInterfaces;
+    VOID *UninstallMultipleProtocolInterfaces;
+    VOID *CalculateCrc32;
+    VOID *CopyMem;
+    VOID *SetMem;
+    VOID *CreateEventEx;
+} EFI_BOOT_SERVICES;
+
+typedef struct
+{
+    EFI_TABLE_HEADER Hdr;
+    CHAR16 *FirmwareVendor;
+    UINT32 FirmwareRevision;
+    EFI_HANDLE ConsoleInHandle;
+    VOID *ConIn;
+    EFI_HANDLE ConsoleOutHandle;
+    VOID *ConOut;
+    EFI_HANDLE StandardErrorHandle;
+    VOID *StdErr;
+    VOID *RuntimeServices;
+    EFI_BOOT_SERVICES *BootServices;
+    UINTN NumberOfTableEntries;
+    VOID *ConfigurationTable;
+} EFI_SYSTEM_TABLE;
+
+// --------------------------
+// Block I/O
+// --------------------------
+
+#define EFI_BLOCK_IO_PROTOCOL_GUID { 0x964e5b21, 0x6459, 0x11d2, { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } }
+#define EFI_BLOCK_IO2_PROTOCOL_GUID { 0xa77b2472, 0xe282, 0x4e9f, { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } }
+
+#define EFI_BLOCK_IO_PROTOCOL_REVISION2 0x00020001
+#define EFI_BLOCK_IO_PROTOCOL_REVISION3 ((2 << 16) | 31)
+
+typedef struct
+{
+    UINT32 MediaId;
+    BOOLEAN RemovableMedia;
+    BOOLEAN MediaPresent;
+    BOOLEAN LogicalPartition;
+    BOOLEAN ReadOnly;
+    BOOLEAN WriteCaching;
+    UINT32 BlockSize;
+    UINT32 IoAlign;
+    EFI_LBA LastBlock;
+    EFI_LBA LowestAlignedLba;
+    UINT32 LogicalBlocksPerPhysicalBlock;
+    UINT32 OptimalTransferLengthGranularity;
+} EFI_BLOCK_IO_MEDIA;
+
+typedef struct _EFI_BLOCK_IO_PROTOCOL
+{
+    UINT64 Revision;
+    EFI_BLOCK_IO_MEDIA *Media;
+    EFI_STATUS (*Reset)(struct _EFI_BLOCK_IO_PROTOCOL *this, BOOLEAN extended_verification);
+    EFI_STATUS (*ReadBlocks)(struct _EFI_BLOCK_IO_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer);
+    EFI_STATUS (*WriteBlocks)(struct _EFI_BLOCK_IO_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer);
+    EFI_STATUS (*FlushBlocks)(struct _EFI_BLOCK_IO_PROTOCOL *this);
+} EFI_BLOCK_IO_PROTOCOL, EFI_BLOCK_IO;
+
+typedef struct
+{
+    EFI_EVENT Event;
+    EFI_STATUS TransactionStatus;
+} EFI_BLOCK_IO2_TOKEN;
+
+typedef struct _EFI_BLOCK_IO2_PROTOCOL
+{
+    EFI_BLOCK_IO_MEDIA *Media;
+    EFI_STATUS (*Reset)(struct _EFI_BLOCK_IO2_PROTOCOL *this, BOOLEAN extended_verification);
+    EFI_STATUS (*ReadBlocksEx)(struct _EFI_BLOCK_IO2_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token, UINTN size, VOID *buffer);
+    EFI_STATUS (*WriteBlocksEx)(struct _EFI_BLOCK_IO2_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token, UINTN size, VOID *buffer);
+    EFI_STATUS (*FlushBlocksEx)(struct _EFI_BLOCK_IO2_PROTOCOL *this, EFI_BLOCK_IO2_TOKEN *token);
+} EFI_BLOCK_IO2_PROTOCOL;
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef EFIGPT_H
+#define EFIGPT_H
+
+#include "efi.h"
+
+typedef struct
+{
+    EFI_TABLE_HEADER Header;
+    EFI_LBA MyLBA;
+    EFI_LBA AlternateLBA;
+    EFI_LBA FirstUsableLBA;
+    EFI_LBA LastUsableLBA;
+    EFI_GUID DiskGUID;
+    EFI_LBA PartitionEntryLBA;
+    UINT32 NumberOfPartitionEntries;
+    UINT32 SizeOfPartitionEntry;
+    UINT32 PartitionEntryArrayCRC32;
+} EFI_PARTITION_TABLE_HEADER;
+
+typedef struct
+{
+    EFI_GUID PartitionTypeGUID;
+    EFI_GUID UniquePartitionGUID;
+    EFI_LBA StartingLBA;
+    EFI_LBA EndingLBA;
+    UINT64 Attributes;
+    CHAR16 PartitionName[36];
+} EFI_PARTITION_ENTRY;
+
+#endif
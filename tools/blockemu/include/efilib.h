@@ -0,0 +1,28 @@
+#ifndef EFILIB_H
+#define EFILIB_H
+
+// The part of gnu-efi's library that the bootloader's disk code uses, implemented in src/efi.c
+
+#include "efi.h"
+
+extern EFI_SYSTEM_TABLE *ST;
+extern EFI_BOOT_SERVICES *BS;
+
+extern EFI_GUID gEfiBlockIoProtocolGuid;
+extern EFI_GUID BlockIoProtocol;
+extern EFI_GUID NullGuid;
+
+VOID *AllocatePool(UINTN size);
+VOID *AllocateZeroPool(UINTN size);
+VOID FreePool(VOID *buffer);
+
+VOID CopyMem(VOID *dest, const VOID *src, UINTN size);
+VOID SetMem(VOID *buffer, UINTN size, UINT8 value);
+VOID ZeroMem(VOID *buffer, UINTN size);
+INTN CompareMem(const VOID *a, const VOID *b, UINTN size);
+INTN CompareGuid(const EFI_GUID *a, const EFI_GUID *b);
+
+VOID StrCpy(CHAR16 *dest, const CHAR16 *src);
+UINTN StrLen(const CHAR16 *string);
+
+#endif
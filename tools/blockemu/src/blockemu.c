@@ -0,0 +1,254 @@
+#include "blockemu.h"
+#include "host.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static EFI_GUID block_io2_guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+// Helper function to get the device from either of its protocols
+#define FROM_BLOCK_IO(this) ((blockemu_t *)((UINT8 *)(this) - offsetof(blockemu_t, block_io)))
+#define FROM_BLOCK_IO2(this) ((blockemu_t *)((UINT8 *)(this) - offsetof(blockemu_t, block_io2)))
+
+// Helper function to check a request the way firmware drivers do
+static EFI_STATUS check_request(blockemu_t *device, UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+    EFI_BLOCK_IO_MEDIA *media = &device->media;
+
+    if (!media->MediaPresent)
+        return EFI_NO_MEDIA;
+    if (media_id != media->MediaId)
+        return EFI_MEDIA_CHANGED;
+    if (buffer == NULL || size % media->BlockSize != 0)
+        return size % media->BlockSize != 0 ? EFI_BAD_BUFFER_SIZE : EFI_INVALID_PARAMETER;
+    if (lba > media->LastBlock || size / media->BlockSize > media->LastBlock - lba + 1)
+        return EFI_INVALID_PARAMETER;
+    if (media->IoAlign > 1 && (UINTN)buffer % media->IoAlign != 0)
+        return EFI_INVALID_PARAMETER;
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to do the read, and decide whether it fails on purpose
+static EFI_STATUS do_read(blockemu_t *device, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+    blockemu_config_t *config = &device->config;
+    UINTN blocks = size / device->media.BlockSize;
+
+    ++device->stats.reads;
+    device->stats.bytes += size;
+    if (config->transfer_granularity > 1 && lba % config->transfer_granularity != 0)
+        ++device->stats.off_granule;
+
+    if ((config->fail_lba >= 0 && (UINT64)config->fail_lba >= lba && (UINT64)config->fail_lba < lba + blocks) ||
+        (config->fail_every != 0 && device->stats.reads % config->fail_every == 0))
+    {
+        ++device->stats.failed;
+        return EFI_DEVICE_ERROR;
+    }
+
+    // Past the end of the file reads as zeroes, the same as a sparse image would
+    memset(buffer, 0, size);
+    if (pread(device->fd, buffer, size, lba * device->media.BlockSize) < 0)
+        return EFI_DEVICE_ERROR;
+
+    return EFI_SUCCESS;
+}
+
+// Helper function to work out when a request finishes, on the first channel that's free
+static UINT64 schedule(blockemu_t *device, UINTN size)
+{
+    blockemu_config_t *config = &device->config;
+    UINT64 now = host_clock();
+    UINT64 cost = config->latency_ns;
+    if (config->bytes_per_second != 0)
+        cost += (UINT64)((double)size * 1e9 / (double)config->bytes_per_second);
+
+    UINT32 channel = 0;
+    for (UINT32 i = 1; i < config->queue_depth; ++i)
+    {
+        if (device->channels[i] < device->channels[channel])
+            channel = i;
+    }
+
+    UINT64 start = device->channels[channel] > now ? device->channels[channel] : now;
+    device->channels[channel] = start + cost;
+
+    // Count how many requests are still going once this one starts
+    UINT64 in_flight = 0;
+    for (UINT32 i = 0; i < config->queue_depth; ++i)
+    {
+        if (device->channels[i] > now)
+            ++in_flight;
+    }
+    if (in_flight > device->stats.max_in_flight)
+        device->stats.max_in_flight = in_flight;
+
+    return start + cost;
+}
+
+static EFI_STATUS read_blocks(EFI_BLOCK_IO_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+    blockemu_t *device = FROM_BLOCK_IO(this);
+
+    EFI_STATUS status = check_request(device, media_id, lba, size, buffer);
+    if (EFI_ERROR(status))
+    {
+        ++device->stats.rejected;
+        return status;
+    }
+
+    // A blocking read waits behind anything already queued
+    UINT64 done = schedule(device, size);
+    status = do_read(device, lba, size, buffer);
+    BS->Stall((done - host_clock() + 999) / 1000);
+    return status;
+}
+
+static EFI_STATUS read_blocks_ex(EFI_BLOCK_IO2_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token,
+    UINTN size, VOID *buffer)
+{
+    blockemu_t *device = FROM_BLOCK_IO2(this);
+
+    // Without an event it's just a blocking read
+    if (token == NULL || token->Event == NULL)
+    {
+        EFI_STATUS status = read_blocks(&device->block_io, media_id, lba, size, buffer);
+        if (token != NULL)
+            token->TransactionStatus = status;
+        return status;
+    }
+
+    EFI_STATUS status = check_request(device, media_id, lba, size, buffer);
+    if (EFI_ERROR(status))
+    {
+        ++device->stats.rejected;
+        return status;
+    }
+
+    // The data is copied straight away, nothing can look at it before the event is signalled anyway
+    ++device->stats.async_reads;
+    token->TransactionStatus = do_read(device, lba, size, buffer);
+    host_signal_at(token->Event, schedule(device, size));
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS reset(EFI_BLOCK_IO_PROTOCOL *this, BOOLEAN extended_verification)
+{
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS reset2(EFI_BLOCK_IO2_PROTOCOL *this, BOOLEAN extended_verification)
+{
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS write_blocks(EFI_BLOCK_IO_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, UINTN size, VOID *buffer)
+{
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS write_blocks_ex(EFI_BLOCK_IO2_PROTOCOL *this, UINT32 media_id, EFI_LBA lba, EFI_BLOCK_IO2_TOKEN *token,
+    UINTN size, VOID *buffer)
+{
+    return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS flush_blocks(EFI_BLOCK_IO_PROTOCOL *this)
+{
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS flush_blocks_ex(EFI_BLOCK_IO2_PROTOCOL *this, EFI_BLOCK_IO2_TOKEN *token)
+{
+    if (token != NULL && token->Event != NULL)
+    {
+        token->TransactionStatus = EFI_SUCCESS;
+        BS->SignalEvent(token->Event);
+    }
+    return EFI_SUCCESS;
+}
+
+VOID blockemu_default_config(OUT blockemu_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->block_size = 512;
+    config->io_align = 1;
+    config->transfer_granularity = 1;
+    config->queue_depth = 1;
+    config->block_io2 = TRUE;
+    config->media_present = TRUE;
+    config->fail_lba = -1;
+}
+
+EFI_STATUS blockemu_open(OUT blockemu_t *device, IN const char *path, IN blockemu_config_t *config)
+{
+    struct stat info;
+
+    memset(device, 0, sizeof(*device));
+    device->config = *config;
+    if (device->config.queue_depth == 0)
+        device->config.queue_depth = 1;
+
+    if (config->block_size == 0 || (config->block_size & (config->block_size - 1)) != 0)
+        return EFI_INVALID_PARAMETER;
+
+    device->fd = open(path, O_RDONLY);
+    if (device->fd < 0)
+        return EFI_NOT_FOUND;
+    if (fstat(device->fd, &info) != 0 || (UINT64)info.st_size < config->block_size)
+    {
+        close(device->fd);
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    device->channels = calloc(device->config.queue_depth, sizeof(UINT64));
+    if (device->channels == NULL)
+    {
+        close(device->fd);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    device->media.MediaId = 1;
+    device->media.MediaPresent = config->media_present;
+    device->media.BlockSize = config->block_size;
+    device->media.IoAlign = config->io_align;
+    device->media.LastBlock = info.st_size / config->block_size - 1;
+    device->media.LogicalBlocksPerPhysicalBlock = 1;
+    device->media.OptimalTransferLengthGranularity = config->transfer_granularity;
+
+    device->block_io.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION3;
+    device->block_io.Media = &device->media;
+    device->block_io.Reset = reset;
+    device->block_io.ReadBlocks = read_blocks;
+    device->block_io.WriteBlocks = write_blocks;
+    device->block_io.FlushBlocks = flush_blocks;
+
+    device->block_io2.Media = &device->media;
+    device->block_io2.Reset = reset2;
+    device->block_io2.ReadBlocksEx = read_blocks_ex;
+    device->block_io2.WriteBlocksEx = write_blocks_ex;
+    device->block_io2.FlushBlocksEx = flush_blocks_ex;
+
+    host_install_protocol(device, &gEfiBlockIoProtocolGuid, &device->block_io);
+    if (config->block_io2)
+        host_install_protocol(device, &block_io2_guid, &device->block_io2);
+
+    return EFI_SUCCESS;
+}
+
+VOID blockemu_close(IN blockemu_t *device)
+{
+    close(device->fd);
+    free(device->channels);
+}
+
+VOID blockemu_reset(IN blockemu_t *device)
+{
+    ++device->media.MediaId;
+    memset(&device->stats, 0, sizeof(device->stats));
+    for (UINT32 i = 0; i < device->config.queue_depth; ++i)
+        device->channels[i] = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef BLOCKEMU_H
+#define BLOCKEMU_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// How a device behaves
+typedef struct
+{
+    UINT32 block_size;          // Bytes per block (the image is read as if it had been written with this LBA size)
+    UINT32 io_align;            // Buffers must be aligned to this (0 or 1 means anything goes)
+    UINT32 transfer_granularity;// OptimalTransferLengthGranularity to report, in blocks
+    UINT64 latency_ns;          // Fixed cost of every request
+    UINT64 bytes_per_second;    // Transfer rate on top of that (0 means transfers are free)
+    UINT32 queue_depth;         // BlockIo2 requests the device works on at once
+    BOOLEAN block_io2;          // Offer BlockIo2 as well as BlockIo
+    BOOLEAN media_present;
+    INT64 fail_lba;             // Reads touching this block fail with EFI_DEVICE_ERROR (-1 for none)
+    UINT64 fail_every;          // Every nth read fails with EFI_DEVICE_ERROR (0 for none)
+} blockemu_config_t;
+
+typedef struct
+{
+    UINT64 reads;               // ReadBlocks and ReadBlocksEx calls that were accepted
+    UINT64 async_reads;         // The ones that came through BlockIo2 with an event
+    UINT64 bytes;
+    UINT64 rejected;            // Calls refused for bad parameters (misaligned buffer, partial block, out of range)
+    UINT64 failed;              // Calls failed on purpose
+    UINT64 off_granule;         // Accepted calls that don't start on a multiple of the transfer granularity
+    UINT64 max_in_flight;       // Most BlockIo2 requests outstanding at once
+} blockemu_stats_t;
+
+typedef struct
+{
+    EFI_BLOCK_IO_PROTOCOL block_io;
+    EFI_BLOCK_IO2_PROTOCOL block_io2;
+    EFI_BLOCK_IO_MEDIA media;
+    blockemu_config_t config;
+    blockemu_stats_t stats;
+    int fd;
+    UINT64 *channels;           // When each of the queue_depth channels is free again
+} blockemu_t;
+
+// Fill out a config for a fast, well behaved 512 byte block device with BlockIo2
+VOID blockemu_default_config(OUT blockemu_config_t *config);
+
+// Open an image file as a device, and install its protocols on the device's handle (the blockemu_t itself)
+EFI_STATUS blockemu_open(OUT blockemu_t *device, IN const char *path, IN blockemu_config_t *config);
+
+// Close the image file
+VOID blockemu_close(IN blockemu_t *device);
+
+// Make the device look like new media was inserted (so nothing cached from before is trusted) and zero the stats
+VOID blockemu_reset(IN blockemu_t *device);
+
+#endif
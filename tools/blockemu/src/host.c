@@ -0,0 +1,316 @@
+#include "host.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Pool allocations get a header, which also makes them 8 byte aligned like UEFI pool (and NOT 16), so reads into
+// pool buffers trip the emulator's IoAlign check the way they would on real hardware
+#define POOL_HEADER_SIZE 8
+
+typedef struct
+{
+    UINT32 type;
+    BOOLEAN signalled;
+    UINT64 signal_at;       // UINT64_MAX if nothing is going to signal it
+} host_event_t;
+
+typedef struct
+{
+    EFI_HANDLE handle;
+    EFI_GUID guid;
+    VOID *interface;
+} host_protocol_t;
+
+static UINT64 clock_ns = 0;
+static UINT64 allocated_pages = 0;
+static UINT64 allocated_pool = 0;
+static UINT64 allocation_calls = 0;
+static host_protocol_t protocols[HOST_MAX_PROTOCOLS];
+static UINTN protocol_count = 0;
+
+EFI_GUID gEfiBlockIoProtocolGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
+EFI_GUID BlockIoProtocol = EFI_BLOCK_IO_PROTOCOL_GUID;
+EFI_GUID NullGuid = { 0 };
+
+// --------------------------
+// Boot services
+// --------------------------
+
+static EFI_STATUS allocate_pages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, UINTN pages, EFI_PHYSICAL_ADDRESS *memory)
+{
+    ++allocation_calls;
+
+    // There's no physical address space to ask for a particular address in
+    if (type != AllocateAnyPages)
+        return EFI_NOT_FOUND;
+
+    VOID *address = mmap(NULL, pages * EFI_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+        return EFI_OUT_OF_RESOURCES;
+
+    allocated_pages += pages;
+    *memory = (EFI_PHYSICAL_ADDRESS)(UINTN)address;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS free_pages(EFI_PHYSICAL_ADDRESS memory, UINTN pages)
+{
+    if (munmap((VOID *)(UINTN)memory, pages * EFI_PAGE_SIZE) != 0)
+        return EFI_INVALID_PARAMETER;
+
+    allocated_pages -= pages;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS allocate_pool(EFI_MEMORY_TYPE pool_type, UINTN size, VOID **buffer)
+{
+    ++allocation_calls;
+    UINT8 *block = malloc(POOL_HEADER_SIZE + size);
+    if (block == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    *(UINT64 *)block = size;
+    allocated_pool += size;
+    *buffer = block + POOL_HEADER_SIZE;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS free_pool(VOID *buffer)
+{
+    UINT8 *block = (UINT8 *)buffer - POOL_HEADER_SIZE;
+    allocated_pool -= *(UINT64 *)block;
+    free(block);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS create_event(UINT32 type, EFI_TPL notify_tpl, EFI_EVENT_NOTIFY notify, VOID *context, EFI_EVENT *event)
+{
+    // Notification functions never run, nothing in the disk code uses them
+    if (notify != NULL)
+        return EFI_UNSUPPORTED;
+
+    host_event_t *created = calloc(1, sizeof(host_event_t));
+    if (created == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    created->type = type;
+    created->signal_at = UINT64_MAX;
+    *event = created;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS set_timer(EFI_EVENT event, EFI_TIMER_DELAY type, UINT64 trigger_time)
+{
+    host_event_t *timer = event;
+    if (!(timer->type & EVT_TIMER) || type == TimerPeriodic)
+        return EFI_UNSUPPORTED;
+
+    // The trigger time is in 100ns units
+    timer->signal_at = type == TimerCancel ? UINT64_MAX : clock_ns + trigger_time * 100;
+    return EFI_SUCCESS;
+}
+
+// Helper function to signal everything that's due by now, returning TRUE if the event is signalled
+static BOOLEAN poll_event(host_event_t *event)
+{
+    if (event->signal_at <= clock_ns)
+    {
+        event->signalled = TRUE;
+        event->signal_at = UINT64_MAX;
+    }
+
+    return event->signalled;
+}
+
+static EFI_STATUS wait_for_event(UINTN count, EFI_EVENT *events, UINTN *index)
+{
+    if (count == 0)
+        return EFI_INVALID_PARAMETER;
+
+    while (TRUE)
+    {
+        for (UINTN i = 0; i < count; ++i)
+        {
+            host_event_t *event = events[i];
+            if (poll_event(event))
+            {
+                event->signalled = FALSE;
+                *index = i;
+                return EFI_SUCCESS;
+            }
+        }
+
+        // Nothing is ready, so skip ahead to whatever happens first (real firmware would hang if that's never)
+        UINT64 next = UINT64_MAX;
+        for (UINTN i = 0; i < count; ++i)
+        {
+            host_event_t *event = events[i];
+            if (event->signal_at < next)
+                next = event->signal_at;
+        }
+
+        if (next == UINT64_MAX)
+            return EFI_INVALID_PARAMETER;
+        clock_ns = next;
+    }
+}
+
+static EFI_STATUS signal_event(EFI_EVENT event)
+{
+    ((host_event_t *)event)->signalled = TRUE;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS close_event(EFI_EVENT event)
+{
+    free(event);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS check_event(EFI_EVENT event)
+{
+    host_event_t *checked = event;
+    if (!poll_event(checked))
+        return EFI_NOT_READY;
+
+    checked->signalled = FALSE;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS handle_protocol(EFI_HANDLE handle, EFI_GUID *protocol, VOID **interface)
+{
+    for (UINTN i = 0; i < protocol_count; ++i)
+    {
+        if (protocols[i].handle == handle && CompareGuid(&protocols[i].guid, protocol) == 0)
+        {
+            *interface = protocols[i].interface;
+            return EFI_SUCCESS;
+        }
+    }
+
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS stall(UINTN microseconds)
+{
+    clock_ns += (UINT64)microseconds * 1000;
+    return EFI_SUCCESS;
+}
+
+static EFI_BOOT_SERVICES boot_services =
+{
+    .AllocatePages = allocate_pages,
+    .FreePages = free_pages,
+    .AllocatePool = allocate_pool,
+    .FreePool = free_pool,
+    .CreateEvent = create_event,
+    .SetTimer = set_timer,
+    .WaitForEvent = wait_for_event,
+    .SignalEvent = signal_event,
+    .CloseEvent = close_event,
+    .CheckEvent = check_event,
+    .HandleProtocol = handle_protocol,
+    .Stall = stall,
+};
+
+static EFI_SYSTEM_TABLE system_table = { .BootServices = &boot_services };
+
+EFI_SYSTEM_TABLE *ST = &system_table;
+EFI_BOOT_SERVICES *BS = &boot_services;
+
+// --------------------------
+// Library
+// --------------------------
+
+VOID *AllocatePool(UINTN size)
+{
+    VOID *buffer;
+    return EFI_ERROR(allocate_pool(EfiLoaderData, size, &buffer)) ? NULL : buffer;
+}
+
+VOID *AllocateZeroPool(UINTN size)
+{
+    VOID *buffer = AllocatePool(size);
+    if (buffer != NULL)
+        memset(buffer, 0, size);
+    return buffer;
+}
+
+VOID FreePool(VOID *buffer)
+{
+    free_pool(buffer);
+}
+
+VOID CopyMem(VOID *dest, const VOID *src, UINTN size)
+{
+    memmove(dest, src, size);
+}
+
+VOID SetMem(VOID *buffer, UINTN size, UINT8 value)
+{
+    memset(buffer, value, size);
+}
+
+VOID ZeroMem(VOID *buffer, UINTN size)
+{
+    memset(buffer, 0, size);
+}
+
+INTN CompareMem(const VOID *a, const VOID *b, UINTN size)
+{
+    return memcmp(a, b, size);
+}
+
+INTN CompareGuid(const EFI_GUID *a, const EFI_GUID *b)
+{
+    return memcmp(a, b, sizeof(EFI_GUID));
+}
+
+VOID StrCpy(CHAR16 *dest, const CHAR16 *src)
+{
+    while ((*dest++ = *src++) != 0);
+}
+
+UINTN StrLen(const CHAR16 *string)
+{
+    UINTN length = 0;
+    while (string[length] != 0)
+        ++length;
+    return length;
+}
+
+// --------------------------
+// Emulator
+// --------------------------
+
+UINT64 host_clock(VOID)
+{
+    return clock_ns;
+}
+
+VOID host_signal_at(EFI_EVENT event, UINT64 time)
+{
+    ((host_event_t *)event)->signal_at = time;
+}
+
+VOID host_install_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID *interface)
+{
+    if (protocol_count >= HOST_MAX_PROTOCOLS)
+        abort();
+
+    protocols[protocol_count].handle = handle;
+    protocols[protocol_count].guid = *guid;
+    protocols[protocol_count].interface = interface;
+    ++protocol_count;
+}
+
+VOID host_get_allocations(UINT64 *pages, UINT64 *pool_bytes)
+{
+    *pages = allocated_pages;
+    *pool_bytes = allocated_pool;
+}
+
+UINT64 host_get_allocation_calls(VOID)
+{
+    return allocation_calls;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// Most protocol interfaces that can be installed on handles at once
+#define HOST_MAX_PROTOCOLS 64
+
+// Nanoseconds of simulated firmware time (device latency and Stall add to it, CPU time doesn't)
+UINT64 host_clock(VOID);
+
+// Signal an event once the clock reaches a point in time (WaitForEvent skips the clock forward to it)
+VOID host_signal_at(EFI_EVENT event, UINT64 time);
+
+// Make an interface available through HandleProtocol
+VOID host_install_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID *interface);
+
+// Pages and pool bytes currently allocated, to catch leaks
+VOID host_get_allocations(UINT64 *pages, UINT64 *pool_bytes);
+
+// AllocatePages and AllocatePool calls made so far
+UINT64 host_get_allocation_calls(VOID);
+
+#endif
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blockemu.h"
+#include "host.h"
+#include "device.h"
+#include "probe.h"
+#include "ext4.h"
+#include "fat32.h"
+#include "file.h"
+#include "arena.h"
+#include "prefetch.h"
+
+#define MAX_RUNS 1000
+
+// Latencies --sweep tries, in microseconds (roughly RAM disk, NVMe, SATA SSD, USB stick, SD card, spinning disk)
+static const UINT64 sweep_latencies[] = { 0, 20, 100, 500, 2000, 8000 };
+
+// Indexed by filesystem_t
+static const char *filesystem_names[] = { "-", "FAT12", "FAT16", "FAT32", "EXT2", "EXT3", "EXT4", "NTFS", "XFS", "Btrfs", "Swap" };
+
+// A host file that a file loaded from the image has to match byte for byte
+typedef struct
+{
+    const char *path;           // NULL if nothing is checked
+    UINT8 *data;
+    UINTN size;
+} expected_t;
+
+typedef struct
+{
+    const char *image;
+    blockemu_config_t config;
+    UINTN runs;
+    BOOLEAN sweep;
+    const char *ext4_path;      // File loaded from every EXT4 partition
+    const char *fat32_path;     // File loaded from every FAT32 partition
+    expected_t ext4_expected;   // What the EXT4 file should contain
+    expected_t fat32_expected;  // What the FAT32 file should contain
+    BOOLEAN prefetch;           // Read the start of every EXT4 file ahead first, like the boot menu does
+} options_t;
+
+// What one pass over the device cost
+typedef struct
+{
+    UINT64 probe_ns;            // Simulated time for the GPT and every partition's probe
+    UINT64 probe_reads;
+    UINT64 load_ns;             // Simulated time to mount and load the files
+    UINT64 load_reads;
+    UINT64 load_bytes;          // Bytes of file that were loaded
+    UINT64 prefetch_ns;         // Simulated time spent reading ahead (not part of load_ns, the menu would be waiting)
+    UINT64 prefetch_reads;
+    UINT64 mismatches;          // Files that loaded but didn't match what was expected
+    UINT64 allocations;         // AllocatePages and AllocatePool calls for both
+    UINT64 cpu_ns;              // Real time spent in the disk code for both
+    BOOLEAN failed;
+} run_t;
+
+// Helper function to turn a status into something readable
+static const char *status_to_string(EFI_STATUS status)
+{
+    switch (status)
+    {
+    case EFI_SUCCESS: return "Success";
+    case EFI_LOAD_ERROR: return "Load Error";
+    case EFI_INVALID_PARAMETER: return "Invalid Parameter";
+    case EFI_UNSUPPORTED: return "Unsupported";
+    case EFI_BAD_BUFFER_SIZE: return "Bad Buffer Size";
+    case EFI_BUFFER_TOO_SMALL: return "Buffer Too Small";
+    case EFI_DEVICE_ERROR: return "Device Error";
+    case EFI_OUT_OF_RESOURCES: return "Out of Resources";
+    case EFI_VOLUME_CORRUPTED: return "Volume Corrupt";
+    case EFI_NO_MEDIA: return "No Media";
+    case EFI_MEDIA_CHANGED: return "Media Changed";
+    case EFI_NOT_FOUND: return "Not Found";
+    case EFI_END_OF_FILE: return "End of File";
+    case EFI_COMPROMISED_DATA: return "Doesn't Match the Expected File";
+    default: return "Error";
+    }
+}
+
+// Helper function to get real time in nanoseconds
+static UINT64 wall_clock(VOID)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Helper function to print a partition name (UCS-2, but only ASCII is expected)
+static VOID print_name(const CHAR16 *name, int width)
+{
+    int i = 0;
+    for (; name[i] != 0 && i < width; ++i)
+        putchar(name[i] < 0x80 ? name[i] : '?');
+    for (; i < width; ++i)
+        putchar(' ');
+}
+
+// Helper function to read a whole host file to compare loaded files against, FALSE if it can't be read
+static BOOLEAN read_expected(const char *path, OUT expected_t *expected)
+{
+    memset(expected, 0, sizeof(*expected));
+    if (path == NULL)
+        return TRUE;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return FALSE;
+
+    BOOLEAN ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    expected->data = ok ? malloc(size > 0 ? size : 1) : NULL;
+    ok = expected->data != NULL && fread(expected->data, 1, size, file) == (size_t)size;
+    fclose(file);
+    if (!ok)
+    {
+        free(expected->data);
+        return FALSE;
+    }
+
+    expected->path = path;
+    expected->size = size;
+    return TRUE;
+}
+
+// Helper function to load a whole ext4 file through a file_t, taking whatever was read ahead
+static EFI_STATUS load_prefetched(ext4_file_t *ext4_file, partition_info_t *partition, const char *path, OUT VOID **buffer, OUT UINTN *size)
+{
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages;
+    file_t file;
+
+    file_from_ext4(ext4_file, &file);
+    prefetch_attach(partition, path, &file);
+
+    status = BS->AllocatePages(AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(file.size), &pages);
+    if (EFI_ERROR(status))
+        return status;
+
+    status = file_read(&file, 0, file.size, (VOID *)(UINTN)pages);
+    if (EFI_ERROR(status))
+    {
+        BS->FreePages(pages, EFI_SIZE_TO_PAGES(file.size));
+        return status;
+    }
+
+    *buffer = (VOID *)(UINTN)pages;
+    *size = file.size;
+    return EFI_SUCCESS;
+}
+
+// Helper function to load a whole file from a partition through the bootloader's own readers
+static EFI_STATUS load_file(blockemu_t *device, partition_info_t *partition, const char *path, BOOLEAN prefetched,
+    const expected_t *expected, UINT64 *bytes)
+{
+    EFI_STATUS status;
+    VOID *buffer;
+    UINTN size;
+
+    if (partition->filesystem.type == FS_EXT4 && path != NULL)
+    {
+        ext4_fs_t fs;
+        ext4_file_t file;
+
+        status = ext4_mount(&fs, &device->block_io, partition);
+        if (EFI_ERROR(status))
+            return status;
+
+        status = ext4_open(&fs, path, &file);
+        if (!EFI_ERROR(status))
+            status = prefetched ? load_prefetched(&file, partition, path, &buffer, &size) : ext4_load_file(&file, &buffer, &size);
+        ext4_unmount(&fs);
+    }
+    else if (partition->filesystem.type == FS_FAT32 && path != NULL)
+    {
+        fat32_fs_t fs;
+        fat32_file_t file;
+
+        status = fat32_mount(&fs, &device->block_io, partition->offset);
+        if (EFI_ERROR(status))
+            return status;
+
+        status = fat32_open(&fs, path, &file);
+        if (!EFI_ERROR(status))
+        {
+            status = fat32_load_file(&file, &buffer, &size);
+            fat32_close(&file);
+        }
+        fat32_unmount(&fs);
+    }
+    else
+        return EFI_UNSUPPORTED;
+
+    if (EFI_ERROR(status))
+        return status;
+
+    // Reading the right number of blocks isn't enough, the bytes have to be the file's
+    if (expected->path != NULL && (size != expected->size || memcmp(buffer, expected->data, size) != 0))
+        status = EFI_COMPROMISED_DATA;
+
+    *bytes += size;
+    BS->FreePages((EFI_PHYSICAL_ADDRESS)(UINTN)buffer, EFI_SIZE_TO_PAGES(size));
+    return status;
+}
+
+// Helper function to probe the device and load the files once, the way a boot would
+static EFI_STATUS run(options_t *options, blockemu_t *device, BOOLEAN verbose, OUT run_t *result)
+{
+    device_t disk;
+
+    memset(result, 0, sizeof(*result));
+    memset(&disk, 0, sizeof(disk));
+    disk.handle = device;
+    disk.block_io = &device->block_io;
+
+    // Start from nothing cached, like a fresh boot
+    blockemu_reset(device);
+    UINT64 allocations_start = host_get_allocation_calls();
+    UINT64 start = host_clock();
+    UINT64 cpu_start = wall_clock();
+
+    EFI_STATUS status = probe_devices(&disk, 1, TRUE);
+    result->probe_ns = host_clock() - start;
+    result->probe_reads = device->stats.reads;
+    if (EFI_ERROR(status) || EFI_ERROR(disk.status))
+    {
+        if (verbose)
+            printf("Probe failed: %s\n", status_to_string(EFI_ERROR(status) ? status : disk.status));
+        result->failed = TRUE;
+        return EFI_ERROR(status) ? status : disk.status;
+    }
+
+    start = host_clock();
+    for (UINTN i = 0; i < disk.partition_count; ++i)
+    {
+        partition_info_t *partition = &disk.partitions[i];
+        const char *path = partition->filesystem.type == FS_EXT4 ? options->ext4_path : options->fat32_path;
+        const expected_t *expected = partition->filesystem.type == FS_EXT4 ? &options->ext4_expected : &options->fat32_expected;
+
+        // Read ahead the way the menu would while it waited (all of it, as if the user took their time)
+        BOOLEAN prefetched = options->prefetch && partition->filesystem.type == FS_EXT4 && path != NULL;
+        if (prefetched)
+        {
+            UINT64 prefetch_start_ns = host_clock();
+            UINT64 prefetch_start_reads = device->stats.reads;
+            prefetch_start(&device->block_io, partition, path);
+            while (prefetch_step())
+                ;
+            result->prefetch_ns += host_clock() - prefetch_start_ns;
+            result->prefetch_reads += device->stats.reads - prefetch_start_reads;
+        }
+
+        EFI_STATUS load_status = load_file(device, partition, path, prefetched, expected, &result->load_bytes);
+        if (prefetched)
+            prefetch_release();
+
+        // A partition without the file is fine, anything else is the disk code going wrong
+        if (EFI_ERROR(load_status) && load_status != EFI_UNSUPPORTED && load_status != EFI_NOT_FOUND)
+            result->failed = TRUE;
+        if (load_status == EFI_COMPROMISED_DATA)
+            ++result->mismatches;
+
+        if (verbose)
+        {
+            printf("%3lu | ", (unsigned long)i + 1);
+            print_name(partition->name, 24);
+            printf(" | %9lu | %-6s %3u%% | ", (unsigned long)(partition->size / (1024 * 1024)),
+                filesystem_names[partition->filesystem.type], partition->filesystem.confidence);
+            print_name(partition->filesystem.label, 16);
+            printf(" | %s%s\n", path != NULL && load_status != EFI_UNSUPPORTED ? path : "-",
+                path != NULL && load_status != EFI_UNSUPPORTED ? (EFI_ERROR(load_status) ? " FAILED" : " loaded") : "");
+            if (EFI_ERROR(load_status) && load_status != EFI_UNSUPPORTED)
+                printf("    %s\n", status_to_string(load_status));
+        }
+    }
+
+    result->load_ns = host_clock() - start - result->prefetch_ns;
+    result->load_reads = device->stats.reads - result->probe_reads - result->prefetch_reads;
+    result->cpu_ns = wall_clock() - cpu_start;
+    result->allocations = host_get_allocation_calls() - allocations_start;
+    return result->failed ? EFI_DEVICE_ERROR : EFI_SUCCESS;
+}
+
+// Helper function to sort for percentiles
+static int compare_u64(const void *a, const void *b)
+{
+    UINT64 x = *(const UINT64 *)a, y = *(const UINT64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Helper function to print the min, median and max of a measurement over every run
+static VOID print_spread(const char *name, UINT64 *values, UINTN count, double scale, const char *unit)
+{
+    qsort(values, count, sizeof(UINT64), compare_u64);
+    printf("  %-16s min %10.3f  median %10.3f  max %10.3f %s\n", name,
+        values[0] / scale, values[count / 2] / scale, values[count - 1] / scale, unit);
+}
+
+// Helper function to get the numeric value of an option (or its default)
+static UINT64 number_option(int argc, char **argv, const char *name, UINT64 value)
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], name) == 0)
+            return strtoull(argv[i + 1], NULL, 0);
+    }
+    return value;
+}
+
+// Helper function to get the string value of an option (or its default)
+static const char *string_option(int argc, char **argv, const char *name, const char *value)
+{
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (strcmp(argv[i], name) == 0)
+            return argv[i + 1];
+    }
+    return value;
+}
+
+// Helper function to check for a flag
+static BOOLEAN flag_option(int argc, char **argv, const char *name)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], name) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static VOID usage(VOID)
+{
+    printf("Usage: blockbench <image> [options]\n"
+        "Device:\n"
+        "  --block-size N       Bytes per block (default 512)\n"
+        "  --io-align N         Required buffer alignment (default 1)\n"
+        "  --granularity N      OptimalTransferLengthGranularity in blocks (default 1)\n"
+        "  --latency US         Cost of every request in microseconds (default 0)\n"
+        "  --bandwidth MB       Transfer rate in MB/s (default unlimited)\n"
+        "  --queue-depth N      BlockIo2 requests worked on at once (default 1)\n"
+        "  --no-block-io2       Only offer BlockIo\n"
+        "  --no-media           Report no media present\n"
+        "  --fail-lba N         Fail every read that touches block N\n"
+        "  --fail-every N       Fail every Nth read\n"
+        "Benchmark:\n"
+        "  --runs N             Repeat the probe and loads N times (default 1)\n"
+        "  --sweep              Repeat once per latency in a range instead\n"
+        "  --ext4-file PATH     File to load from EXT4 partitions (default /boot/kernel)\n"
+        "  --fat32-file PATH    File to load from FAT32 partitions (default /EFI/BOOT/BOOTX64.EFI)\n"
+        "  --ext4-expect FILE   Host file the EXT4 file has to match, failing if it doesn't\n"
+        "  --fat32-expect FILE  Host file the FAT32 file has to match, failing if it doesn't\n"
+        "  --prefetch           Read the start of each EXT4 file ahead first, like the boot menu, and time it apart\n");
+}
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    blockemu_t device;
+    static run_t runs[MAX_RUNS];
+
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    options.image = argv[1];
+    blockemu_default_config(&options.config);
+    options.config.block_size = number_option(argc, argv, "--block-size", 512);
+    options.config.io_align = number_option(argc, argv, "--io-align", 1);
+    options.config.transfer_granularity = number_option(argc, argv, "--granularity", 1);
+    options.config.latency_ns = number_option(argc, argv, "--latency", 0) * 1000;
+    options.config.bytes_per_second = number_option(argc, argv, "--bandwidth", 0) * 1000000;
+    options.config.queue_depth = number_option(argc, argv, "--queue-depth", 1);
+    options.config.block_io2 = !flag_option(argc, argv, "--no-block-io2");
+    options.config.media_present = !flag_option(argc, argv, "--no-media");
+    options.config.fail_lba = (INT64)number_option(argc, argv, "--fail-lba", (UINT64)-1);
+    options.config.fail_every = number_option(argc, argv, "--fail-every", 0);
+    options.runs = number_option(argc, argv, "--runs", 1);
+    options.sweep = flag_option(argc, argv, "--sweep");
+    options.ext4_path = string_option(argc, argv, "--ext4-file", "/boot/kernel");
+    options.fat32_path = string_option(argc, argv, "--fat32-file", "/EFI/BOOT/BOOTX64.EFI");
+    options.prefetch = flag_option(argc, argv, "--prefetch");
+
+    const char *expect_paths[] = { string_option(argc, argv, "--ext4-expect", NULL), string_option(argc, argv, "--fat32-expect", NULL) };
+    expected_t *expected[] = { &options.ext4_expected, &options.fat32_expected };
+    for (UINTN i = 0; i < 2; ++i)
+    {
+        if (!read_expected(expect_paths[i], expected[i]))
+        {
+            printf("Failed to read %s\n", expect_paths[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.runs == 0 || options.runs > MAX_RUNS)
+    {
+        printf("--runs must be from 1 to %d\n", MAX_RUNS);
+        return EXIT_FAILURE;
+    }
+
+    EFI_STATUS status = blockemu_open(&device, options.image, &options.config);
+    if (EFI_ERROR(status))
+    {
+        printf("Failed to open %s as a device: %s\n", options.image, status_to_string(status));
+        return EXIT_FAILURE;
+    }
+
+    // The disk code's cache and arena are only set up once, like in the bootloader (blockemu_reset stops the cache
+    // hitting across runs)
+    UINT64 base_pages, base_pool;
+    block_cache_init();
+    arena_init();
+    host_get_allocations(&base_pages, &base_pool);
+
+    // The first run prints what it found
+    printf("%s: %lu blocks of %u bytes, IoAlign %u, %s\n", options.image, (unsigned long)device.media.LastBlock + 1,
+        device.media.BlockSize, device.media.IoAlign, options.config.block_io2 ? "BlockIo2" : "BlockIo only");
+    printf(" id | Name                     | Size (MB) | Format       | Label            | File\n");
+    status = run(&options, &device, TRUE, &runs[0]);
+    UINT64 mismatches = runs[0].mismatches;
+
+    if (options.sweep)
+    {
+        printf("\nLatency sensitivity (%lu reads to probe, %lu to load):\n",
+            (unsigned long)runs[0].probe_reads, (unsigned long)runs[0].load_reads);
+        printf("  latency (us) |   probe (ms) |    load (ms) |   total (ms)\n");
+        for (UINTN i = 0; i < sizeof(sweep_latencies) / sizeof(sweep_latencies[0]); ++i)
+        {
+            run_t result;
+            device.config.latency_ns = sweep_latencies[i] * 1000;
+            run(&options, &device, FALSE, &result);
+            mismatches += result.mismatches;
+            printf("  %12lu | %12.3f | %12.3f | %12.3f\n", (unsigned long)sweep_latencies[i],
+                result.probe_ns / 1e6, result.load_ns / 1e6, (result.probe_ns + result.load_ns) / 1e6);
+        }
+    }
+    else
+    {
+        for (UINTN i = 1; i < options.runs; ++i)
+        {
+            run(&options, &device, FALSE, &runs[i]);
+            mismatches += runs[i].mismatches;
+        }
+
+        UINT64 values[MAX_RUNS];
+        printf("\n%lu run(s), device time is simulated and CPU time is real:\n", (unsigned long)options.runs);
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].probe_reads;
+        print_spread("probe reads", values, options.runs, 1, "");
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].probe_ns;
+        print_spread("probe device", values, options.runs, 1e6, "ms");
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].load_reads;
+        print_spread("load reads", values, options.runs, 1, "");
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].load_ns;
+        print_spread("load device", values, options.runs, 1e6, "ms");
+        if (options.prefetch)
+        {
+            for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].prefetch_reads;
+            print_spread("prefetch reads", values, options.runs, 1, "");
+            for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].prefetch_ns;
+            print_spread("prefetch device", values, options.runs, 1e6, "ms");
+        }
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].cpu_ns;
+        print_spread("cpu", values, options.runs, 1e6, "ms");
+        for (UINTN i = 0; i < options.runs; ++i) values[i] = runs[i].allocations;
+        print_spread("allocator calls", values, options.runs, 1, "");
+        printf("  loaded %lu bytes, %lu async reads, at most %lu in flight, %lu rejected, %lu failed on purpose\n",
+            (unsigned long)runs[0].load_bytes, (unsigned long)device.stats.async_reads,
+            (unsigned long)device.stats.max_in_flight, (unsigned long)device.stats.rejected, (unsigned long)device.stats.failed);
+        printf("  %lu reads started off a %u block granule\n", (unsigned long)device.stats.off_granule,
+            device.config.transfer_granularity);
+    }
+
+    UINT64 pages, pool;
+    host_get_allocations(&pages, &pool);
+    printf("  leaked: %lu pages, %lu pool bytes\n", (unsigned long)(pages - base_pages), (unsigned long)(pool - base_pool));
+
+    arena_stats_t arena_stats;
+    arena_get_stats(&arena_stats);
+    printf("  arena: high water %lu KB of %lu KB in %lu chunk(s)\n", (unsigned long)arena_stats.high_water / 1024,
+        (unsigned long)arena_stats.reserved / 1024, (unsigned long)arena_stats.chunk_count);
+
+    if (options.ext4_expected.path != NULL || options.fat32_expected.path != NULL)
+        printf("  %lu loaded file(s) didn't match the expected ones\n", (unsigned long)mismatches);
+
+    blockemu_close(&device);
+    free(options.ext4_expected.data);
+    free(options.fat32_expected.data);
+
+    // Injected faults are expected to make things fail, anything else failing is a bug (and a fault should make a read
+    // fail, never hand back the wrong bytes)
+    BOOLEAN faults = options.config.fail_lba >= 0 || options.config.fail_every != 0 || !options.config.media_present;
+    return (EFI_ERROR(status) && !faults) || mismatches > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
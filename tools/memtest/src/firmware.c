@@ -0,0 +1,166 @@
+#include "firmware.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    UINT64 address;
+    UINTN pages;
+    EFI_MEMORY_TYPE type;
+} allocation_t;
+
+static firmware_map_t current;
+static allocation_t allocations[FIRMWARE_MAX_ALLOCATIONS];
+static UINTN allocation_count = 0;
+static UINTN allocation_calls = 0;
+static BOOLEAN exited = FALSE;
+static BOOLEAN key_failed = FALSE;
+static UINTN calls_after_exit = 0;
+
+static EFI_BOOT_SERVICES boot_services;
+static EFI_SYSTEM_TABLE system_table;
+EFI_SYSTEM_TABLE *ST = &system_table;
+EFI_BOOT_SERVICES *BS = &boot_services;
+
+// Helper function to tell whether the map has changed yet
+static BOOLEAN has_grown(VOID)
+{
+    return current.grown != NULL && allocation_calls >= current.grow_after;
+}
+
+// --------------------------
+// Boot services
+// --------------------------
+
+static EFI_STATUS get_memory_map(UINTN *map_size, EFI_MEMORY_DESCRIPTOR *map, UINTN *map_key, UINTN *descriptor_size,
+    UINT32 *descriptor_version)
+{
+    if (exited)
+        ++calls_after_exit;
+
+    const EFI_MEMORY_DESCRIPTOR *descriptors = has_grown() ? current.grown : current.descriptors;
+    UINTN count = has_grown() ? current.grown_count : current.count;
+    UINTN needed = count * FIRMWARE_DESCRIPTOR_SIZE;
+
+    *descriptor_size = FIRMWARE_DESCRIPTOR_SIZE;
+    *descriptor_version = 1;
+    *map_key = has_grown() ? 2 : 1;
+    if (*map_size < needed || map == NULL)
+    {
+        *map_size = needed;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    // Fill the padding too, so anything reading past the struct gets garbage rather than zeroes
+    memset(map, 0xA5, needed);
+    for (UINTN i = 0; i < count; ++i)
+        memcpy((UINT8 *)map + i * FIRMWARE_DESCRIPTOR_SIZE, &descriptors[i], sizeof(EFI_MEMORY_DESCRIPTOR));
+    *map_size = needed;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS exit_boot_services(EFI_HANDLE image_handle, UINTN map_key)
+{
+    if (exited)
+        ++calls_after_exit;
+
+    if (current.stale_key && !key_failed)
+    {
+        key_failed = TRUE;
+        return EFI_INVALID_PARAMETER;
+    }
+    if (map_key != (has_grown() ? 2 : 1))
+        return EFI_INVALID_PARAMETER;
+
+    exited = TRUE;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS allocate_pages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_type, UINTN pages, EFI_PHYSICAL_ADDRESS *memory)
+{
+    if (exited)
+        ++calls_after_exit;
+    if (type != AllocateAnyPages || allocation_count == FIRMWARE_MAX_ALLOCATIONS)
+        return EFI_OUT_OF_RESOURCES;
+
+    VOID *address = aligned_alloc(EFI_PAGE_SIZE, pages * EFI_PAGE_SIZE);
+    if (address == NULL)
+        return EFI_OUT_OF_RESOURCES;
+
+    allocations[allocation_count].address = (UINT64)(UINTN)address;
+    allocations[allocation_count].pages = pages;
+    allocations[allocation_count].type = memory_type;
+    ++allocation_count;
+    ++allocation_calls;
+    *memory = (EFI_PHYSICAL_ADDRESS)(UINTN)address;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS free_pages(EFI_PHYSICAL_ADDRESS memory, UINTN pages)
+{
+    if (exited)
+        ++calls_after_exit;
+
+    for (UINTN i = 0; i < allocation_count; ++i)
+    {
+        if (allocations[i].address != memory || allocations[i].pages != pages)
+            continue;
+
+        free((VOID *)(UINTN)memory);
+        allocations[i] = allocations[--allocation_count];
+        return EFI_SUCCESS;
+    }
+    return EFI_NOT_FOUND;
+}
+
+// --------------------------
+// Test control
+// --------------------------
+
+VOID firmware_reset(const firmware_map_t *map)
+{
+    firmware_free_all();
+    memset(&boot_services, 0, sizeof(boot_services));
+    boot_services.GetMemoryMap = get_memory_map;
+    boot_services.ExitBootServices = exit_boot_services;
+    boot_services.AllocatePages = allocate_pages;
+    boot_services.FreePages = free_pages;
+    system_table.BootServices = &boot_services;
+
+    current = *map;
+    allocation_calls = 0;
+    exited = FALSE;
+    key_failed = FALSE;
+    calls_after_exit = 0;
+}
+
+EFI_MEMORY_TYPE firmware_allocation_type(UINT64 address)
+{
+    for (UINTN i = 0; i < allocation_count; ++i)
+    {
+        if (allocations[i].address == address)
+            return allocations[i].type;
+    }
+    return EfiMaxMemoryType;
+}
+
+UINTN firmware_outstanding(VOID)
+{
+    return allocation_count;
+}
+
+VOID firmware_free_all(VOID)
+{
+    while (allocation_count > 0)
+        free((VOID *)(UINTN)allocations[--allocation_count].address);
+}
+
+BOOLEAN firmware_exited(VOID)
+{
+    return exited;
+}
+
+UINTN firmware_calls_after_exit(VOID)
+{
+    return calls_after_exit;
+}
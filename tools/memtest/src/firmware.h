@@ -0,0 +1,40 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// Bytes per descriptor the fake firmware hands out (more than the struct, like real firmware, so the stride matters)
+#define FIRMWARE_DESCRIPTOR_SIZE 48
+
+// Most allocations that can be outstanding at once
+#define FIRMWARE_MAX_ALLOCATIONS 16
+
+// The memory map GetMemoryMap reports, which can change part way through like the real one does
+typedef struct
+{
+    const EFI_MEMORY_DESCRIPTOR *descriptors;
+    UINTN count;
+    const EFI_MEMORY_DESCRIPTOR *grown;     // The map once grow_after pages allocations have been made (NULL to keep it)
+    UINTN grown_count;
+    UINTN grow_after;
+    BOOLEAN stale_key;                      // Fail the first ExitBootServices as if the map changed under it
+} firmware_map_t;
+
+// Start again with a new map (nothing can be left allocated from the last one)
+VOID firmware_reset(const firmware_map_t *map);
+
+// The memory type a pages allocation was made with (EfiMaxMemoryType if address isn't the start of one)
+EFI_MEMORY_TYPE firmware_allocation_type(UINT64 address);
+
+// Pages allocations that haven't been freed
+UINTN firmware_outstanding(VOID);
+
+// Free everything still allocated
+VOID firmware_free_all(VOID);
+
+// Whether ExitBootServices succeeded, and how many boot services were called after it did
+BOOLEAN firmware_exited(VOID);
+UINTN firmware_calls_after_exit(VOID);
+
+#endif
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "firmware.h"
+#include "memory.h"
+
+#define D(type, start, pages) { (type), 0, (start), 0, (pages), 0 }
+#define R(start, pages, type) { (start), (pages), (type), 0 }
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// Pages the timing map covers (16GB), in pieces with a hole after each
+#define LARGE_DESCRIPTORS 4096
+#define LARGE_PAGES (4ULL * 1024 * 1024)
+
+typedef struct
+{
+    const char *name;
+    firmware_map_t map;
+    EFI_STATUS status;                      // What memory_exit_boot_services should return
+    const boot_memory_range_t *ranges;
+    UINTN range_count;
+    UINT64 free_pages;
+} test_case_t;
+
+// Listed out of order, with free memory next to reclaimable memory (which doesn't merge with it)
+static const EFI_MEMORY_DESCRIPTOR unsorted_map[] = {
+    D(EfiConventionalMemory, 0x200000, 16),
+    D(EfiBootServicesData, 0x100000, 16),
+    D(EfiReservedMemoryType, 0x0, 1),
+    D(EfiConventionalMemory, 0x110000, 16),
+    D(EfiLoaderData, 0x120000, 8),
+    D(EfiBootServicesCode, 0x300000, 4),
+};
+static const boot_memory_range_t unsorted_ranges[] = {
+    R(0x100000, 16, BOOT_MEMORY_RECLAIMABLE),
+    R(0x110000, 16, BOOT_MEMORY_FREE),
+    R(0x200000, 16, BOOT_MEMORY_FREE),
+    R(0x300000, 4, BOOT_MEMORY_RECLAIMABLE),
+};
+
+// Neighbours of the same type merge (both boot services types count as reclaimable), a gap stops them
+static const EFI_MEMORY_DESCRIPTOR adjacent_map[] = {
+    D(EfiConventionalMemory, 0x1000, 15),
+    D(EfiConventionalMemory, 0x10000, 16),
+    D(EfiBootServicesCode, 0x20000, 8),
+    D(EfiBootServicesData, 0x28000, 8),
+    D(EfiConventionalMemory, 0x30000, 16),
+    D(EfiConventionalMemory, 0x41000, 16),
+    D(EfiMemoryMappedIO, 0xFEC00000, 1),
+};
+static const boot_memory_range_t adjacent_ranges[] = {
+    R(0x1000, 31, BOOT_MEMORY_FREE),
+    R(0x20000, 16, BOOT_MEMORY_RECLAIMABLE),
+    R(0x30000, 16, BOOT_MEMORY_FREE),
+    R(0x41000, 16, BOOT_MEMORY_FREE),
+};
+
+// Empty descriptors don't make ranges, and don't stop the ones on either side merging
+static const EFI_MEMORY_DESCRIPTOR zero_pages_map[] = {
+    D(EfiConventionalMemory, 0x0, 0),
+    D(EfiConventionalMemory, 0x100000, 8),
+    D(EfiConventionalMemory, 0x108000, 0),
+    D(EfiConventionalMemory, 0x108000, 8),
+    D(EfiBootServicesData, 0x400000, 0),
+};
+static const boot_memory_range_t zero_pages_ranges[] = {
+    R(0x100000, 16, BOOT_MEMORY_FREE),
+};
+
+// Page 0 is free, but never handed out (0 is what running out looks like)
+static const EFI_MEMORY_DESCRIPTOR page_zero_map[] = {
+    D(EfiConventionalMemory, 0x0, 160),
+    D(EfiConventionalMemory, 0x100000, 64),
+};
+static const boot_memory_range_t page_zero_ranges[] = {
+    R(0x0, 160, BOOT_MEMORY_FREE),
+    R(0x100000, 64, BOOT_MEMORY_FREE),
+};
+
+// The map changes once the buffers are allocated: they carve loader data out of a free range, and the firmware adds
+// free ranges either side of what the bitmap was sized for (those are listed but left out of the bitmap)
+static const EFI_MEMORY_DESCRIPTOR grown_before_map[] = {
+    D(EfiConventionalMemory, 0x100000, 256),
+    D(EfiBootServicesData, 0x200000, 64),
+};
+static const EFI_MEMORY_DESCRIPTOR grown_after_map[] = {
+    D(EfiConventionalMemory, 0x100000, 200),
+    D(EfiLoaderData, 0x1C8000, 56),
+    D(EfiBootServicesData, 0x200000, 64),
+    D(EfiConventionalMemory, 0x240000, 32),
+    D(EfiConventionalMemory, 0x80000, 16),
+};
+static const boot_memory_range_t grown_ranges[] = {
+    R(0x80000, 16, BOOT_MEMORY_FREE),
+    R(0x100000, 200, BOOT_MEMORY_FREE),
+    R(0x200000, 64, BOOT_MEMORY_RECLAIMABLE),
+    R(0x240000, 32, BOOT_MEMORY_FREE),
+};
+
+// The map grows past the slack left for it, so leaving has to fail without anything staying allocated
+static EFI_MEMORY_DESCRIPTOR overflow_map[200];
+
+static EFI_MEMORY_DESCRIPTOR large_map[LARGE_DESCRIPTORS * 2];
+
+// Helper function to get real time in nanoseconds
+static UINT64 wall_clock(VOID)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Helper function to count the pages marked free in the bitmap
+static UINT64 count_bitmap(boot_memory_t *memory)
+{
+    UINT64 *bitmap = (UINT64 *)(UINTN)memory->bitmap;
+    UINT64 count = 0;
+    for (UINT64 i = 0; i < (memory->page_count + 63) / 64; ++i)
+        count += __builtin_popcountll(bitmap[i]);
+    return count;
+}
+
+// Helper function to check an address is a page in a free range, inside the span the bitmap covers
+static BOOLEAN is_free_page(boot_memory_t *memory, UINT64 address)
+{
+    boot_memory_range_t *ranges = (boot_memory_range_t *)(UINTN)memory->ranges;
+    UINT64 page = address / EFI_PAGE_SIZE;
+
+    if (address % EFI_PAGE_SIZE != 0 || page == 0 || page < memory->first_page
+        || page >= memory->first_page + memory->page_count)
+        return FALSE;
+
+    for (UINT64 i = 0; i < memory->range_count; ++i)
+    {
+        if (ranges[i].type == BOOT_MEMORY_FREE && address >= ranges[i].start
+            && address < ranges[i].start + ranges[i].pages * EFI_PAGE_SIZE)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// Helper function to take every page, check each one, and give them all back
+static BOOLEAN drain(const char *name, boot_memory_t *memory, UINT64 *allocate_ns, UINT64 *free_ns)
+{
+    UINT64 expected = memory->free_pages;
+    UINT64 *pages = malloc((expected + 1) * sizeof(UINT64));
+    UINT64 count = 0;
+    BOOLEAN ok = TRUE;
+
+    UINT64 start = wall_clock();
+    for (UINT64 address; (address = boot_memory_allocate_page(memory)) != 0 && count <= expected;)
+        pages[count++] = address;
+    *allocate_ns = wall_clock() - start;
+
+    if (count != expected || memory->free_pages != 0 || boot_memory_allocate_page(memory) != 0)
+    {
+        printf("%s: got %lu pages of %lu before running out\n", name, (unsigned long)count, (unsigned long)expected);
+        ok = FALSE;
+    }
+    for (UINT64 i = 0; i < count && ok; ++i)
+    {
+        if (!is_free_page(memory, pages[i]))
+        {
+            printf("%s: handed out 0x%lx, which isn't a free page\n", name, (unsigned long)pages[i]);
+            ok = FALSE;
+        }
+    }
+
+    start = wall_clock();
+    for (UINT64 i = 0; i < count; ++i)
+        boot_memory_free_page(memory, pages[i]);
+    *free_ns = wall_clock() - start;
+
+    // Freeing twice does nothing, and the lowest page comes back first
+    if (count > 0)
+        boot_memory_free_page(memory, pages[0]);
+    if (memory->free_pages != expected || count_bitmap(memory) != expected
+        || (count > 0 && boot_memory_allocate_page(memory) != pages[0]))
+    {
+        printf("%s: %lu pages free after giving them back, not %lu\n", name, (unsigned long)memory->free_pages,
+            (unsigned long)expected);
+        ok = FALSE;
+    }
+
+    free(pages);
+    return ok;
+}
+
+// Helper function to run a case, FALSE if anything about it was wrong
+static BOOLEAN run(const test_case_t *test, BOOLEAN timed)
+{
+    static boot_info_t boot_info;
+    boot_memory_t *memory = &boot_info.memory;
+    BOOLEAN ok = TRUE;
+
+    memset(&boot_info, 0, sizeof(boot_info));
+    firmware_reset(&test->map);
+
+    UINT64 start = wall_clock();
+    EFI_STATUS status = memory_exit_boot_services(NULL, &boot_info);
+    UINT64 exit_ns = wall_clock() - start;
+
+    if (status != test->status)
+    {
+        printf("%s: returned 0x%lx, not 0x%lx\n", test->name, (unsigned long)status, (unsigned long)test->status);
+        return FALSE;
+    }
+    if (firmware_calls_after_exit() != 0)
+    {
+        printf("%s: %lu boot services called after leaving them\n", test->name, (unsigned long)firmware_calls_after_exit());
+        ok = FALSE;
+    }
+    if (EFI_ERROR(status))
+    {
+        if (firmware_exited() || firmware_outstanding() != 0)
+        {
+            printf("%s: failed but left %lu allocation(s) behind\n", test->name, (unsigned long)firmware_outstanding());
+            ok = FALSE;
+        }
+        printf("%-12s %s\n", test->name, ok ? "ok" : "FAILED");
+        return ok;
+    }
+
+    // The map the kernel keeps has to be somewhere it won't reclaim
+    if (firmware_allocation_type(memory->efi_map) != EfiLoaderData || firmware_allocation_type(memory->region) != EfiLoaderData)
+    {
+        printf("%s: the map or the region isn't loader data\n", test->name);
+        ok = FALSE;
+    }
+    if (memory->first_page == 0)
+    {
+        printf("%s: page 0 is in the bitmap\n", test->name);
+        ok = FALSE;
+    }
+
+    if (test->ranges != NULL)
+    {
+        boot_memory_range_t *ranges = (boot_memory_range_t *)(UINTN)memory->ranges;
+        BOOLEAN same = memory->range_count == test->range_count;
+        for (UINTN i = 0; same && i < test->range_count; ++i)
+        {
+            same = ranges[i].start == test->ranges[i].start && ranges[i].pages == test->ranges[i].pages
+                && ranges[i].type == test->ranges[i].type;
+        }
+        if (!same)
+        {
+            printf("%s: ranges don't match:\n", test->name);
+            for (UINT64 i = 0; i < memory->range_count; ++i)
+                printf("  0x%lx %lu pages, type %u\n", (unsigned long)ranges[i].start, (unsigned long)ranges[i].pages, ranges[i].type);
+            ok = FALSE;
+        }
+    }
+
+    if (memory->free_pages != test->free_pages || count_bitmap(memory) != test->free_pages)
+    {
+        printf("%s: %lu free pages (%lu in the bitmap), not %lu\n", test->name, (unsigned long)memory->free_pages,
+            (unsigned long)count_bitmap(memory), (unsigned long)test->free_pages);
+        ok = FALSE;
+    }
+
+    UINT64 allocate_ns, free_ns;
+    if (ok)
+        ok = drain(test->name, memory, &allocate_ns, &free_ns);
+
+    printf("%-12s %s", test->name, ok ? "ok" : "FAILED");
+    if (ok && timed)
+    {
+        printf(" (%lu descriptors, %lu ranges, %lu pages: exit %.3f ms, %.1f ns per allocation, %.1f ns per free)",
+            (unsigned long)(test->map.grown != NULL ? test->map.grown_count : test->map.count),
+            (unsigned long)memory->range_count, (unsigned long)test->free_pages, exit_ns / 1e6,
+            (double)allocate_ns / test->free_pages, (double)free_ns / test->free_pages);
+    }
+    printf("\n");
+
+    firmware_free_all();
+    return ok;
+}
+
+// Helper function to make the timing map: free pieces with holes between them, listed in a shuffled order
+static UINT64 make_large_map(VOID)
+{
+    UINT64 pages_each = LARGE_PAGES / LARGE_DESCRIPTORS;
+    UINT64 free_pages = 0;
+
+    for (UINTN i = 0; i < LARGE_DESCRIPTORS; ++i)
+    {
+        UINT64 start = 0x100000 + i * (pages_each + 1) * EFI_PAGE_SIZE;
+        EFI_MEMORY_DESCRIPTOR piece = D(i % 3 == 0 ? EfiBootServicesData : EfiConventionalMemory, start, pages_each);
+        EFI_MEMORY_DESCRIPTOR hole = D(EfiRuntimeServicesData, start + pages_each * EFI_PAGE_SIZE, 1);
+        large_map[i * 2] = piece;
+        large_map[i * 2 + 1] = hole;
+        if (i % 3 != 0)
+            free_pages += pages_each;
+    }
+
+    srand(1);
+    for (UINTN i = COUNT(large_map) - 1; i > 0; --i)
+    {
+        UINTN j = rand() % (i + 1);
+        EFI_MEMORY_DESCRIPTOR swap = large_map[i];
+        large_map[i] = large_map[j];
+        large_map[j] = swap;
+    }
+    return free_pages;
+}
+
+int main(int argc, char **argv)
+{
+    for (UINTN i = 0; i < COUNT(overflow_map); ++i)
+    {
+        EFI_MEMORY_DESCRIPTOR piece = D(EfiConventionalMemory, 0x100000 + i * 2 * EFI_PAGE_SIZE, 1);
+        overflow_map[i] = piece;
+    }
+    UINT64 large_free = make_large_map();
+
+    const test_case_t tests[] = {
+        { "unsorted", { unsorted_map, COUNT(unsorted_map) }, EFI_SUCCESS, unsorted_ranges, COUNT(unsorted_ranges), 32 },
+        { "adjacent", { adjacent_map, COUNT(adjacent_map) }, EFI_SUCCESS, adjacent_ranges, COUNT(adjacent_ranges), 63 },
+        { "zero-pages", { zero_pages_map, COUNT(zero_pages_map) }, EFI_SUCCESS, zero_pages_ranges, COUNT(zero_pages_ranges), 16 },
+        { "page-zero", { page_zero_map, COUNT(page_zero_map) }, EFI_SUCCESS, page_zero_ranges, COUNT(page_zero_ranges), 223 },
+        { "grown", { grown_before_map, COUNT(grown_before_map), grown_after_map, COUNT(grown_after_map), 2, TRUE },
+            EFI_SUCCESS, grown_ranges, COUNT(grown_ranges), 200 },
+        { "overflow", { overflow_map, 4, overflow_map, COUNT(overflow_map), 2 }, EFI_BUFFER_TOO_SMALL, NULL, 0, 0 },
+        { "large", { large_map, COUNT(large_map) }, EFI_SUCCESS, NULL, 0, large_free },
+    };
+
+    UINTN failed = 0;
+    for (UINTN i = 0; i < COUNT(tests); ++i)
+    {
+        if (!run(&tests[i], tests[i].ranges == NULL))
+            ++failed;
+    }
+
+    printf("%lu of %lu passed\n", (unsigned long)(COUNT(tests) - failed), (unsigned long)COUNT(tests));
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}